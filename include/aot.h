@@ -0,0 +1,53 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sim.h"
+
+/**
+ * This file contains the ahead-of-time translator, which turns an assembled program into C with one label per
+ * instruction, compiles it with the system compiler into a shared library and loads it with dlopen. Registers and
+ * flags live in locals of the one generated function and every branch is a goto to a constant label, so the compiler
+ * can keep the whole machine in host registers and drop flag updates nothing reads.
+ *
+ * The step budget is checked once per basic block, for the whole block. The generated code hands control back to the
+ * interpreter for the INPUT instructions and for the few instructions left when the budget runs out partway through a
+ * block, and the interpreter finishes the run on its own once the program has written its own code, so a run stops
+ * in exactly the same state as sim_run would leave it in.
+ */
+
+// the compiler to run, when the CC environment variable does not name one
+#define AOT_DEFAULT_CC "cc"
+
+// the function the generated library exports, it runs from *pc until it halts or needs the interpreter and returns
+// one of the AOT_EXIT_* codes, *left counts down the instructions it may still run
+typedef int (*AotEntry)(uint8_t *regs, uint8_t *flags, uint16_t *pc, uint8_t *dmem, uint64_t *left);
+
+#define AOT_EXIT_HALTED 0 // the PC left the program
+#define AOT_EXIT_INTERP 1 // the instruction at *pc has to be run by the interpreter
+
+typedef struct {
+    void *handle; // the loaded library, NULL if the program has not been compiled
+    AotEntry run;
+    uint16_t code[TARGET_CSEG_MAX]; // the program that was compiled
+    size_t code_len;
+} AotProgram;
+
+// writes the program as a C translation unit exporting the AotEntry function i281_run
+void aot_translate(const uint16_t *code, size_t code_len, FILE *out);
+
+// translates and compiles the program and loads the result, returns false if it does not fit in code memory or the
+// compiler or dlopen failed, which have been reported on stdout
+bool aot_compile(AotProgram *prog, const uint16_t *code, size_t code_len);
+
+// the compiled version of sim_run, with the same arguments and the same results
+// falls back to sim_run when the state holds some other program than the one that was compiled
+SimStatus aot_run(const AotProgram *prog, SimState *state, const SimInput *input, uint64_t max_steps);
+
+void aot_free(AotProgram *prog);
+
+#endif
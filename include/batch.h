@@ -0,0 +1,34 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * This file contains the batch runner, which simulates assembled programs against many input vectors at once. The
+ * list file names one .bin image and one vector file per line:
+ *   BubbleSort.bin sort.vec
+ * and every line of a vector file is one run, the values read by the INPUT instructions followed by the data memory
+ * expected once the program ends:
+ *   7, 3, 2 => 0=2 1=3 2=7
+ * Runs are spread over worker threads that each own a range of the runs and steal from each other when they finish
+ * early, and every run writes only its own result slot, so the workers share nothing mutable but the ranges.
+ * With lockstep set each worker takes up to LOCKSTEP_LANES runs of the same program at a time and runs them together
+ * on the lockstep simulator, which gives the same results. With aot set each program is compiled to native code
+ * before the workers start and every run uses that instead.
+ */
+
+typedef struct {
+    int threads; // worker threads, 0 for one per core
+    const char *report; // file to write the report to, NULL for stdout
+    bool lockstep; // run the vectors of a program together on the lockstep simulator
+    bool aot; // compile each program to native code and run the vectors on that
+} BatchOptions;
+
+// runs every vector listed in list_path, returns 0 if all of them passed and -1 otherwise
+int run_batch(const char *list_path, const BatchOptions *opts);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "ir.h"
+#include "expr.h"
+
+/**
+ * This file contains the control flow pass, which cleans up the code segment once every branch offset is resolved.
+ * It threads JUMPs and branches that land on a JUMP straight to the final target, deletes branches to the
+ * instruction that follows them anyway and deletes every block that cannot be reached from the first instruction,
+ * then re-resolves the offsets of the branches that are left.
+ */
+
+typedef struct {
+    bool skipped; // the program writes its own code or uses a code label as a value, so nothing was changed
+    int threaded; // branches retargeted past a JUMP
+    int fallthrough; // branches to the next instruction deleted
+    int unreachable; // unreachable instructions deleted
+    size_t words_before;
+    size_t words_after;
+} CfgStats;
+
+// finds where every branch goes, -1 for instructions that are not branches, and returns false if code cannot be
+// moved around without changing what the program does
+bool cfg_find_targets(const InstIR *ir, const SymbolTable *syms, int *target);
+
+// checks that no branch can read the flags before an instruction sets them again, starting at instruction i
+// every instruction that sets flags sets all four, and the end of the program counts as setting them
+bool cfg_flags_dead(const InstIR *ir, const int *target, int i);
+
+// runs the pass on the IR, the symbol table is only used to tell which operands refer to code labels
+// returns false if memory could not be allocated, in which case the IR is left unchanged
+bool cfg_optimize(InstIR *ir, const SymbolTable *syms, CfgStats *stats);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef DATA_H
+#define DATA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "expr.h"
+#include "ir.h"
+#include "diag.h"
+
+/**
+ * This file contains the parsers for the data segment and for .equ constants. Each data declaration is parsed in a
+ * single pass straight into the data image, and may hold any mix of:
+ *   expressions       array BYTE 7, 0x03, 'a', SIZE-1
+ *   reservations      temp  BYTE ?
+ *   strings           msg   BYTE "hi\n"
+ *   repeated groups   table BYTE 4 DUP(0), 2 DUP(1, 2 DUP(?))
+ * A declaration without a name continues the data of the one before it.
+ */
+
+// checks whether a line is a .equ directive
+bool is_equ(const char *line);
+
+// defines the constant declared on the line, then blanks the line so later passes skip it
+// returns false if the directive was invalid, the problem is reported to diags
+bool parse_equ_line(char *line, int line_num, SymbolTable *syms, DiagList *diags);
+
+// parse_equ_line for lines[i]
+bool parse_equ(char **lines, int i, SymbolTable *syms, DiagList *diags);
+
+// defines every .equ constant that has not been handled yet, returns the number defined
+int parse_equs(char **lines, int lines_len, SymbolTable *syms, DiagList *diags);
+
+// parses one data declaration, adding its label to the symbol table and its values to data
+// returns 1 if a label was defined and 0 otherwise, problems are reported to diags
+int parse_data_line(const char *line, int line_num, SymbolTable *syms, DataImage *data, size_t limit, DiagList *diags);
+
+// parses the data segment starting at the segment declaration on lines[offset], ending at the code segment
+// labels are added to the symbol table and their values appended to data, which may grow to at most limit bytes
+// returns the number of labels read, problems are reported to diags
+int parse_dseg(char **lines, int offset, int lines_len, SymbolTable *syms, DataImage *data, size_t limit, DiagList *diags);
+
+#endif
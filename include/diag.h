@@ -0,0 +1,71 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+
+/**
+ * This file contains the diagnostics list. Errors and warnings are collected with their position and a code while the
+ * program is assembled, so one run reports every problem in the file, and are printed together at the end either as
+ * text or as JSON for tools that fix the source automatically.
+ */
+
+#define DIAG_ERROR 0
+#define DIAG_WARNING 1
+
+// error codes, printed as E001, E002, ... and warning codes, printed as W001, ...
+#define E_UNKNOWN_INST 1 // the mnemonic is not an i281 instruction
+#define E_MISSING_OPERAND 2 // an operand or separator is missing
+#define E_BAD_REGISTER 3 // a register is not one of A-D
+#define E_BAD_EXPR 4 // an operand expression could not be evaluated
+#define E_RANGE 5 // a value does not fit in its field
+#define E_TRAILING 6 // there is unexpected text after the operands
+#define E_MISSING_BRACKET 7 // an address is missing its closing bracket
+#define E_MISSING_INDEX 8 // an indexed address does not add a register
+#define E_DUP_SYMBOL 9 // a label or constant is defined twice
+#define E_BAD_DIRECTIVE 10 // a directive or data declaration is malformed
+#define E_DSEG_FULL 11 // the data segment does not fit in data memory
+#define E_BAD_CHAR 12 // the source contains a NUL byte, which would cut its line short
+#define W_CSEG_FULL 1 // the program does not fit in code memory
+
+typedef struct {
+    int severity;
+    int code;
+    int line; // starting at 1
+    int col; // starting at 1
+    char *msg;
+} Diagnostic;
+
+typedef struct {
+    const char *file; // name printed with every diagnostic
+    Diagnostic *items;
+    int len;
+    int cap;
+    int errors;
+    int warnings;
+    int dropped; // diagnostics that were counted but could not be stored because memory ran out
+} DiagList;
+
+void diag_init(DiagList *diags, const char *file);
+
+// removes every diagnostic but keeps the memory for the next run
+void diag_clear(DiagList *diags);
+
+void diag_free(DiagList *diags);
+
+// a diagnostic that cannot be stored for lack of memory is still counted, so it fails the assembly all the same
+void diag_report(DiagList *diags, int severity, int code, int line, int col, const char *fmt, ...) __attribute__((format(printf, 6, 7)));
+
+void diag_vreport(DiagList *diags, int severity, int code, int line, int col, const char *fmt, va_list ap);
+
+// copies every diagnostic in from to the end of diags, along with the count of the ones from could not store
+void diag_append(DiagList *diags, const DiagList *from);
+
+// prints the diagnostics sorted by position, as file:line:col text or as a JSON array
+void diag_print(DiagList *diags, FILE *f, bool json);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * This file contains the symbol table and the operand expression evaluator. Expressions are folded to a constant
+ * while assembling, and may use decimal, hex (0x), binary (0b) and character ('c') literals, .equ constants, data
+ * and code labels, parentheses and the usual C arithmetic and bitwise operators.
+ */
+
+typedef enum {
+    SYM_CONST, // defined with .equ
+    SYM_DATA, // a label in the data segment, its value is the start address
+    SYM_CODE // a branch label in the code segment, its value is the instruction address
+} SymbolKind;
+
+typedef struct {
+    char *name;
+    int32_t value;
+    SymbolKind kind;
+} Symbol;
+
+typedef struct {
+    Symbol *syms;
+    int len;
+    int cap;
+    int *index; // open addressed hash of the names, each slot holds a position in syms plus one, or 0 if it is empty
+    int index_cap; // a power of two, kept at least twice len
+} SymbolTable;
+
+void init_symbols(SymbolTable *table);
+
+// removes every symbol but keeps the memory for the next run
+void clear_symbols(SymbolTable *table);
+
+void free_symbols(SymbolTable *table);
+
+// removes every symbol added after the first len, keeping the ones before them where they are
+void truncate_symbols(SymbolTable *table, int len);
+
+// adds a symbol, returns false if the name is already defined or memory could not be allocated
+bool add_symbol(SymbolTable *table, const char *name, size_t name_len, int32_t value, SymbolKind kind);
+
+// returns the index of the symbol with the given name, or -1 if it is not defined
+int find_symbol(const SymbolTable *table, const char *name, size_t name_len);
+
+typedef struct {
+    int32_t value;
+    char reg; // register added to the address by an indexed operand such as [array+B+1], 0 if there is none
+    uint8_t kinds; // bitmask of (1 << SymbolKind) for every kind of symbol the expression referenced
+    int sym_ref; // index of the first symbol referenced, or -1
+    bool undefined; // evaluation failed on a symbol that is not defined, which a later definition may fix
+    bool overflow; // evaluation failed on a number or a result that does not fit in 32 bits, a range error
+} ExprValue;
+
+// evaluates the expression at *s and advances *s past it
+// when allow_reg is set, one register may be added to the expression to form an indexed address
+// on failure a description of the problem is written to err
+bool eval_expr(const char **s, const SymbolTable *syms, bool allow_reg, ExprValue *out, char *err, size_t err_len);
+
+#endif
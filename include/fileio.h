@@ -0,0 +1,29 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * This file contains helpers for reading source files and writing output files. Outputs are replaced atomically and
+ * only when their contents change, so tools watching them are not triggered by a rebuild that produced the same thing.
+ */
+
+// reads the whole file into *buf, growing it if *cap is too small, the contents are always null terminated
+bool read_file(const char *path, char **buf, size_t *cap, size_t *len);
+
+// writes data to path through a temporary file and a rename, skipping the write if the file already holds data
+// returns 1 if the file was written, 0 if it was already up to date and -1 on error
+int write_file_if_changed(const char *path, const char *data, size_t len);
+
+// returns a newly allocated name for a temporary file next to path, for outputs too large to build in memory
+char *temp_path(const char *path);
+
+// moves a finished temporary file over path, or removes it if path already holds the same contents
+// returns like write_file_if_changed
+int replace_file_if_changed(const char *tmp_path, const char *path);
+
+#endif
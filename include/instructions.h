@@ -6,75 +6,46 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include "expr.h"
+#include "ir.h"
+#include "diag.h"
+#include "isa.h"
+#include "target.h"
 
 /**
- * This file contains function declarations for each of the assembly instructions so that they can be parsed properly. 
+ * This file contains the instruction parser, which reads the operands of any instruction in the isa.h table and
+ * encodes it, along with the operand ranges it checks against. The memory sizes come from the target in target.h.
  */
 
 typedef struct {
-    char *inst;
     uint16_t opcode;
+    uint8_t operand_kinds; // bitmask of OPND_* values
 } ParsedInstruction;
 
-// convenience function to add the name as a string to a ParsedInstruction struct
-void add_inst_name(ParsedInstruction *inst, char *name);
+// everything an instruction parser needs to know besides the line itself
+typedef struct {
+    const SymbolTable *syms; // .equ constants and data and code labels
+    int pc; // address of the instruction being parsed, used to turn branch labels into offsets
+    int sym_ref; // set to the index of the first symbol an operand refers to, or left at -1
+    const char *line; // the line being parsed, used to work out the column of an error
+    DiagList *diags; // where errors are reported
+    bool undefined; // set when an operand names a symbol that is not defined yet
+} ParseContext;
+
+// ranges operands are checked against, negative values are stored in two's complement
+#define IMM_MIN -128
+#define IMM_MAX 255
+#define PCOFFSET_MIN -128
+#define PCOFFSET_MAX 127
 
 #define MIN_REG 'A'
-#define MAX_REG 'D'
+#define MAX_REG ('A' + target.num_regs - 1)
 
 // convenience function to check if a character specifies a valid CPU register
 bool check_regs(char reg);
 
-bool parse_noop(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_inputc(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_inputcf(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_inputd(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_inputdf(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_move(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_loadi(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_loadp(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_add(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_addi(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_sub(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_subi(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_load(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_loadf(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_store(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_storef(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_shiftl(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_shiftr(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_cmp(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_jump(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_bre(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_brz(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_brne(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_brnz(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_brg(char *line, int line_num, ParsedInstruction *inst);
-
-bool parse_brge(char *line, int line_num, ParsedInstruction *inst);
+// parses the operands of the instruction on the line and encodes it, the operand syntax comes from the instruction's
+// pattern in the isa.h table
+bool parse_instruction(InstId id, char *line, int line_num, ParseContext *ctx, ParsedInstruction *inst);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * This file contains the internal representation of an assembled program. Instructions are stored as parallel
+ * arrays rather than an array of structs, so passes that only look at one field (usually the opcode) stream through
+ * tightly packed memory, and the arrays grow as needed so the representation is not limited to the 64 word code
+ * segment of the real hardware.
+ */
+
+// kinds of operands an instruction has, combined as a bitmask
+#define OPND_REG0 0x01 // register in bits 11-10
+#define OPND_REG1 0x02 // register in bits 9-8
+#define OPND_IMM 0x04 // immediate value in the low byte
+#define OPND_DADDR 0x08 // data address in the low byte
+#define OPND_CADDR 0x10 // code address in the low byte
+#define OPND_PCOFFSET 0x20 // branch offset in the low byte
+#define OPND_INDEXED 0x40 // a register is added to the address at runtime
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    uint16_t *opcode;
+    uint32_t *line; // source line, starting at 1
+    uint32_t *col_start; // first column of the instruction text, starting at 0
+    uint32_t *col_end; // one past the last column of the instruction text
+    uint8_t *operand_kinds;
+    int32_t *sym_ref; // index in the symbol table of the symbol an operand refers to, or -1
+} InstIR;
+
+void ir_init(InstIR *ir);
+
+// removes every instruction but keeps the memory for the next run
+void ir_clear(InstIR *ir);
+
+void ir_free(InstIR *ir);
+
+// appends an instruction, returns false if memory could not be allocated
+bool ir_push(InstIR *ir, uint16_t opcode, uint32_t line, uint32_t col_start, uint32_t col_end, uint8_t operand_kinds, int32_t sym_ref);
+
+// removes every instruction whose keep entry is false, moving the rest down in order
+void ir_remove(InstIR *ir, const bool *keep);
+
+// the contents of the data segment, laid out exactly as they are loaded into data memory
+typedef struct {
+    uint8_t *bytes;
+    size_t len;
+    size_t cap;
+} DataImage;
+
+void data_init(DataImage *data);
+
+// removes every byte but keeps the memory for the next run
+void data_clear(DataImage *data);
+
+void data_free(DataImage *data);
+
+// makes room for len more bytes and returns a pointer to them, or NULL if memory could not be allocated
+uint8_t *data_extend(DataImage *data, size_t len);
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "ir.h"
+
+/**
+ * This file contains the description of the i281 instruction set. Every instruction is one line of the table below,
+ * giving its mnemonic, the opcode with all operand fields zero and the pattern of its operands. The parser, the
+ * encoder, the disassembler and the simulator's decoder are all generated from it, so adding an instruction means
+ * adding one line here and, if it does something new, one case to the simulator.
+ *
+ * An instruction word is split into four fields:
+ *   15-12  opcode
+ *   11-10  register 0 (rx)
+ *   9-8    register 1 (ry), or the sub-opcode of INPUT*, SHIFT* and the branches
+ *   7-0    immediate value, address or branch offset
+ */
+
+// how the operands of an instruction are written and where they go in the instruction word
+typedef enum {
+    PAT_NONE, // NOOP
+    PAT_CADDR, // INPUTC [addr]
+    PAT_DADDR, // INPUTD [addr]
+    PAT_REG_CBASE, // INPUTCF A, base, where A is added to the code address at runtime
+    PAT_REG_DBASE, // INPUTDF A, base, where A is added to the data address at runtime
+    PAT_REG_REG, // ADD A, B
+    PAT_REG_IMM, // ADDI A, value
+    PAT_REG_PTR, // LOADP A, array, the address of a data label as a value
+    PAT_REG_MEM, // LOAD A, [addr]
+    PAT_REG_INDEX, // LOADF A, [addr+B]
+    PAT_MEM_REG, // STORE [addr], A
+    PAT_INDEX_REG, // STOREF [addr+B], A
+    PAT_REG, // SHIFTL A
+    PAT_OFFSET, // JUMP label
+    NUM_PATTERNS
+} OperandPattern;
+
+// patterns whose bits 9-8 hold a register rather than a sub-opcode
+#define PAT_HAS_REG1(pat) ((pat) == PAT_REG_REG || (pat) == PAT_REG_INDEX || (pat) == PAT_INDEX_REG)
+
+// X(name, opcode, pattern)
+#define I281_INSTRUCTIONS(X) \
+    X(NOOP,    0x0000, PAT_NONE) \
+    X(INPUTC,  0x1000, PAT_CADDR) \
+    X(INPUTCF, 0x1100, PAT_REG_CBASE) \
+    X(INPUTD,  0x1200, PAT_DADDR) \
+    X(INPUTDF, 0x1300, PAT_REG_DBASE) \
+    X(MOVE,    0x2000, PAT_REG_REG) \
+    X(LOADI,   0x3000, PAT_REG_IMM) \
+    X(ADD,     0x4000, PAT_REG_REG) \
+    X(ADDI,    0x5000, PAT_REG_IMM) \
+    X(SUB,     0x6000, PAT_REG_REG) \
+    X(SUBI,    0x7000, PAT_REG_IMM) \
+    X(LOAD,    0x8000, PAT_REG_MEM) \
+    X(LOADF,   0x9000, PAT_REG_INDEX) \
+    X(STORE,   0xA000, PAT_MEM_REG) \
+    X(STOREF,  0xB000, PAT_INDEX_REG) \
+    X(SHIFTL,  0xC000, PAT_REG) \
+    X(SHIFTR,  0xC100, PAT_REG) \
+    X(CMP,     0xD000, PAT_REG_REG) \
+    X(JUMP,    0xE000, PAT_OFFSET) \
+    X(BRE,     0xF000, PAT_OFFSET) \
+    X(BRNE,    0xF100, PAT_OFFSET) \
+    X(BRG,     0xF200, PAT_OFFSET) \
+    X(BRGE,    0xF300, PAT_OFFSET)
+
+// other names the i281 accepts for the instructions above, they share an encoding so they are never decoded
+#define I281_ALIASES(X) \
+    X(LOADP,   0x3000, PAT_REG_PTR) \
+    X(BRZ,     0xF000, PAT_OFFSET) \
+    X(BRNZ,    0xF100, PAT_OFFSET)
+
+#define ISA_ENUM(name, opcode, pattern) INST_##name,
+
+typedef enum {
+    INST_INVALID, // an encoding that is not an instruction
+    I281_INSTRUCTIONS(ISA_ENUM)
+    I281_ALIASES(ISA_ENUM)
+    NUM_INSTS
+} InstId;
+
+typedef struct {
+    const char *mnemonic;
+    uint16_t opcode;
+    OperandPattern pattern;
+} InstDesc;
+
+// indexed by InstId
+extern const InstDesc inst_table[NUM_INSTS];
+
+// operand kinds (OPND_*) of each pattern
+extern const uint8_t pattern_kinds[NUM_PATTERNS];
+
+// maps the top six bits of a word, the opcode and bits 9-8, to the instruction
+extern const uint8_t decode_table[64];
+
+static inline InstId isa_decode(uint16_t word) {
+    return (InstId) decode_table[((word >> 10) & 0x3C) | ((word >> 8) & 0x3)];
+}
+
+// looks up a mnemonic, returns INST_INVALID if there is no such instruction
+InstId find_instruction(const char *mnemonic, size_t len);
+
+// builds an instruction word, the fields an instruction does not use must be 0
+static inline uint16_t isa_encode(InstId id, int rx, int ry, uint8_t low) {
+    return inst_table[id].opcode | rx << 10 | ry << 8 | low;
+}
+
+// writes the instruction in the syntax the parser accepts, with branch offsets as plain numbers
+// returns the number of characters written, like snprintf
+int isa_disassemble(uint16_t word, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "ir.h"
+#include "expr.h"
+#include "sim.h"
+
+/**
+ * This file contains profile-guided block layout. A profiling run of the simulator counts how often each instruction
+ * runs and how often each branch is taken, and the layout pass uses those counts to reorder the basic blocks so the
+ * hottest edges fall through. A branch whose hot side ends up next is inverted, BRE and BRNE into each other and BRG
+ * and BRGE into each other by swapping the operands of the CMP in front of them, and every offset is re-resolved.
+ *
+ * Profiles are text files, a header naming the code they were taken from and then one line per instruction:
+ *   code 20 0x1f2e3d4c
+ *   0 1 0               ; address, times run, times the branch was taken
+ */
+
+typedef struct {
+    size_t len;
+    uint32_t hash; // code_hash() of the program the profile was taken from
+    uint64_t *count; // times each instruction ran
+    uint64_t *taken; // times each branch was taken
+} Profile;
+
+// a hash of the code words, so a profile of a different program is never applied
+uint32_t code_hash(const uint16_t *code, size_t len);
+
+bool profile_init(Profile *profile, const uint16_t *code, size_t len);
+
+void profile_free(Profile *profile);
+
+// runs like sim_run while counting every instruction and every taken branch
+SimStatus sim_run_profiled(SimState *state, const SimInput *input, uint64_t max_steps, Profile *profile);
+
+bool profile_save(const Profile *profile, const char *path);
+
+bool profile_load(Profile *profile, const char *path);
+
+typedef struct {
+    bool skipped; // the code cannot be moved, or the offsets would not fit afterwards
+    int blocks;
+    int moved; // blocks no longer in their original place
+    int inverted; // branches whose condition was flipped
+    int jumps_added;
+    int jumps_removed;
+} LayoutStats;
+
+// reorders the blocks of the IR by the profile, returns false if memory could not be allocated
+bool layout_blocks(InstIR *ir, const SymbolTable *syms, const Profile *profile, LayoutStats *stats);
+
+#endif
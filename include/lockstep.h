@@ -0,0 +1,31 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sim.h"
+
+/**
+ * This file contains the lockstep simulator, which runs one program against up to LOCKSTEP_LANES input vectors at
+ * once. Registers, flags and data memory are kept lane by lane in GCC vector types, so while the instances agree on
+ * the PC every instruction is a handful of vector operations for all of them. When a branch splits them up, the group
+ * with the lowest PC runs first and the others join it at the first instruction they share, which is usually the end
+ * of the loop that split them. An instance that writes code memory is no longer running the same program as the
+ * others, so it finishes on the scalar simulator.
+ */
+
+// instances run together, 16 fills one SSE register per byte of state and 32 one AVX2 register
+#ifndef LOCKSTEP_LANES
+#define LOCKSTEP_LANES 16
+#endif
+
+// runs count instances of the program, instance i reading inputs[i], and leaves each in out[i] exactly as sim_reset
+// followed by sim_run with max_steps would have
+// returns false if the program does not fit in memory or count is more than LOCKSTEP_LANES
+bool lockstep_run(const uint16_t *code, size_t code_len, const uint8_t *data, size_t data_len, const SimInput *inputs,
+                  int count, uint64_t max_steps, SimState *out);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "ir.h"
+
+/**
+ * This file contains the writers for the assembler's output files. Besides the text .bin format, the code and data
+ * segments can be written straight to the memory initialization formats used by FPGA tools: Altera .mif, Xilinx .coe
+ * and the plain text files read by Verilog's $readmemb and $readmemh. Every selected format is written from the same
+ * assembled program, one file per segment.
+ */
+
+// output formats, combined as a bitmask
+#define OUT_BIN 0x01 // <name>.bin
+#define OUT_MIF 0x02 // <name>_code.mif and <name>_data.mif
+#define OUT_COE 0x04 // <name>_code.coe and <name>_data.coe
+#define OUT_MEMB 0x08 // <name>_code.mem and <name>_data.mem, binary words for $readmemb
+#define OUT_MEMH 0x10 // <name>_code.hex and <name>_data.hex, hex words for $readmemh
+
+// the .bin text format is this header, one line of BIN_WORD_LEN characters per instruction and then the data segment
+#define BIN_CODE_HEADER "-----MACHINE CODE-----\n"
+#define BIN_WORD_LEN 20
+
+// writes the machine code and data segment in the .bin text format
+void write_bin(FILE *out_file, const InstIR *ir, const DataImage *data);
+
+// writes the .bin line for one instruction
+void write_bin_word(FILE *out_file, uint16_t opcode);
+
+// writes everything in the .bin file that follows the machine code
+void write_bin_data(FILE *out_file, const DataImage *data);
+
+// reads a program back from the .bin text format, returns false if the file is malformed or does not fit
+bool read_bin(const char *path, uint16_t *code, size_t *code_len, size_t code_cap, uint8_t *data, size_t *data_len, size_t data_cap);
+
+// writes a program back out as source the assembler accepts, with each word's address and encoding in a comment
+void write_disassembly(FILE *out_file, const uint16_t *code, size_t code_len, const uint8_t *data, size_t data_len);
+
+// writes every selected format for the program assembled from path, named after path without its .asm extension
+// files whose contents did not change are left alone, returns -1 if any file could not be written
+int write_outputs(const char *path, unsigned formats, const InstIR *ir, const DataImage *data, bool verbose);
+
+// writes a Makefile rule saying the outputs write_outputs writes for formats depend on inputs, the source first
+// the rule goes to dep_path, or next to the outputs as <name>.d if dep_path is NULL, and is replaced atomically
+int write_depfile(const char *path, const char *dep_path, unsigned formats, const char *const *inputs, int num_inputs, bool verbose);
+
+#endif
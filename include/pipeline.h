@@ -0,0 +1,27 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * This file contains the streaming assembler for very large generated programs. Rather than reading the whole file
+ * and then running one pass after another, four stages run at the same time on their own threads, connected by
+ * bounded queues:
+ *   read    reads the file in fixed size chunks, split at line boundaries
+ *   lex     finds the comments and labels of each line and sorts it into directives, data and instructions
+ *   encode  defines the symbols and encodes each instruction as soon as it arrives
+ *   write   writes the .bin line of each encoded instruction
+ * An instruction that refers to a symbol defined further down is written as a placeholder and kept as a fixup, which
+ * is encoded and patched into the file in place once the whole program has been read. Memory use is bounded by the
+ * queue depths and the number of fixups rather than by the size of the source file.
+ */
+
+// assembles the file at path into its .bin file, returns 0 on success and -1 if the program could not be assembled
+// progress messages are left out when diag_json is set, like in the regular assembler
+int assemble_stream(const char *path, bool diag_json);
+
+#endif
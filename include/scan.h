@@ -0,0 +1,45 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * This file contains the pre-scan of the raw source buffer. The whole file is classified in one vectorized pass
+ * (AVX2 or SSE2 when the CPU has them, plain C otherwise) so that later stages can jump straight to the structure
+ * characters of a line instead of searching for them again with strchr/strstr.
+ */
+
+// offsets are relative to the start of the line, SCAN_NONE means the character does not appear on the line
+#define SCAN_NONE -1
+
+typedef struct {
+    size_t start; // offset of the first character of the line in the source buffer
+    size_t len; // length of the line, not counting the newline
+    int32_t comment; // first ';' on the line outside a string or character literal
+    int32_t colon; // first ':' before the comment, outside a literal
+    int32_t bracket; // first '[' before the comment, outside a literal
+    int32_t comma; // first ',' before the comment, outside a literal
+} ScanLine;
+
+typedef struct {
+    ScanLine *lines;
+    int num_lines;
+    int lines_cap;
+    char quote; // the quote of the literal the scan is inside of, or '\0', a literal never runs past its line
+} ScanResult;
+
+// classifies every structure character in buf, filling in one ScanLine per line of the source
+// res must be zeroed before the first call, its line array is reused by later calls
+// returns false if memory could not be allocated
+bool scan_source(const char *buf, size_t len, ScanResult *res);
+
+void free_scan(ScanResult *res);
+
+// checks whether a line holds nothing but whitespace
+bool is_blank(const char *line);
+
+#endif
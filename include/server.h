@@ -0,0 +1,38 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * This file contains the editor server, which keeps one source file assembled in memory and updates it line by line
+ * as it is edited, so an editor can show the machine code next to every line while it is being typed. Requests are
+ * lines of text on the input:
+ *   open FILE              replaces the document with the contents of FILE
+ *   edit FIRST COUNT N     replaces the COUNT lines starting at line FIRST with the N lines of text that follow it,
+ *                          so a COUNT of 0 inserts and an N of 0 deletes
+ *   quit
+ * and each one is answered with a JSON object framed like the language server protocol:
+ *   Content-Length: 112
+ *
+ *   {"version": 2, "us": 38, "lines": [{"line": 4, "address": 2, "word": "0x3205"}, {"line": 6, "address": null}],
+ *    "diagnostics": [...]}
+ * where version counts the requests carried out so far, us is how long this one took in microseconds, lines lists
+ * every line, numbered as it is after the edit, whose address or encoding is not what the editor was last told, and
+ * diagnostics is every problem in the document in the form --diag-json prints them. A request that cannot be carried
+ * out is answered with the version unchanged, and what went wrong is printed on stdout as usual, which --serve points
+ * at stderr so the responses have their stream to themselves.
+ *
+ * Only the inserted lines are lexed again. The data segment and constants are parsed again when a data or .equ line
+ * changed, code label addresses are counted again, and an instruction is encoded again only if it is new, if it is a
+ * branch whose own address moved or if it names a symbol whose value changed, which is mostly a branch to a label
+ * that moved.
+ */
+
+// answers requests from in on out until quit or the end of in, returns 0, or -1 if memory ran out
+int serve(FILE *in, FILE *out);
+
+#endif
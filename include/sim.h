@@ -0,0 +1,141 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "instructions.h"
+
+/**
+ * This file contains the instruction set simulator. The whole machine state fits in one SimState, so a run can be
+ * stopped after any number of instructions, saved to a compact binary snapshot and later restored to continue from
+ * exactly the same point, which lets many runs fork from one warmed-up checkpoint instead of starting at reset.
+ *
+ * The INPUT instructions read from a stand-in for the switches, either one sequence of values or, when the input is
+ * keyed by PC, a sequence for each input instruction. Both come from a text file:
+ *   7, 3, 0x10         ; one sequence, read in order by whichever input instruction runs
+ *   3: 7, 1            ; the instruction at address 3 reads 7 and then 1
+ *   9: 0x10            ; and the one at address 9 reads 0x10
+ * or from a replay file converted from one, which is memory-mapped and read in place with no parsing.
+ */
+
+// flag bits, set by the arithmetic, compare and shift instructions
+#define FLAG_C 0x01 // carry out of the adder, for SUB and CMP this means no borrow
+#define FLAG_N 0x02 // result is negative
+#define FLAG_O 0x04 // signed overflow
+#define FLAG_Z 0x08 // result is zero
+
+// instructions run before the simulator gives up on a program that never reaches its end
+#define SIM_DEFAULT_STEPS 1000000
+
+typedef enum {
+    SIM_RUNNING, // stopped at the requested instruction count, the program can be continued
+    SIM_HALTED, // the PC left the program
+    SIM_NO_INPUT, // an INPUT instruction found the input device empty
+    SIM_STEP_LIMIT // the step budget ran out
+} SimStatus;
+
+typedef struct {
+    uint16_t pc;
+    uint8_t regs[4]; // A-D
+    uint8_t flags; // FLAG_* bits
+    uint8_t status; // SimStatus
+    uint16_t code_len; // the PC running past this ends the program
+    uint32_t input_pos; // values read from the input device
+    uint64_t steps; // instructions executed since reset
+    uint8_t dmem[TARGET_DSEG_MAX]; // only the first DSEG_SIZE bytes are used
+    uint16_t cmem[TARGET_CSEG_MAX]; // kept in the state because INPUTC and INPUTCF write to it
+    uint32_t pc_reads[TARGET_CSEG_MAX]; // values read by the instruction at each address, for input keyed by PC
+} SimState;
+
+// values supplied to INPUTC, INPUTCF, INPUTD and INPUTDF, in the order they are read
+typedef struct {
+    uint16_t *values;
+    size_t len;
+    size_t cap;
+    uint32_t *by_pc; // num_keys + 1 offsets into values when the input is keyed by PC, NULL for one sequence
+    uint32_t num_keys;
+    void *map; // the replay file values and by_pc point into, NULL when they were allocated
+    size_t map_len;
+} SimInput;
+
+// takes the next value for the input instruction at pc, returns false if there is none
+static inline bool sim_next_input(const SimInput *input, uint16_t pc, uint32_t *input_pos, uint32_t *pc_reads, uint16_t *val) {
+    if(input == NULL) return false;
+
+    size_t pos = *input_pos;
+    if(input->by_pc != NULL) {
+        if(pc >= input->num_keys) return false;
+        pos = input->by_pc[pc] + pc_reads[pc];
+        if(pos >= input->by_pc[pc + 1]) return false;
+        pc_reads[pc]++;
+    } else if(pos >= input->len) {
+        return false;
+    }
+
+    *val = input->values[pos];
+    (*input_pos)++;
+    return true;
+}
+
+// loads a program and its data segment and resets the machine, returns false if they do not fit in memory
+bool sim_reset(SimState *state, const uint16_t *code, size_t code_len, const uint8_t *data, size_t data_len);
+
+// checks whether a conditional branch or JUMP is taken with the given flags
+static inline bool sim_branch_taken(InstId id, uint8_t flags) {
+    bool z = flags & FLAG_Z;
+    bool ge = !(flags & FLAG_N) == !(flags & FLAG_O); // signed greater or equal, the sign is right unless it overflowed
+    switch(id) {
+        case INST_JUMP: return true;
+        case INST_BRE: return z;
+        case INST_BRNE: return !z;
+        case INST_BRG: return ge && !z;
+        case INST_BRGE: return ge;
+        default: return false;
+    }
+}
+
+// runs one instruction
+SimStatus sim_step(SimState *state, const SimInput *input);
+
+// runs until the program ends or the instruction count since reset reaches max_steps
+SimStatus sim_run(SimState *state, const SimInput *input, uint64_t max_steps);
+
+// prints the registers, flags and data memory
+void sim_print(const SimState *state, FILE *out_file);
+
+// reads the values for the input device from a replay file, or from a text file of whitespace or comma separated
+// values, each of which may be decimal or 0x hex and may be preceded by a PC and a colon to key the ones after it
+bool read_sim_input(const char *path, SimInput *input);
+
+// replay files are a magic number, version, key count and value count followed by the offsets of each PC's values
+// and then the values, all in little endian and aligned so a little endian host can use them straight from the map
+#define REPLAY_MAGIC "i281rply"
+#define REPLAY_VERSION 1
+
+// writes the input as a replay file, which is replaced atomically
+bool save_sim_input(const SimInput *input, const char *path);
+
+void free_sim_input(SimInput *input);
+
+// snapshots are a magic number, version and the segment sizes of the target followed by every field of the state in
+// little endian, a snapshot only loads into a target with the same segment sizes
+#define SNAPSHOT_MAGIC "i281snap"
+#define SNAPSHOT_VERSION 3
+
+// writes the snapshot to buf, which must hold at least sim_snapshot_size() bytes, and returns its length
+size_t sim_save(const SimState *state, uint8_t *buf);
+
+size_t sim_snapshot_size(const SimState *state);
+
+// restores a state from a snapshot, returns false if buf does not hold a valid snapshot
+bool sim_load(SimState *state, const uint8_t *buf, size_t len);
+
+// file versions of the above, the file is replaced atomically
+bool sim_save_file(const SimState *state, const char *path);
+
+bool sim_load_file(SimState *state, const char *path);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef SUPEROPT_H
+#define SUPEROPT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "ir.h"
+#include "expr.h"
+
+/**
+ * This file contains the superoptimizer and the peephole pass that applies what it finds. The superoptimizer takes a
+ * window of up to SUPEROPT_WINDOW straight-line instructions and tries every shorter sequence, shortest first, until
+ * one leaves registers A-D, the flags and data memory exactly as the window does. Candidates are run with the
+ * simulator from a fixed set of edge-case and random states, so equivalence is tested rather than proven, and the
+ * search is split across threads by the first instruction of the candidate.
+ *
+ * Results are kept in a rewrite database, a text file that grows between runs so each window is only searched once.
+ * It starts with the target it was built for, since the encodings and what they do depend on its sizes:
+ *   target i281 16 64 4          ; name, dseg, cseg and regs
+ *   exact 3001 5002 => 3003      ; the flags end up the same as well
+ *   noflags 5000 5000 => 5000    ; only right when the flags are not read before they are set again
+ *   exact 2400 3001 => none      ; nothing shorter exists
+ */
+
+#define SUPEROPT_WINDOW 4 // longest window searched, the search grows with the number of candidates to this power
+
+typedef struct {
+    uint16_t window[SUPEROPT_WINDOW];
+    uint8_t window_len;
+    bool flags; // the replacement leaves the flags as the window does
+    bool found; // false when no shorter sequence exists
+    uint16_t repl[SUPEROPT_WINDOW];
+    uint8_t repl_len;
+} Rewrite;
+
+typedef struct {
+    Rewrite *items;
+    size_t len;
+    size_t cap;
+} RewriteDB;
+
+// loads the database, a file that does not exist yet or was built for another target is an empty database
+bool rewrite_db_load(RewriteDB *db, const char *path);
+
+bool rewrite_db_save(const RewriteDB *db, const char *path);
+
+void rewrite_db_free(RewriteDB *db);
+
+// returns the entry for the window, or NULL if it has not been searched yet
+const Rewrite *rewrite_db_find(const RewriteDB *db, const uint16_t *window, size_t len, bool flags);
+
+// checks whether an instruction can be part of a window, which rules out branches and input
+bool superopt_allowed(uint16_t opcode);
+
+// searches for the shortest sequence equivalent to the window, on every thread the machine has if threads is 0
+// returns false if memory could not be allocated
+bool superopt_search(const uint16_t *window, size_t len, bool flags, int threads, Rewrite *out);
+
+typedef struct {
+    bool skipped; // the program writes its own code or uses a code label as a value, so nothing was changed
+    int searched; // windows searched because they were missing from the database
+    int rewritten; // windows replaced by something shorter
+    size_t words_before;
+    size_t words_after;
+} PeepholeStats;
+
+// replaces every window of the IR that the database has a shorter sequence for, using the noflags entries where the
+// flags are dead afterwards, and re-resolves the branch offsets
+// when search is set, windows missing from the database are searched first and added to it
+// returns false if memory could not be allocated, in which case the IR is left unchanged
+bool peephole(InstIR *ir, const SymbolTable *syms, RewriteDB *db, bool search, int threads, PeepholeStats *stats);
+
+#endif
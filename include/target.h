@@ -0,0 +1,47 @@
+#ifndef TARGET_H
+#define TARGET_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * This file contains the description of the machine being assembled for. The i281 is compiled in, and a variant is
+ * described in a text file given with --target, one setting per line:
+ *   name    wide281
+ *   dseg    256        ; bytes of data memory
+ *   cseg    128        ; words of code memory
+ *   regs    4          ; registers, named from A
+ * Settings left out keep their i281 values. Every target shares the 4/2/2/8 split of the 16-bit instruction word,
+ * which the ISA table in isa.h places every opcode for, so it is not a setting. The one global target is filled in
+ * before anything is assembled and the masks are worked out from it then, so the parser and the simulator read a size
+ * or a mask where they used to have a constant and nothing is looked up per instruction. Memory sizes are powers of
+ * two so addresses wrap with the mask.
+ */
+
+// addresses come from the 8-bit immediate field, so no target can have more memory than this
+#define TARGET_DSEG_MAX 256
+#define TARGET_CSEG_MAX 256
+
+typedef struct {
+    char name[32];
+    int dseg_size; // bytes of data memory
+    int cseg_size; // words of code memory
+    int num_regs;
+    int dseg_mask; // dseg_size - 1
+    int cseg_mask;
+} Target;
+
+extern Target target;
+
+#define DSEG_SIZE (target.dseg_size)
+#define CSEG_SIZE (target.cseg_size)
+#define DSEG_MASK (target.dseg_mask)
+#define CSEG_MASK (target.cseg_mask)
+
+// replaces the target with the one described in path, returns false and leaves it unchanged if the file is invalid
+bool target_load(const char *path);
+
+#endif
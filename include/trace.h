@@ -0,0 +1,73 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "sim.h"
+#include "ir.h"
+
+/**
+ * This file contains the execution trace. While tracing, the simulator writes one 8-byte record per instruction into a
+ * fixed-size ring buffer, so a long run keeps only its last few thousand instructions and costs no more than a store
+ * per step. The buffer is written to a file when the program stops, either at its end or when a trigger condition is
+ * met, and the file can be decoded later next to the source lines that produced each instruction.
+ */
+
+// what an instruction changed, registers are 0-3 and addresses go up to TARGET_DSEG_MAX or TARGET_CSEG_MAX
+#define TRACE_NONE 0xFFF
+#define TRACE_DMEM 0x400 // | data address
+#define TRACE_CMEM 0x800 // | code address
+
+typedef struct {
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t value; // new value of the register or memory cell in dest
+    uint16_t dest : 12; // register number, TRACE_DMEM | address, TRACE_CMEM | address or TRACE_NONE
+    uint16_t flags : 4; // flags after the instruction ran
+} TraceRecord;
+
+// the ring holds a power of two records, head counts every record ever written so the newest is at (head - 1) & mask
+typedef struct {
+    TraceRecord *records;
+    uint32_t mask;
+    _Atomic uint64_t head;
+    uint64_t first_step; // instruction count when tracing started, the record written n-th is for step first_step + n
+} TraceBuffer;
+
+#define TRACE_DEFAULT_SIZE 4096
+
+// size is rounded up to a power of two, returns false if memory could not be allocated
+bool trace_init(TraceBuffer *trace, uint32_t size, uint64_t first_step);
+
+void trace_free(TraceBuffer *trace);
+
+typedef enum {
+    TRIGGER_NONE,
+    TRIGGER_PC, // pc=N, the instruction at address N runs
+    TRIGGER_WRITE, // write=N, data address N is written
+    TRIGGER_STEP // step=N, the instruction count reaches N
+} TriggerKind;
+
+typedef struct {
+    TriggerKind kind;
+    uint64_t value;
+} TraceTrigger;
+
+// parses a trigger written as pc=N, write=N or step=N
+bool parse_trigger(const char *s, TraceTrigger *trigger);
+
+// runs like sim_run while recording every instruction, stopping early with SIM_RUNNING if the trigger is met
+SimStatus sim_run_traced(SimState *state, const SimInput *input, uint64_t max_steps, TraceBuffer *trace,
+                         const TraceTrigger *trigger, bool *triggered);
+
+// writes the records in the buffer to path, along with the source file and the source line of every instruction
+bool trace_save(const TraceBuffer *trace, const char *path, const char *source, const InstIR *ir);
+
+// prints a saved trace, one instruction per line next to the source line it came from
+bool trace_decode(const char *path, FILE *out_file);
+
+#endif
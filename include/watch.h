@@ -0,0 +1,21 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * This file contains the watch mode loop, which waits for inotify events on a set of source files and calls back
+ * into the assembler each time one of them is saved.
+ */
+
+typedef void (*RebuildFn)(void *ctx);
+
+// blocks forever, calling rebuild once a burst of changes to any of the given files has settled
+// returns -1 if the files could not be watched
+int watch_files(const char **paths, int num_paths, RebuildFn rebuild, void *ctx);
+
+#endif
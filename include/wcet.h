@@ -0,0 +1,48 @@
+#ifndef WCET_H
+#define WCET_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "ir.h"
+#include "expr.h"
+#include "scan.h"
+#include "diag.h"
+
+/**
+ * This file contains the static worst-case execution time analysis. The control flow graph is built from the encoded
+ * program and every backward branch closes a loop, which has to carry a bound written in a comment on the loop's
+ * first line or on one of its backward branches:
+ *   Inner:  LOAD D, [last]      ; @loop 8       the first instruction runs at most 8 times per entry
+ *           BRGE Inner          ; @loop 1..8    and at least once, at most 8 times
+ * Loops are collapsed innermost first into a single node whose cost depends on the exit taken, which leaves a graph
+ * without cycles whose shortest and longest paths are the best and worst case. Counts are in executed instructions.
+ * The i281 has no call instruction, so the whole program is the only routine and loops are reported in its place.
+ */
+
+typedef struct {
+    int line; // source line the annotation is on
+    uint32_t min;
+    uint32_t max;
+} LoopBound;
+
+typedef struct {
+    LoopBound *items;
+    int len;
+    int cap;
+} LoopBounds;
+
+// collects the @loop annotations from the comments of the scanned source, malformed ones are reported to diags
+// returns false if memory could not be allocated
+bool wcet_read_bounds(const char *source, const ScanResult *scan, LoopBounds *bounds, DiagList *diags);
+
+void wcet_free_bounds(LoopBounds *bounds);
+
+// analyzes the program and writes the per-block breakdown, every loop and the totals to out
+// returns false if the worst case cannot be bounded, because a loop has no bound, the program writes its own code or
+// control can enter a loop other than at its first instruction
+bool wcet_analyze(const InstIR *ir, const SymbolTable *syms, const LoopBounds *bounds, FILE *out);
+
+#endif
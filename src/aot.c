@@ -0,0 +1,277 @@
+#include "aot.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static bool is_branch(InstId id) {
+    return inst_table[id].pattern == PAT_OFFSET;
+}
+
+static bool is_input(InstId id) {
+    return id == INST_INPUTC || id == INST_INPUTCF || id == INST_INPUTD || id == INST_INPUTDF;
+}
+
+// the C condition for a branch being taken, the same tests as sim_branch_taken
+static const char *branch_condition(InstId id) {
+    switch(id) {
+        case INST_BRE: return "f & FLAG_Z";
+        case INST_BRNE: return "!(f & FLAG_Z)";
+        case INST_BRG: return "!(f & FLAG_N) == !(f & FLAG_O) && !(f & FLAG_Z)";
+        case INST_BRGE: return "!(f & FLAG_N) == !(f & FLAG_O)";
+        default: return "1";
+    }
+}
+
+// the helpers mirror add_flags and shift_flags in sim.c
+static const char *prelude =
+    "#include <stdint.h>\n"
+    "\n"
+    "#define FLAG_C %d\n"
+    "#define FLAG_N %d\n"
+    "#define FLAG_O %d\n"
+    "#define FLAG_Z %d\n"
+    "\n"
+    "static inline uint8_t add(uint8_t *f, uint8_t a, uint8_t b, int carry_in) {\n"
+    "    unsigned sum = a + b + carry_in;\n"
+    "    uint8_t result = (uint8_t) sum;\n"
+    "    *f = (sum > 0xFF ? FLAG_C : 0) | (result & 0x80 ? FLAG_N : 0) | (((a ^ result) & (b ^ result)) & 0x80 ? FLAG_O : 0) | (result == 0 ? FLAG_Z : 0);\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "static inline uint8_t shift_left(uint8_t *f, uint8_t a) {\n"
+    "    uint8_t result = (uint8_t) (a << 1);\n"
+    "    *f = (a & 0x80 ? FLAG_C : 0) | (result & 0x80 ? FLAG_N : 0) | ((a ^ result) & 0x80 ? FLAG_O : 0) | (result == 0 ? FLAG_Z : 0);\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "static inline uint8_t shift_right(uint8_t *f, uint8_t a) {\n"
+    "    uint8_t result = (uint8_t) ((a >> 1) | (a & 0x80));\n"
+    "    *f = (a & 0x01 ? FLAG_C : 0) | (result & 0x80 ? FLAG_N : 0) | (result == 0 ? FLAG_Z : 0);\n"
+    "    return result;\n"
+    "}\n"
+    "\n";
+
+void aot_translate(const uint16_t *code, size_t code_len, FILE *out) {
+    int len = (int) code_len;
+
+    // a block starts at the entry, at every branch target, after every branch and at and after every input
+    // instruction, which the interpreter runs
+    bool leader[TARGET_CSEG_MAX + 1] = {false};
+    leader[0] = true;
+    for(int p = 0; p < len; p++) {
+        InstId id = isa_decode(code[p]);
+        if(is_branch(id)) {
+            int dest = p + 1 + (int8_t) (code[p] & 0xFF);
+            if(dest >= 0 && dest < len) leader[dest] = true;
+            leader[p + 1] = true;
+        } else if(is_input(id)) {
+            leader[p] = leader[p + 1] = true;
+        }
+    }
+
+    // instructions from each address to the end of its block, which is what the budget is checked for on entry
+    int run[TARGET_CSEG_MAX + 1];
+    run[len] = 0;
+    for(int p = len - 1; p >= 0; p--) {
+        InstId id = isa_decode(code[p]);
+        if(is_input(id)) run[p] = 0;
+        else if(is_branch(id) || leader[p + 1]) run[p] = 1;
+        else run[p] = 1 + run[p + 1];
+    }
+
+    fprintf(out, "// generated by i281assembler from a %d word program\n", len);
+    fprintf(out, prelude, FLAG_C, FLAG_N, FLAG_O, FLAG_Z);
+    fprintf(out, "int i281_run(uint8_t *regs, uint8_t *flags, uint16_t *pc, uint8_t *dmem, uint64_t *left) {\n");
+    fprintf(out, "    uint8_t r0 = regs[0], r1 = regs[1], r2 = regs[2], r3 = regs[3];\n");
+    fprintf(out, "    uint8_t f = *flags;\n");
+    fprintf(out, "    uint64_t n = *left;\n");
+    fprintf(out, "    int exit_code = %d;\n\n", AOT_EXIT_INTERP);
+
+    // entering partway through a block checks the budget for the rest of it, anything else is left to the interpreter
+    fprintf(out, "    switch(*pc) {\n");
+    for(int p = 0; p < len; p++) {
+        fprintf(out, "        case %d: if(n < %d) goto out; n -= %d; goto L%d;\n", p, run[p], run[p], p);
+    }
+    fprintf(out, "        default: goto out;\n");
+    fprintf(out, "    }\n\n");
+
+    for(int p = 0; p < len; p++) {
+        uint16_t inst = code[p];
+        InstId id = isa_decode(inst);
+        int rx = (inst >> 10) & 0x3;
+        int ry = (inst >> 8) & 0x3;
+        uint8_t low = inst & 0xFF;
+
+        if(leader[p] && run[p] > 0) fprintf(out, "B%d: if(n < %d) { *pc = %d; goto out; } n -= %d;\n", p, run[p], p, run[p]);
+        else if(leader[p]) fprintf(out, "B%d:\n", p);
+        fprintf(out, "L%d: ", p);
+
+        switch(id) {
+            case INST_INPUTC:
+            case INST_INPUTCF:
+            case INST_INPUTD:
+            case INST_INPUTDF:
+                fprintf(out, "*pc = %d; goto out;\n", p);
+                continue;
+            case INST_MOVE: fprintf(out, "r%d = r%d;\n", rx, ry); break;
+            case INST_LOADI: fprintf(out, "r%d = %d;\n", rx, low); break;
+            case INST_ADD: fprintf(out, "r%d = add(&f, r%d, r%d, 0);\n", rx, rx, ry); break;
+            case INST_ADDI: fprintf(out, "r%d = add(&f, r%d, %d, 0);\n", rx, rx, low); break;
+            case INST_SUB: fprintf(out, "r%d = add(&f, r%d, (uint8_t) ~r%d, 1);\n", rx, rx, ry); break;
+            case INST_SUBI: fprintf(out, "r%d = add(&f, r%d, %d, 1);\n", rx, rx, (uint8_t) ~low); break;
+            case INST_LOAD: fprintf(out, "r%d = dmem[%d];\n", rx, low & DSEG_MASK); break;
+            case INST_LOADF: fprintf(out, "r%d = dmem[(uint8_t) (r%d + %d) & %d];\n", rx, ry, low, DSEG_MASK); break;
+            case INST_STORE: fprintf(out, "dmem[%d] = r%d;\n", low & DSEG_MASK, rx); break;
+            case INST_STOREF: fprintf(out, "dmem[(uint8_t) (r%d + %d) & %d] = r%d;\n", ry, low, DSEG_MASK, rx); break;
+            case INST_SHIFTL: fprintf(out, "r%d = shift_left(&f, r%d);\n", rx, rx); break;
+            case INST_SHIFTR: fprintf(out, "r%d = shift_right(&f, r%d);\n", rx, rx); break;
+            case INST_CMP: fprintf(out, "add(&f, r%d, (uint8_t) ~r%d, 1);\n", rx, ry); break;
+            case INST_JUMP:
+            case INST_BRE:
+            case INST_BRNE:
+            case INST_BRG:
+            case INST_BRGE: {
+                // the destination is known, so a branch out of the program goes straight to the end
+                int dest = p + 1 + (int8_t) low;
+                if(dest >= 0 && dest < len) fprintf(out, "if(%s) goto B%d;\n", branch_condition(id), dest);
+                else fprintf(out, "if(%s) goto halt;\n", branch_condition(id));
+                break;
+            }
+            default: // NOOP, and encodings that are not instructions do nothing
+                fprintf(out, ";\n");
+                break;
+        }
+    }
+
+    // running off the end of the program ends it like a branch out of it does
+    fprintf(out, "    goto halt;\n\n");
+    fprintf(out, "halt:\n");
+    fprintf(out, "    *pc = %d;\n", len);
+    fprintf(out, "    exit_code = %d;\n", AOT_EXIT_HALTED);
+    fprintf(out, "out:\n");
+    fprintf(out, "    regs[0] = r0; regs[1] = r1; regs[2] = r2; regs[3] = r3;\n");
+    fprintf(out, "    *flags = f;\n");
+    fprintf(out, "    *left = n;\n");
+    fprintf(out, "    return exit_code;\n");
+    fprintf(out, "}\n");
+}
+
+// compiles src into the shared library lib with the compiler named by $CC, returns false if it failed
+static bool run_compiler(const char *src, const char *lib) {
+    // the shell splits $CC, so it can carry flags or a wrapper, and the paths are passed as arguments rather than
+    // pasted into the command
+    const char *script = "exec ${CC:-" AOT_DEFAULT_CC "} -O2 -fPIC -shared -w -o \"$1\" \"$2\"";
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid < 0) {
+        printf("Error starting the compiler: %s\n", strerror(errno));
+        return false;
+    }
+    if(pid == 0) {
+        execl("/bin/sh", "sh", "-c", script, "sh", lib, src, (char *) NULL);
+        _exit(127);
+    }
+
+    int status;
+    while(waitpid(pid, &status, 0) < 0) {
+        if(errno != EINTR) {
+            printf("Error waiting for the compiler: %s\n", strerror(errno));
+            return false;
+        }
+    }
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("Compiling the translated program failed\n");
+        return false;
+    }
+    return true;
+}
+
+bool aot_compile(AotProgram *prog, const uint16_t *code, size_t code_len) {
+    memset(prog, 0, sizeof(AotProgram));
+    if(code_len > (size_t) CSEG_SIZE) {
+        printf("Program does not fit in the %d word code segment and cannot be compiled\n", CSEG_SIZE);
+        return false;
+    }
+
+    // the source and library only have to live until the library is loaded
+    const char *tmp = getenv("TMPDIR");
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s/i281aot.XXXXXX", tmp != NULL && tmp[0] != '\0' ? tmp : "/tmp");
+    if(mkdtemp(dir) == NULL) {
+        printf("Error creating directory %s: %s\n", dir, strerror(errno));
+        return false;
+    }
+    char src[4096 + 16], lib[4096 + 16];
+    snprintf(src, sizeof(src), "%s/prog.c", dir);
+    snprintf(lib, sizeof(lib), "%s/prog.so", dir);
+
+    bool ok = false;
+    FILE *f = fopen(src, "w");
+    if(f == NULL) {
+        printf("Error occured opening file %s: %s\n", src, strerror(errno));
+    } else {
+        aot_translate(code, code_len, f);
+        ok = fclose(f) == 0 && run_compiler(src, lib);
+    }
+
+    if(ok) {
+        prog->handle = dlopen(lib, RTLD_NOW | RTLD_LOCAL);
+        if(prog->handle == NULL) {
+            printf("Error loading the compiled program: %s\n", dlerror());
+            ok = false;
+        } else if((prog->run = (AotEntry) dlsym(prog->handle, "i281_run")) == NULL) {
+            printf("Error loading the compiled program: %s\n", dlerror());
+            aot_free(prog);
+            ok = false;
+        }
+    }
+
+    // the loaded library stays mapped after its file is gone
+    unlink(src);
+    unlink(lib);
+    rmdir(dir);
+
+    if(ok) {
+        memcpy(prog->code, code, sizeof(uint16_t) * code_len);
+        prog->code_len = code_len;
+    }
+    return ok;
+}
+
+static bool same_program(const AotProgram *prog, const SimState *state) {
+    return state->code_len == prog->code_len && memcmp(state->cmem, prog->code, sizeof(uint16_t) * prog->code_len) == 0;
+}
+
+SimStatus aot_run(const AotProgram *prog, SimState *state, const SimInput *input, uint64_t max_steps) {
+    if(state->status == SIM_HALTED) return SIM_HALTED;
+    if(prog->run == NULL || !same_program(prog, state)) return sim_run(state, input, max_steps);
+
+    state->status = SIM_RUNNING;
+    while(state->steps < max_steps) {
+        uint64_t left = max_steps - state->steps;
+        int exit_code = prog->run(state->regs, &state->flags, &state->pc, state->dmem, &left);
+        state->steps = max_steps - left;
+        if(exit_code == AOT_EXIT_HALTED) {
+            state->status = SIM_HALTED;
+            return SIM_HALTED;
+        }
+        if(state->steps >= max_steps) break;
+
+        // the compiled code stopped at an input instruction or where the budget runs out before the end of a block
+        bool writes_code = state->pc < state->code_len && (isa_decode(state->cmem[state->pc]) == INST_INPUTC || isa_decode(state->cmem[state->pc]) == INST_INPUTCF);
+        if(sim_step(state, input) != SIM_RUNNING) return state->status;
+
+        // a program that changed its own code is no longer the one that was compiled
+        if(writes_code && !same_program(prog, state)) return sim_run(state, input, max_steps);
+    }
+    return SIM_RUNNING;
+}
+
+void aot_free(AotProgram *prog) {
+    if(prog->handle != NULL) dlclose(prog->handle);
+    prog->handle = NULL;
+    prog->run = NULL;
+}
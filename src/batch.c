@@ -0,0 +1,436 @@
+#include "batch.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include "aot.h"
+#include "fileio.h"
+#include "lockstep.h"
+#include "output.h"
+#include "scan.h"
+#include "sim.h"
+
+typedef struct {
+    uint8_t addr;
+    uint8_t value;
+} Expectation;
+
+// one run, its inputs and expectations are slices of the pools in Batch
+typedef struct {
+    int program;
+    int line; // line of the vector file, for the report
+    uint32_t input_start;
+    uint32_t input_len;
+    uint32_t expect_start;
+    uint32_t expect_len;
+} Vector;
+
+typedef struct {
+    char *image_path;
+    char *vector_path;
+    uint16_t code[TARGET_CSEG_MAX];
+    size_t code_len;
+    uint8_t data[TARGET_DSEG_MAX];
+    size_t data_len;
+    AotProgram aot; // the compiled program, its run is NULL unless the batch runs compiled
+} Program;
+
+// everything loaded from the list file, read only once the workers start
+typedef struct {
+    Program *programs;
+    int num_programs;
+    size_t programs_cap;
+    Vector *vectors;
+    size_t num_vectors;
+    size_t vectors_cap;
+    uint16_t *inputs;
+    size_t num_inputs;
+    size_t inputs_cap;
+    Expectation *expects;
+    size_t num_expects;
+    size_t expects_cap;
+} Batch;
+
+typedef struct {
+    uint8_t status; // SimStatus the run ended with
+    bool passed;
+    uint8_t bad_addr; // first data address that did not match
+    uint8_t got; // value found at bad_addr
+    uint64_t steps;
+} RunResult;
+
+// each worker is on its own cache line, since its range is written by every thief
+typedef struct Worker {
+    _Alignas(64) _Atomic uint64_t range; // next run to take in the low 32 bits, end of the range in the high 32 bits
+    pthread_t thread;
+    int id;
+    int num_workers;
+    struct Worker *all;
+    const Batch *batch;
+    RunResult *results;
+    bool lockstep;
+    // written only by the worker itself
+    uint64_t steps;
+    size_t runs;
+    size_t steals;
+} Worker;
+
+// grows a pool so it can hold one more element
+static bool reserve(void **items, size_t elem_size, size_t len, size_t *cap) {
+    if(len < *cap) return true;
+    size_t new_cap = *cap == 0 ? 64 : *cap * 2;
+    void *grown = realloc(*items, elem_size * new_cap);
+    if(grown == NULL) {
+        printf("Error allocating memory\n");
+        return false;
+    }
+    *items = grown;
+    *cap = new_cap;
+    return true;
+}
+
+static char *skip_space(char *s) {
+    while(*s == ' ' || *s == '\t' || *s == '\r' || *s == ',') s++;
+    return s;
+}
+
+// parses one line of a vector file, which has already had its comment removed
+static bool parse_vector(Batch *b, char *line, const char *path, int line_num) {
+    Vector v = {b->num_programs - 1, line_num, b->num_inputs, 0, b->num_expects, 0};
+
+    char *expect = strstr(line, "=>");
+    if(expect != NULL) *expect = '\0';
+
+    char *s = skip_space(line);
+    while(*s != '\0') {
+        char *end;
+        long val = strtol(s, &end, 0);
+        if(end == s || val < -32768 || val > 65535) {
+            printf("%s:%d: invalid input value \"%.*s\"\n", path, line_num, (int) strcspn(s, " \t\r,"), s);
+            return false;
+        }
+        if(!reserve((void **) &b->inputs, sizeof(uint16_t), b->num_inputs, &b->inputs_cap)) return false;
+        b->inputs[b->num_inputs++] = (uint16_t) val;
+        v.input_len++;
+        s = skip_space(end);
+    }
+
+    if(expect != NULL) {
+        s = skip_space(expect + 2);
+        while(*s != '\0') {
+            char *end;
+            long addr = strtol(s, &end, 0);
+            long val = 0;
+            bool ok = end != s && *end == '=' && addr >= 0 && addr < DSEG_SIZE;
+            if(ok) {
+                s = end + 1;
+                val = strtol(s, &end, 0);
+                ok = end != s && val >= -128 && val <= 255;
+            }
+            if(!ok) {
+                printf("%s:%d: expected data address=value, found \"%.*s\"\n", path, line_num, (int) strcspn(s, " \t\r,"), s);
+                return false;
+            }
+            if(!reserve((void **) &b->expects, sizeof(Expectation), b->num_expects, &b->expects_cap)) return false;
+            b->expects[b->num_expects++] = (Expectation) {(uint8_t) addr, (uint8_t) val};
+            v.expect_len++;
+            s = skip_space(end);
+        }
+    }
+
+    if(!reserve((void **) &b->vectors, sizeof(Vector), b->num_vectors, &b->vectors_cap)) return false;
+    b->vectors[b->num_vectors++] = v;
+    return true;
+}
+
+// calls fn on every line of the file that is not blank once its ';' or '#' comment is removed
+static bool for_each_line(const char *path, bool (*fn)(Batch *, char *, const char *, int), Batch *b) {
+    char *buf = NULL;
+    size_t cap = 0, len;
+    if(!read_file(path, &buf, &cap, &len)) {
+        free(buf);
+        return false;
+    }
+
+    bool ok = true;
+    int line_num = 0;
+    for(char *line = buf; ok && line != NULL; ) {
+        char *next = strchr(line, '\n');
+        if(next != NULL) *next++ = '\0';
+        line_num++;
+
+        line[strcspn(line, ";#")] = '\0';
+        if(!is_blank(line)) ok = fn(b, line, path, line_num);
+        line = next;
+    }
+
+    free(buf);
+    return ok;
+}
+
+static bool parse_program(Batch *b, char *line, const char *list_path, int line_num) {
+    char image[512], vectors[512];
+    if(sscanf(line, "%511s %511s", image, vectors) != 2) {
+        printf("%s:%d: expected an image and a vector file\n", list_path, line_num);
+        return false;
+    }
+
+    if(!reserve((void **) &b->programs, sizeof(Program), b->num_programs, &b->programs_cap)) return false;
+    Program *p = &b->programs[b->num_programs];
+    memset(p, 0, sizeof(Program));
+    if(!read_bin(image, p->code, &p->code_len, CSEG_SIZE, p->data, &p->data_len, DSEG_SIZE)) return false;
+    p->image_path = strdup(image);
+    p->vector_path = strdup(vectors);
+    if(p->image_path == NULL || p->vector_path == NULL) {
+        printf("Error allocating memory\n");
+        free(p->image_path);
+        free(p->vector_path);
+        return false;
+    }
+    b->num_programs++;
+
+    return for_each_line(p->vector_path, parse_vector, b);
+}
+
+static void free_batch(Batch *b) {
+    for(int i = 0; i < b->num_programs; i++) {
+        free(b->programs[i].image_path);
+        free(b->programs[i].vector_path);
+        aot_free(&b->programs[i].aot);
+    }
+    free(b->programs);
+    free(b->vectors);
+    free(b->inputs);
+    free(b->expects);
+}
+
+static SimInput vector_input(const Batch *b, size_t i) {
+    const Vector *v = &b->vectors[i];
+    return (SimInput) {(uint16_t *) b->inputs + v->input_start, v->input_len, v->input_len};
+}
+
+// checks the state a run ended in against what its vector expects
+static void check_vector(const Batch *b, size_t i, const SimState *state, RunResult *res) {
+    const Vector *v = &b->vectors[i];
+    SimStatus status = state->status;
+    if(status == SIM_RUNNING) status = SIM_STEP_LIMIT;
+
+    res->status = status;
+    res->steps = state->steps;
+    res->passed = status == SIM_HALTED;
+    for(uint32_t j = 0; res->passed && j < v->expect_len; j++) {
+        const Expectation *e = &b->expects[v->expect_start + j];
+        if(state->dmem[e->addr] != e->value) {
+            res->passed = false;
+            res->bad_addr = e->addr;
+            res->got = state->dmem[e->addr];
+        }
+    }
+}
+
+static void run_vector(const Batch *b, size_t i, RunResult *res) {
+    const Program *p = &b->programs[b->vectors[i].program];
+
+    SimState state;
+    sim_reset(&state, p->code, p->code_len, p->data, p->data_len);
+    SimInput input = vector_input(b, i);
+    if(p->aot.run != NULL) aot_run(&p->aot, &state, &input, SIM_DEFAULT_STEPS);
+    else sim_run(&state, &input, SIM_DEFAULT_STEPS);
+    check_vector(b, i, &state, res);
+}
+
+// runs count vectors of the same program starting at first together on the lockstep simulator
+static void run_lockstep(const Batch *b, size_t first, int count, RunResult *results) {
+    const Program *p = &b->programs[b->vectors[first].program];
+
+    SimInput inputs[LOCKSTEP_LANES];
+    SimState states[LOCKSTEP_LANES];
+    for(int k = 0; k < count; k++) inputs[k] = vector_input(b, first + k);
+    lockstep_run(p->code, p->code_len, p->data, p->data_len, inputs, count, SIM_DEFAULT_STEPS, states);
+    for(int k = 0; k < count; k++) check_vector(b, first + k, &states[k], &results[first + k]);
+}
+
+#define RANGE(begin, end) ((uint64_t) (end) << 32 | (uint32_t) (begin))
+#define RANGE_BEGIN(range) ((uint32_t) (range))
+#define RANGE_END(range) ((uint32_t) ((range) >> 32))
+
+// takes up to max runs of the same program from the front of the worker's own range, returns how many it took
+static uint32_t take_own(Worker *w, uint32_t max, uint32_t *run) {
+    const Vector *vectors = w->batch->vectors;
+    uint64_t range = atomic_load(&w->range);
+    while(RANGE_BEGIN(range) < RANGE_END(range)) {
+        uint32_t begin = RANGE_BEGIN(range), count = 1;
+        while(count < max && begin + count < RANGE_END(range) && vectors[begin + count].program == vectors[begin].program) count++;
+        if(atomic_compare_exchange_weak(&w->range, &range, RANGE(begin + count, RANGE_END(range)))) {
+            *run = begin;
+            return count;
+        }
+    }
+    return 0;
+}
+
+// moves the back half of another worker's remaining range into this worker's range, which is empty
+static bool steal(Worker *w) {
+    Worker *workers = w->all;
+    for(int k = 1; k < w->num_workers; k++) {
+        Worker *victim = &workers[(w->id + k) % w->num_workers];
+        uint64_t range = atomic_load(&victim->range);
+        while(RANGE_BEGIN(range) < RANGE_END(range)) {
+            uint32_t begin = RANGE_BEGIN(range), end = RANGE_END(range);
+            uint32_t mid = begin + (end - begin) / 2;
+            if(atomic_compare_exchange_weak(&victim->range, &range, RANGE(begin, mid))) {
+                atomic_store(&w->range, RANGE(mid, end));
+                w->steals++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    uint32_t max = w->lockstep ? LOCKSTEP_LANES : 1;
+    uint32_t run, count;
+    while((count = take_own(w, max, &run)) > 0 || (steal(w) && (count = take_own(w, max, &run)) > 0)) {
+        if(w->lockstep) run_lockstep(w->batch, run, count, w->results);
+        else run_vector(w->batch, run, &w->results[run]);
+        for(uint32_t k = 0; k < count; k++) w->steps += w->results[run + k].steps;
+        w->runs += count;
+    }
+    return NULL;
+}
+
+static void report_failure(FILE *out, const Batch *b, size_t i, const RunResult *res) {
+    const Vector *v = &b->vectors[i];
+    const Program *p = &b->programs[v->program];
+    fprintf(out, "FAIL %s:%d (%s): ", p->vector_path, v->line, p->image_path);
+
+    if(res->status == SIM_NO_INPUT) {
+        fprintf(out, "ran out of input\n");
+    } else if(res->status == SIM_STEP_LIMIT) {
+        fprintf(out, "did not end within %d instructions\n", SIM_DEFAULT_STEPS);
+    } else {
+        for(uint32_t j = 0; j < v->expect_len; j++) {
+            const Expectation *e = &b->expects[v->expect_start + j];
+            if(e->addr == res->bad_addr) {
+                fprintf(out, "data[%d] = %d, expected %d\n", e->addr, res->got, e->value);
+                break;
+            }
+        }
+    }
+}
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int run_batch(const char *list_path, const BatchOptions *opts) {
+    if(opts->lockstep && opts->aot) {
+        printf("--lockstep and --aot cannot be combined\n");
+        return -1;
+    }
+
+    Batch b;
+    memset(&b, 0, sizeof(Batch));
+    if(!for_each_line(list_path, parse_program, &b)) {
+        free_batch(&b);
+        return -1;
+    }
+
+    if(b.num_vectors > UINT32_MAX) {
+        printf("Too many vectors in %s\n", list_path);
+        free_batch(&b);
+        return -1;
+    }
+
+    // each program is compiled once, before the clock starts, and the library is shared by every worker
+    for(int i = 0; opts->aot && i < b.num_programs; i++) {
+        if(!aot_compile(&b.programs[i].aot, b.programs[i].code, b.programs[i].code_len)) {
+            free_batch(&b);
+            return -1;
+        }
+    }
+
+    int num_workers = opts->threads > 0 ? opts->threads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_workers < 1) num_workers = 1;
+    if((size_t) num_workers > b.num_vectors) num_workers = b.num_vectors > 0 ? b.num_vectors : 1;
+
+    RunResult *results = calloc(b.num_vectors > 0 ? b.num_vectors : 1, sizeof(RunResult));
+    Worker *workers = aligned_alloc(64, sizeof(Worker) * num_workers);
+    if(results == NULL || workers == NULL) {
+        printf("Error allocating memory\n");
+        free(results);
+        free(workers);
+        free_batch(&b);
+        return -1;
+    }
+
+    // the runs start out split evenly, stealing evens out programs that take longer than others
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < num_workers; i++) {
+        Worker *w = &workers[i];
+        memset(w, 0, sizeof(Worker));
+        atomic_init(&w->range, RANGE(b.num_vectors * i / num_workers, b.num_vectors * (i + 1) / num_workers));
+        w->id = i;
+        w->num_workers = num_workers;
+        w->all = workers;
+        w->batch = &b;
+        w->results = results;
+        w->lockstep = opts->lockstep;
+    }
+
+    int started = 0;
+    for(; started < num_workers; started++) {
+        if(pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]) != 0) break;
+    }
+    // any runs left to threads that could not be started are stolen by the others, or run here
+    if(started == 0) worker_main(&workers[0]);
+    for(int i = 0; i < started; i++) pthread_join(workers[i].thread, NULL);
+    double elapsed = seconds_since(&start);
+
+    FILE *out = stdout;
+    if(opts->report != NULL && (out = fopen(opts->report, "w")) == NULL) {
+        printf("Error opening report %s\n", opts->report);
+        out = stdout;
+    }
+
+    uint64_t steps = 0;
+    size_t steals = 0;
+    for(int i = 0; i < num_workers; i++) {
+        steps += workers[i].steps;
+        steals += workers[i].steals;
+    }
+
+    size_t total_passed = 0;
+    size_t first = 0;
+    for(int p = 0; p < b.num_programs; p++) {
+        size_t passed = 0, count = 0;
+        for(; first + count < b.num_vectors && b.vectors[first + count].program == p; count++) {
+            const RunResult *res = &results[first + count];
+            if(res->passed) passed++;
+            else report_failure(out, &b, first + count, res);
+        }
+        fprintf(out, "%s: %zu/%zu vectors passed\n", b.programs[p].image_path, passed, count);
+        total_passed += passed;
+        first += count;
+    }
+
+    fprintf(out, "Total: %zu vectors, %zu passed, %zu failed\n", b.num_vectors, total_passed, b.num_vectors - total_passed);
+    fprintf(out, "Simulated %llu instructions in %.3f s on %d threads%s (%zu steals): %.1f M instructions/s, %.0f vectors/s\n",
+            (unsigned long long) steps, elapsed, num_workers, opts->lockstep ? " in lockstep" : opts->aot ? " as native code" : "", steals, elapsed > 0 ? steps / elapsed / 1e6 : 0.0,
+            elapsed > 0 ? b.num_vectors / elapsed : 0.0);
+
+    if(out != stdout) fclose(out);
+
+    int result = total_passed == b.num_vectors ? 0 : -1;
+    free(results);
+    free(workers);
+    free_batch(&b);
+    return result;
+}
@@ -0,0 +1,197 @@
+#include "cfg.h"
+
+#include "isa.h"
+#include "instructions.h"
+
+// state shared by the steps of the pass, all indices are positions in the IR before anything is deleted
+typedef struct {
+    size_t len;
+    const uint16_t *opcode;
+    int *target; // where each branch goes, -1 for any other instruction
+    bool *keep;
+    int *work; // stack for the reachability walk
+} Cfg;
+
+static bool is_jump(const Cfg *cfg, size_t i) {
+    return isa_decode(cfg->opcode[i]) == INST_JUMP;
+}
+
+// the first instruction at or after i that has not been deleted, or len
+static size_t next_kept(const Cfg *cfg, size_t i) {
+    while(i < cfg->len && !cfg->keep[i]) i++;
+    return i;
+}
+
+// points every branch that lands on a JUMP at wherever the chain of JUMPs finally leads
+static int thread_jumps(Cfg *cfg) {
+    int threaded = 0;
+    for(size_t i = 0; i < cfg->len; i++) {
+        if(!cfg->keep[i] || cfg->target[i] < 0) continue;
+
+        size_t t = next_kept(cfg, cfg->target[i]);
+        // a chain longer than the program is a loop of JUMPs, which is left alone
+        for(size_t hops = 0; t < cfg->len && is_jump(cfg, t) && t != i && hops < cfg->len; hops++) {
+            t = next_kept(cfg, cfg->target[t]);
+        }
+        if(t < cfg->len && is_jump(cfg, t) && t != i) continue;
+
+        // the offset has to fit before anything is deleted, deleting only ever brings the target closer
+        int offset = (int) t - (int) i - 1;
+        if(t == next_kept(cfg, cfg->target[i]) || offset < PCOFFSET_MIN || offset > PCOFFSET_MAX) continue;
+
+        cfg->target[i] = t;
+        threaded++;
+    }
+    return threaded;
+}
+
+// deletes branches whose target is the instruction that runs next anyway, a branch never changes the flags
+static int remove_fallthrough(Cfg *cfg) {
+    int removed = 0;
+    for(size_t i = 0; i < cfg->len; i++) {
+        if(!cfg->keep[i] || cfg->target[i] < 0) continue;
+        if(next_kept(cfg, cfg->target[i]) != next_kept(cfg, i + 1)) continue;
+
+        cfg->keep[i] = false;
+        removed++;
+    }
+    return removed;
+}
+
+// deletes every instruction the first one cannot reach, returns the number deleted
+static int remove_unreachable(Cfg *cfg, bool *reached) {
+    memset(reached, 0, sizeof(bool) * cfg->len);
+
+    int top = 0;
+    size_t entry = next_kept(cfg, 0);
+    if(entry < cfg->len) {
+        reached[entry] = true;
+        cfg->work[top++] = entry;
+    }
+
+    while(top > 0) {
+        size_t i = cfg->work[--top];
+        size_t succ[2];
+        int num_succ = 0;
+
+        if(cfg->target[i] >= 0) succ[num_succ++] = next_kept(cfg, cfg->target[i]);
+        if(!is_jump(cfg, i)) succ[num_succ++] = next_kept(cfg, i + 1);
+
+        for(int k = 0; k < num_succ; k++) {
+            if(succ[k] >= cfg->len || reached[succ[k]]) continue;
+            reached[succ[k]] = true;
+            cfg->work[top++] = succ[k];
+        }
+    }
+
+    int removed = 0;
+    for(size_t i = 0; i < cfg->len; i++) {
+        if(cfg->keep[i] && !reached[i]) {
+            cfg->keep[i] = false;
+            removed++;
+        }
+    }
+    return removed;
+}
+
+bool cfg_find_targets(const InstIR *ir, const SymbolTable *syms, int *target) {
+    for(size_t i = 0; i < ir->len; i++) {
+        // a branch out of the program ends it, which is only kept track of when it lands exactly one past the end
+        target[i] = -1;
+        if(inst_table[isa_decode(ir->opcode[i])].pattern == PAT_OFFSET) {
+            int t = (int) i + 1 + (int8_t) (ir->opcode[i] & 0xFF);
+            if(t < 0 || t > (int) ir->len) return false;
+            target[i] = t;
+        }
+
+        // code written at runtime could be anything, including a branch into the middle of a deleted block
+        if(ir->operand_kinds[i] & OPND_CADDR) return false;
+
+        // a code label used as a value would no longer point at the right instruction
+        int32_t ref = ir->sym_ref[i];
+        if(target[i] < 0 && ref >= 0 && ref < syms->len && syms->syms[ref].kind == SYM_CODE) return false;
+    }
+    return true;
+}
+
+static bool writes_flags(InstId id) {
+    return id == INST_ADD || id == INST_ADDI || id == INST_SUB || id == INST_SUBI || id == INST_CMP || id == INST_SHIFTL || id == INST_SHIFTR;
+}
+
+bool cfg_flags_dead(const InstIR *ir, const int *target, int i) {
+    for(size_t steps = 0; steps <= ir->len; steps++) {
+        if(i < 0 || i >= (int) ir->len) return true;
+
+        InstId id = isa_decode(ir->opcode[i]);
+        if(writes_flags(id)) return true;
+        if(id == INST_JUMP) i = target[i];
+        else if(inst_table[id].pattern == PAT_OFFSET) return false;
+        else i++;
+    }
+    // a loop that never touches the flags
+    return true;
+}
+
+bool cfg_optimize(InstIR *ir, const SymbolTable *syms, CfgStats *stats) {
+    memset(stats, 0, sizeof(CfgStats));
+    stats->words_before = ir->len;
+    stats->words_after = ir->len;
+    if(ir->len == 0) return true;
+
+    Cfg cfg = {ir->len, ir->opcode, NULL, NULL, NULL};
+    cfg.target = malloc(sizeof(int) * ir->len);
+    cfg.keep = malloc(sizeof(bool) * ir->len);
+    cfg.work = malloc(sizeof(int) * ir->len);
+    bool *reached = malloc(sizeof(bool) * ir->len);
+    int *new_index = malloc(sizeof(int) * (ir->len + 1));
+    if(cfg.target == NULL || cfg.keep == NULL || cfg.work == NULL || reached == NULL || new_index == NULL) {
+        free(cfg.target);
+        free(cfg.keep);
+        free(cfg.work);
+        free(reached);
+        free(new_index);
+        return false;
+    }
+
+    for(size_t i = 0; i < ir->len; i++) cfg.keep[i] = true;
+
+    if(!cfg_find_targets(ir, syms, cfg.target)) {
+        stats->skipped = true;
+    } else {
+        // each step can open up more work for the others, so they run until nothing changes
+        bool changed = true;
+        while(changed) {
+            int threaded = thread_jumps(&cfg);
+            int fallthrough = remove_fallthrough(&cfg);
+            int unreachable = remove_unreachable(&cfg, reached);
+            stats->threaded += threaded;
+            stats->fallthrough += fallthrough;
+            stats->unreachable += unreachable;
+            changed = threaded + fallthrough + unreachable > 0;
+        }
+
+        // a deleted instruction maps to the one that took its place, and the end of the program to the new end
+        int kept = 0;
+        for(size_t i = 0; i < ir->len; i++) {
+            new_index[i] = kept;
+            if(cfg.keep[i]) kept++;
+        }
+        new_index[ir->len] = kept;
+
+        for(size_t i = 0; i < ir->len; i++) {
+            if(!cfg.keep[i] || cfg.target[i] < 0) continue;
+            int offset = new_index[cfg.target[i]] - new_index[i] - 1;
+            ir->opcode[i] = (ir->opcode[i] & 0xFF00) | (uint8_t) offset;
+        }
+
+        ir_remove(ir, cfg.keep);
+        stats->words_after = ir->len;
+    }
+
+    free(cfg.target);
+    free(cfg.keep);
+    free(cfg.work);
+    free(reached);
+    free(new_index);
+    return true;
+}
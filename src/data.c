@@ -0,0 +1,308 @@
+#include "data.h"
+
+#include <ctype.h>
+#include <strings.h>
+#include "scan.h"
+
+// state for parsing the values of one data declaration
+typedef struct {
+    const char *line;
+    int line_num;
+    const SymbolTable *syms;
+    DataImage *data;
+    size_t limit;
+    DiagList *diags;
+    int depth; // DUP groups the parser is inside of
+} DataParser;
+
+// deepest nesting of DUP groups, each level is a few calls deeper on the stack
+#define DUP_MAX_DEPTH 256
+
+static void skip_space(const char **s) {
+    while(**s == ' ' || **s == '\t' || **s == '\r') (*s)++;
+}
+
+static size_t ident_len(const char *s) {
+    size_t len = 0;
+    while(isalnum((unsigned char) s[len]) || s[len] == '_' || s[len] == '.') len++;
+    return len;
+}
+
+// checks whether s starts with the keyword word, in any case, followed by something that cannot continue it
+static bool match_keyword(const char *s, const char *word) {
+    size_t len = strlen(word);
+    return strncasecmp(s, word, len) == 0 && ident_len(s) == len;
+}
+
+static int col_of(const DataParser *p, const char *at) {
+    return (int) (at - p->line) + 1;
+}
+
+// appends len bytes to the image, reporting an error if that would overflow data memory
+static uint8_t *reserve(DataParser *p, const char *at, size_t len) {
+    if(p->data->len + len > p->limit) {
+        diag_report(p->diags, DIAG_ERROR, E_DSEG_FULL, p->line_num, col_of(p, at), "Too many bytes in data segment, only %zu bytes of data memory are available", p->limit);
+        return NULL;
+    }
+
+    uint8_t *bytes = data_extend(p->data, len);
+    if(bytes == NULL) diag_report(p->diags, DIAG_ERROR, E_DSEG_FULL, p->line_num, col_of(p, at), "Error allocating memory");
+    return bytes;
+}
+
+static bool parse_value_list(DataParser *p, const char **s, char close);
+
+static bool parse_string(DataParser *p, const char **s) {
+    const char *start = *s;
+    (*s)++; // skip the opening quote
+
+    while(**s != '"') {
+        char c = *(*s)++;
+        if(c == '\0') {
+            diag_report(p->diags, DIAG_ERROR, E_BAD_DIRECTIVE, p->line_num, col_of(p, start), "Unterminated string");
+            return false;
+        }
+
+        if(c == '\\') {
+            switch(*(*s)++) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+                case '\\': c = '\\'; break;
+                case '"': c = '"'; break;
+                default:
+                    diag_report(p->diags, DIAG_ERROR, E_BAD_DIRECTIVE, p->line_num, col_of(p, *s - 2), "Unknown escape in string");
+                    return false;
+            }
+        }
+
+        uint8_t *byte = reserve(p, start, 1);
+        if(byte == NULL) return false;
+        *byte = c;
+    }
+
+    (*s)++; // skip the closing quote
+    return true;
+}
+
+// parses "count DUP(values)" once the count has been read, the group is parsed once and then copied
+static bool parse_dup(DataParser *p, const char **s, const char *start, int32_t count) {
+    *s += 3; // skip DUP
+    skip_space(s);
+    if(**s != '(') {
+        diag_report(p->diags, DIAG_ERROR, E_MISSING_OPERAND, p->line_num, col_of(p, *s), "Expected \"(\" after DUP");
+        return false;
+    }
+    (*s)++;
+
+    if(count < 0) {
+        diag_report(p->diags, DIAG_ERROR, E_RANGE, p->line_num, col_of(p, start), "DUP count %d is negative", count);
+        return false;
+    }
+
+    if(p->depth == DUP_MAX_DEPTH) {
+        diag_report(p->diags, DIAG_ERROR, E_BAD_DIRECTIVE, p->line_num, col_of(p, start), "DUP groups are nested more than %d levels deep", DUP_MAX_DEPTH);
+        return false;
+    }
+
+    size_t group_start = p->data->len;
+    p->depth++;
+    bool ok = parse_value_list(p, s, ')');
+    p->depth--;
+    if(!ok) return false;
+    (*s)++; // skip the closing parenthesis
+
+    size_t group_len = p->data->len - group_start;
+    if(count == 0 || group_len == 0) {
+        p->data->len = group_start;
+        return true;
+    }
+
+    // checked before multiplying so a huge count cannot overflow
+    if((size_t) count > p->limit || group_start + group_len * count > p->limit) {
+        diag_report(p->diags, DIAG_ERROR, E_DSEG_FULL, p->line_num, col_of(p, start), "Too many bytes in data segment, only %zu bytes of data memory are available", p->limit);
+        return false;
+    }
+
+    if(reserve(p, start, group_len * (count - 1)) == NULL) return false;
+
+    // copy in doubling steps, so each byte is written once
+    uint8_t *group = p->data->bytes + group_start;
+    size_t filled = group_len;
+    size_t total = group_len * count;
+    while(filled < total) {
+        size_t n = filled < total - filled ? filled : total - filled;
+        memcpy(group + filled, group, n);
+        filled += n;
+    }
+
+    return true;
+}
+
+static bool parse_value(DataParser *p, const char **s) {
+    skip_space(s);
+    const char *start = *s;
+
+    if(**s == '?') {
+        (*s)++;
+        uint8_t *byte = reserve(p, start, 1);
+        if(byte == NULL) return false;
+        *byte = 0; // reserved bytes start out cleared, just like data memory at reset
+        return true;
+    }
+
+    if(**s == '"') return parse_string(p, s);
+
+    char err[128];
+    ExprValue val;
+    if(!eval_expr(s, p->syms, false, &val, err, sizeof(err))) {
+        diag_report(p->diags, DIAG_ERROR, val.overflow ? E_RANGE : E_BAD_EXPR, p->line_num, col_of(p, start), "Invalid data value: %s", err);
+        return false;
+    }
+
+    if(match_keyword(*s, "DUP")) return parse_dup(p, s, start, val.value);
+
+    if(val.value < -128 || val.value > 255) {
+        diag_report(p->diags, DIAG_ERROR, E_RANGE, p->line_num, col_of(p, start), "The data value %d is out of range [-128, 255]", val.value);
+        return false;
+    }
+
+    uint8_t *byte = reserve(p, start, 1);
+    if(byte == NULL) return false;
+    *byte = (uint8_t) val.value;
+    return true;
+}
+
+// parses values separated by commas, up to the end of the line or the close character, which is left unconsumed
+static bool parse_value_list(DataParser *p, const char **s, char close) {
+    while(true) {
+        if(!parse_value(p, s)) return false;
+
+        skip_space(s);
+        if(**s == ',') {
+            (*s)++;
+            continue;
+        }
+
+        if(**s == close) return true;
+
+        if(close == '\0') diag_report(p->diags, DIAG_ERROR, E_TRAILING, p->line_num, col_of(p, *s), "Unexpected \"%s\" after data value", *s);
+        else if(**s == '\0') diag_report(p->diags, DIAG_ERROR, E_MISSING_OPERAND, p->line_num, col_of(p, *s), "Missing \"%c\" after DUP values", close);
+        else diag_report(p->diags, DIAG_ERROR, E_TRAILING, p->line_num, col_of(p, *s), "Unexpected \"%c\" in DUP values", **s);
+        return false;
+    }
+}
+
+bool is_equ(const char *line) {
+    while(*line == ' ' || *line == '\t') line++;
+    return strncmp(line, ".equ", 4) == 0 && (line[4] == ' ' || line[4] == '\t');
+}
+
+bool parse_equ_line(char *line, int line_num, SymbolTable *syms, DiagList *diags) {
+    bool valid = false;
+
+    const char *s = strstr(line, ".equ") + 4;
+    while(*s == ' ' || *s == '\t') s++;
+    const char *name = s;
+    while(*s != '\0' && *s != ',' && *s != ' ' && *s != '\t') s++;
+    size_t name_len = s - name;
+    while(*s == ' ' || *s == '\t') s++;
+
+    // the line is blanked whether or not the directive is valid, so it is only ever reported once
+    if(name_len == 0 || *s != ',') {
+        diag_report(diags, DIAG_ERROR, E_BAD_DIRECTIVE, line_num, (int) (s - line) + 1, "Expected \".equ NAME, value\"");
+    } else {
+        s++;
+        const char *start = s;
+        while(*start == ' ' || *start == '\t') start++;
+
+        char err[128];
+        ExprValue val;
+        if(!eval_expr(&s, syms, false, &val, err, sizeof(err))) {
+            diag_report(diags, DIAG_ERROR, val.overflow ? E_RANGE : E_BAD_EXPR, line_num, (int) (start - line) + 1, "Invalid value for constant %.*s: %s", (int) name_len, name, err);
+        } else if(!is_blank(s)) {
+            diag_report(diags, DIAG_ERROR, E_TRAILING, line_num, (int) (s - line) + 1, "Unexpected \"%s\" after constant %.*s", s, (int) name_len, name);
+        } else if(!add_symbol(syms, name, name_len, val.value, SYM_CONST)) {
+            diag_report(diags, DIAG_ERROR, E_DUP_SYMBOL, line_num, (int) (name - line) + 1, "Symbol %.*s is already defined", (int) name_len, name);
+        } else {
+            valid = true;
+        }
+    }
+
+    line[0] = '\0';
+    return valid;
+}
+
+bool parse_equ(char **lines, int i, SymbolTable *syms, DiagList *diags) {
+    return parse_equ_line(lines[i], i + 1, syms, diags);
+}
+
+int parse_equs(char **lines, int lines_len, SymbolTable *syms, DiagList *diags) {
+    int num_equs = 0;
+    for(int i = 0; i < lines_len; i++) {
+        if(is_equ(lines[i]) && parse_equ(lines, i, syms, diags)) num_equs++;
+    }
+
+    return num_equs;
+}
+
+int parse_data_line(const char *line, int line_num, SymbolTable *syms, DataImage *data, size_t limit, DiagList *diags) {
+    const char *s = line;
+    skip_space(&s);
+    if(*s == '\0') return 0;
+
+    DataParser p = {line, line_num, syms, data, limit, diags};
+
+    // the name is optional, a declaration without one carries on from the previous label
+    const char *name = s;
+    size_t name_len = 0;
+    if(!match_keyword(s, "BYTE")) {
+        name_len = ident_len(s);
+        if(name_len == 0) {
+            diag_report(diags, DIAG_ERROR, E_BAD_DIRECTIVE, line_num, col_of(&p, s), "Expected a data label");
+            return 0;
+        }
+        s += name_len;
+        skip_space(&s);
+    }
+
+    if(!match_keyword(s, "BYTE")) {
+        diag_report(diags, DIAG_ERROR, E_BAD_DIRECTIVE, line_num, col_of(&p, s), "Expected data type BYTE after %.*s", (int) name_len, name);
+        return 0;
+    }
+    s += 4;
+
+    if(name_len > 0 && !add_symbol(syms, name, name_len, data->len, SYM_DATA)) {
+        diag_report(diags, DIAG_ERROR, E_DUP_SYMBOL, line_num, col_of(&p, name), "Data label %.*s is already defined", (int) name_len, name);
+        return 0;
+    }
+
+    skip_space(&s);
+    if(*s == '\0') {
+        diag_report(diags, DIAG_ERROR, E_MISSING_OPERAND, line_num, col_of(&p, s), "Missing value for data label %.*s", (int) name_len, name);
+    } else {
+        parse_value_list(&p, &s, '\0');
+    }
+    return name_len > 0 ? 1 : 0;
+}
+
+int parse_dseg(char **lines, int offset, int lines_len, SymbolTable *syms, DataImage *data, size_t limit, DiagList *diags) {
+    offset++; // skip the segment declaration
+
+    int num_labels = 0;
+    for(int i = offset; i < lines_len; i++) {
+        // check if we reached a code segment
+        if(strncmp(lines[i], ".code", 5) == 0) break;
+
+        // constants are defined in source order along with the data, so each can use whatever is declared above it
+        if(is_equ(lines[i])) {
+            parse_equ(lines, i, syms, diags);
+            continue;
+        }
+
+        num_labels += parse_data_line(lines[i], i + 1, syms, data, limit, diags);
+    }
+
+    return num_labels;
+}
@@ -0,0 +1,129 @@
+#include "diag.h"
+
+void diag_init(DiagList *diags, const char *file) {
+    memset(diags, 0, sizeof(DiagList));
+    diags->file = file;
+}
+
+void diag_clear(DiagList *diags) {
+    for(int i = 0; i < diags->len; i++) free(diags->items[i].msg);
+    diags->len = 0;
+    diags->errors = 0;
+    diags->warnings = 0;
+    diags->dropped = 0;
+}
+
+void diag_free(DiagList *diags) {
+    diag_clear(diags);
+    free(diags->items);
+    diags->items = NULL;
+    diags->cap = 0;
+}
+
+void diag_vreport(DiagList *diags, int severity, int code, int line, int col, const char *fmt, va_list ap) {
+    // the count is what fails the assembly, so it is kept even if the diagnostic itself cannot be
+    if(severity == DIAG_ERROR) diags->errors++;
+    else diags->warnings++;
+
+    // measure the message first so it can be stored at its exact size
+    va_list measure;
+    va_copy(measure, ap);
+    int len = vsnprintf(NULL, 0, fmt, measure);
+    va_end(measure);
+    char *msg = len >= 0 ? malloc(sizeof(char) * (len + 1)) : NULL;
+    if(msg == NULL) {
+        diags->dropped++;
+        return;
+    }
+    vsnprintf(msg, len + 1, fmt, ap);
+
+    if(diags->len == diags->cap) {
+        int cap = diags->cap == 0 ? 16 : diags->cap * 2;
+        Diagnostic *grown = realloc(diags->items, sizeof(Diagnostic) * cap);
+        if(grown == NULL) {
+            free(msg);
+            diags->dropped++;
+            return;
+        }
+        diags->items = grown;
+        diags->cap = cap;
+    }
+
+    Diagnostic *d = &diags->items[diags->len++];
+    d->severity = severity;
+    d->code = code;
+    d->line = line;
+    d->col = col;
+    d->msg = msg;
+}
+
+void diag_report(DiagList *diags, int severity, int code, int line, int col, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    diag_vreport(diags, severity, code, line, col, fmt, ap);
+    va_end(ap);
+}
+
+void diag_append(DiagList *diags, const DiagList *from) {
+    int stored_errors = 0, stored_warnings = 0;
+    for(int i = 0; i < from->len; i++) {
+        const Diagnostic *d = &from->items[i];
+        diag_report(diags, d->severity, d->code, d->line, d->col, "%s", d->msg);
+        if(d->severity == DIAG_ERROR) stored_errors++;
+        else stored_warnings++;
+    }
+
+    // the ones from could not store still count
+    diags->errors += from->errors - stored_errors;
+    diags->warnings += from->warnings - stored_warnings;
+    diags->dropped += from->dropped;
+}
+
+static int compare_position(const void *a, const void *b) {
+    const Diagnostic *da = a;
+    const Diagnostic *db = b;
+    if(da->line != db->line) return da->line - db->line;
+    return da->col - db->col;
+}
+
+static void print_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for(; s != NULL && *s != '\0'; s++) {
+        unsigned char c = *s;
+        if(c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if(c == '\n') fprintf(f, "\\n");
+        else if(c == '\t') fprintf(f, "\\t");
+        else if(c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+void diag_print(DiagList *diags, FILE *f, bool json) {
+    // diagnostics are reported pass by pass, sorting puts them back in file order
+    if(diags->len > 1) qsort(diags->items, diags->len, sizeof(Diagnostic), compare_position);
+
+    if(json) {
+        fprintf(f, "[");
+        for(int i = 0; i < diags->len; i++) {
+            Diagnostic *d = &diags->items[i];
+            bool error = d->severity == DIAG_ERROR;
+            fprintf(f, "%s\n  {\"file\": ", i == 0 ? "" : ",");
+            print_json_string(f, diags->file);
+            fprintf(f, ", \"line\": %d, \"column\": %d, \"severity\": \"%s\", \"code\": \"%c%03d\", \"message\": ", d->line, d->col, error ? "error" : "warning", error ? 'E' : 'W', d->code);
+            print_json_string(f, d->msg);
+            fprintf(f, "}");
+        }
+        fprintf(f, "%s]\n", diags->len == 0 ? "" : "\n");
+        return;
+    }
+
+    for(int i = 0; i < diags->len; i++) {
+        Diagnostic *d = &diags->items[i];
+        bool error = d->severity == DIAG_ERROR;
+        fprintf(f, "%s:%d:%d: %s %c%03d: %s\n", diags->file, d->line, d->col, error ? "error" : "warning", error ? 'E' : 'W', d->code, d->msg);
+    }
+
+    if(diags->dropped > 0) fprintf(f, "%d more diagnostic(s) could not be stored, memory ran out\n", diags->dropped);
+    if(diags->errors > 0 || diags->warnings > 0) fprintf(f, "%d error(s), %d warning(s)\n", diags->errors, diags->warnings);
+}
@@ -0,0 +1,407 @@
+#include "expr.h"
+
+#include <ctype.h>
+#include "instructions.h"
+
+void init_symbols(SymbolTable *table) {
+    table->syms = NULL;
+    table->len = 0;
+    table->cap = 0;
+    table->index = NULL;
+    table->index_cap = 0;
+}
+
+void clear_symbols(SymbolTable *table) {
+    for(int i = 0; i < table->len; i++) free(table->syms[i].name);
+    table->len = 0;
+    if(table->index != NULL) memset(table->index, 0, sizeof(int) * table->index_cap);
+}
+
+void free_symbols(SymbolTable *table) {
+    clear_symbols(table);
+    free(table->syms);
+    free(table->index);
+    init_symbols(table);
+}
+
+// FNV-1a, the names are short and this keeps every lookup to a single pass over them
+static uint32_t hash_name(const char *name, size_t name_len) {
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < name_len; i++) hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+    return hash;
+}
+
+// returns the slot in the index that holds the name, or the empty slot it would go in
+static int find_slot(const SymbolTable *table, const char *name, size_t name_len) {
+    int mask = table->index_cap - 1;
+    int slot = hash_name(name, name_len) & mask;
+    while(table->index[slot] != 0) {
+        const char *other = table->syms[table->index[slot] - 1].name;
+        if(strncmp(other, name, name_len) == 0 && other[name_len] == '\0') break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// doubles the index and puts every symbol back in it
+static bool grow_index(SymbolTable *table) {
+    int cap = table->index_cap == 0 ? 32 : table->index_cap * 2;
+    int *index = calloc(cap, sizeof(int));
+    if(index == NULL) return false;
+
+    free(table->index);
+    table->index = index;
+    table->index_cap = cap;
+    for(int i = 0; i < table->len; i++) {
+        table->index[find_slot(table, table->syms[i].name, strlen(table->syms[i].name))] = i + 1;
+    }
+    return true;
+}
+
+void truncate_symbols(SymbolTable *table, int len) {
+    if(len >= table->len) return;
+    for(int i = len; i < table->len; i++) free(table->syms[i].name);
+    table->len = len;
+
+    // open addressing cannot simply drop entries, so the index is rebuilt from what is left
+    memset(table->index, 0, sizeof(int) * table->index_cap);
+    for(int i = 0; i < table->len; i++) table->index[find_slot(table, table->syms[i].name, strlen(table->syms[i].name))] = i + 1;
+}
+
+bool add_symbol(SymbolTable *table, const char *name, size_t name_len, int32_t value, SymbolKind kind) {
+    if(find_symbol(table, name, name_len) >= 0) return false;
+
+    if(table->len == table->cap) {
+        int cap = table->cap == 0 ? 16 : table->cap * 2;
+        Symbol *grown = realloc(table->syms, sizeof(Symbol) * cap);
+        if(grown == NULL) return false;
+        table->syms = grown;
+        table->cap = cap;
+    }
+    if((table->len + 1) * 2 > table->index_cap && !grow_index(table)) return false;
+
+    Symbol *sym = &table->syms[table->len];
+    sym->name = strndup(name, name_len);
+    if(sym->name == NULL) return false;
+    sym->value = value;
+    sym->kind = kind;
+    table->index[find_slot(table, name, name_len)] = ++table->len;
+    return true;
+}
+
+int find_symbol(const SymbolTable *table, const char *name, size_t name_len) {
+    if(table->index_cap == 0) return -1;
+    return table->index[find_slot(table, name, name_len)] - 1;
+}
+
+// state shared by the recursive descent functions below
+typedef struct {
+    const char *s;
+    const SymbolTable *syms;
+    ExprValue *out;
+    char *err;
+    size_t err_len;
+    int depth; // parentheses and unary operators the parser is inside of
+} ExprParser;
+
+// deepest nesting of parentheses and unary operators, each level is a few calls deeper on the stack
+#define EXPR_MAX_DEPTH 256
+
+static bool expr_or(ExprParser *p, bool allow_reg, int32_t *val);
+
+static void skip_space(ExprParser *p) {
+    while(isspace((unsigned char) *p->s)) p->s++;
+}
+
+// counts one more level of nesting, returns false once the expression goes deeper than EXPR_MAX_DEPTH
+static bool enter_nested(ExprParser *p) {
+    if(p->depth == EXPR_MAX_DEPTH) {
+        snprintf(p->err, p->err_len, "expression is nested more than %d levels deep", EXPR_MAX_DEPTH);
+        return false;
+    }
+    p->depth++;
+    return true;
+}
+
+// fails the evaluation on a result that does not fit in an int32_t, which the callers report as out of range
+static bool overflowed(ExprParser *p, char op) {
+    snprintf(p->err, p->err_len, "the result of \"%c\" does not fit in 32 bits", op);
+    p->out->overflow = true;
+    return false;
+}
+
+static bool is_ident_start(char c) {
+    return isalpha((unsigned char) c) || c == '_' || c == '.';
+}
+
+static bool is_ident_char(char c) {
+    return isalnum((unsigned char) c) || c == '_' || c == '.';
+}
+
+static bool expr_number(ExprParser *p, int32_t *val) {
+    int base = 10;
+    const char *start = p->s;
+    if(p->s[0] == '0' && (p->s[1] == 'x' || p->s[1] == 'X')) {
+        base = 16;
+        p->s += 2;
+    } else if(p->s[0] == '0' && (p->s[1] == 'b' || p->s[1] == 'B')) {
+        base = 2;
+        p->s += 2;
+    }
+
+    int64_t result = 0;
+    int digits = 0;
+    while(isalnum((unsigned char) *p->s)) {
+        char c = tolower((unsigned char) *p->s);
+        int digit = isdigit((unsigned char) c) ? c - '0' : c - 'a' + 10;
+        if(digit >= base) {
+            snprintf(p->err, p->err_len, "invalid digit '%c' in number", *p->s);
+            return false;
+        }
+        result = result * base + digit;
+        if(result > INT32_MAX) {
+            snprintf(p->err, p->err_len, "number \"%.*s\" is too large", (int) (p->s - start + 1), start);
+            p->out->overflow = true;
+            return false;
+        }
+        digits++;
+        p->s++;
+    }
+
+    if(digits == 0) {
+        snprintf(p->err, p->err_len, "missing digits after \"%.*s\"", (int) (p->s - start), start);
+        return false;
+    }
+
+    *val = (int32_t) result;
+    return true;
+}
+
+static bool expr_char(ExprParser *p, int32_t *val) {
+    p->s++; // skip the opening quote
+    char c = *p->s++;
+    if(c == '\\') {
+        switch(*p->s++) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case '0': c = '\0'; break;
+            case '\\': c = '\\'; break;
+            case '\'': c = '\''; break;
+            default:
+                snprintf(p->err, p->err_len, "unknown escape in character literal");
+                return false;
+        }
+    } else if(c == '\0') {
+        snprintf(p->err, p->err_len, "unterminated character literal");
+        return false;
+    }
+
+    if(*p->s != '\'') {
+        snprintf(p->err, p->err_len, "unterminated character literal");
+        return false;
+    }
+    p->s++;
+
+    *val = (unsigned char) c;
+    return true;
+}
+
+static bool expr_primary(ExprParser *p, bool allow_reg, int32_t *val) {
+    skip_space(p);
+
+    if(*p->s == '(') {
+        p->s++;
+        if(!enter_nested(p) || !expr_or(p, false, val)) return false;
+        skip_space(p);
+        if(*p->s != ')') {
+            snprintf(p->err, p->err_len, "missing closing parenthesis");
+            return false;
+        }
+        p->s++;
+        p->depth--;
+        return true;
+    }
+
+    if(isdigit((unsigned char) *p->s)) return expr_number(p, val);
+    if(*p->s == '\'') return expr_char(p, val);
+
+    if(is_ident_start(*p->s)) {
+        const char *name = p->s;
+        while(is_ident_char(*p->s)) p->s++;
+        size_t len = p->s - name;
+
+        int index = find_symbol(p->syms, name, len);
+        if(index >= 0) {
+            const Symbol *sym = &p->syms->syms[index];
+            p->out->kinds |= 1 << sym->kind;
+            if(p->out->sym_ref < 0) p->out->sym_ref = index;
+            *val = sym->value;
+            return true;
+        }
+
+        // a lone register letter adds the register to an indexed address
+        if(len == 1 && check_regs(name[0])) {
+            if(!allow_reg) {
+                snprintf(p->err, p->err_len, "register %c is not allowed here", name[0]);
+                return false;
+            }
+            if(p->out->reg != 0) {
+                snprintf(p->err, p->err_len, "only one register may be added to an address");
+                return false;
+            }
+            p->out->reg = name[0];
+            *val = 0;
+            return true;
+        }
+
+        p->out->undefined = true;
+        snprintf(p->err, p->err_len, "undefined symbol \"%.*s\"", (int) len, name);
+        return false;
+    }
+
+    if(*p->s == '\0' || *p->s == ']' || *p->s == ',') snprintf(p->err, p->err_len, "missing value");
+    else snprintf(p->err, p->err_len, "unexpected character '%c'", *p->s);
+    return false;
+}
+
+static bool expr_unary(ExprParser *p, bool allow_reg, int32_t *val) {
+    skip_space(p);
+
+    char op = *p->s;
+    if(op == '-' || op == '+' || op == '~') {
+        p->s++;
+        // a register can only ever be added, never negated or inverted
+        if(!enter_nested(p) || !expr_unary(p, op == '+' && allow_reg, val)) return false;
+        if(op == '-' && *val == INT32_MIN) return overflowed(p, op);
+        if(op == '-') *val = -*val;
+        else if(op == '~') *val = ~*val;
+        p->depth--;
+        return true;
+    }
+
+    return expr_primary(p, allow_reg, val);
+}
+
+static bool expr_mul(ExprParser *p, bool allow_reg, int32_t *val) {
+    char reg_before = p->out->reg;
+    if(!expr_unary(p, allow_reg, val)) return false;
+
+    while(true) {
+        skip_space(p);
+        char op = *p->s;
+        if(op != '*' && op != '/' && op != '%') return true;
+
+        if(p->out->reg != reg_before) {
+            snprintf(p->err, p->err_len, "a register cannot be scaled");
+            return false;
+        }
+
+        p->s++;
+        int32_t rhs;
+        if(!expr_unary(p, false, &rhs)) return false;
+
+        if(op == '*') {
+            if(__builtin_mul_overflow(*val, rhs, val)) return overflowed(p, op);
+        } else if(rhs == 0) {
+            snprintf(p->err, p->err_len, "division by zero");
+            return false;
+        } else if(*val == INT32_MIN && rhs == -1) {
+            // the quotient does not fit, and the remainder traps on x86 as well
+            return overflowed(p, op);
+        } else if(op == '/') {
+            *val /= rhs;
+        } else {
+            *val %= rhs;
+        }
+    }
+}
+
+static bool expr_add(ExprParser *p, bool allow_reg, int32_t *val) {
+    if(!expr_mul(p, allow_reg, val)) return false;
+
+    while(true) {
+        skip_space(p);
+        char op = *p->s;
+        if(op != '+' && op != '-') return true;
+
+        p->s++;
+        int32_t rhs;
+        if(!expr_mul(p, op == '+' && allow_reg, &rhs)) return false;
+        if(op == '+' ? __builtin_add_overflow(*val, rhs, val) : __builtin_sub_overflow(*val, rhs, val)) return overflowed(p, op);
+    }
+}
+
+static bool expr_shift(ExprParser *p, bool allow_reg, int32_t *val) {
+    if(!expr_add(p, allow_reg, val)) return false;
+
+    while(true) {
+        skip_space(p);
+        if(!((p->s[0] == '<' && p->s[1] == '<') || (p->s[0] == '>' && p->s[1] == '>'))) return true;
+
+        char op = p->s[0];
+        p->s += 2;
+        int32_t rhs;
+        if(!expr_add(p, false, &rhs)) return false;
+        if(rhs < 0 || rhs > 31) {
+            snprintf(p->err, p->err_len, "shift amount %d is out of range", rhs);
+            return false;
+        }
+        *val = op == '<' ? (int32_t) ((uint32_t) *val << rhs) : *val >> rhs;
+    }
+}
+
+typedef bool (*ExprLevel)(ExprParser *p, bool allow_reg, int32_t *val);
+
+// one level of bitwise operator, evaluated left to right over operands of the next level up, registers may not appear
+// under it
+static bool expr_bitwise(ExprParser *p, bool allow_reg, int32_t *val, char op, ExprLevel operand) {
+    char reg_before = p->out->reg;
+    if(!operand(p, allow_reg, val)) return false;
+
+    while(true) {
+        skip_space(p);
+        if(*p->s != op) return true;
+
+        if(p->out->reg != reg_before) {
+            snprintf(p->err, p->err_len, "a register cannot be combined with \"%c\"", op);
+            return false;
+        }
+
+        p->s++;
+        int32_t rhs;
+        if(!operand(p, false, &rhs)) return false;
+        if(op == '&') *val &= rhs;
+        else if(op == '^') *val ^= rhs;
+        else *val |= rhs;
+    }
+}
+
+// & binds tighter than ^, which binds tighter than |, as in C
+static bool expr_and(ExprParser *p, bool allow_reg, int32_t *val) {
+    return expr_bitwise(p, allow_reg, val, '&', expr_shift);
+}
+
+static bool expr_xor(ExprParser *p, bool allow_reg, int32_t *val) {
+    return expr_bitwise(p, allow_reg, val, '^', expr_and);
+}
+
+static bool expr_or(ExprParser *p, bool allow_reg, int32_t *val) {
+    return expr_bitwise(p, allow_reg, val, '|', expr_xor);
+}
+
+bool eval_expr(const char **s, const SymbolTable *syms, bool allow_reg, ExprValue *out, char *err, size_t err_len) {
+    out->value = 0;
+    out->reg = 0;
+    out->kinds = 0;
+    out->sym_ref = -1;
+    out->undefined = false;
+    out->overflow = false;
+
+    ExprParser p = {*s, syms, out, err, err_len};
+    if(!expr_or(&p, allow_reg, &out->value)) return false;
+
+    skip_space(&p);
+    *s = p.s;
+    return true;
+}
@@ -0,0 +1,134 @@
+#include "fileio.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+bool read_file(const char *path, char **buf, size_t *cap, size_t *len) {
+    FILE *f = fopen(path, "r");
+    if(f == NULL) {
+        printf("Error occured opening file %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long file_len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(file_len < 0) {
+        printf("Error reading file %s: %s\n", path, strerror(errno));
+        fclose(f);
+        return false;
+    }
+
+    if(*buf == NULL || *cap < (size_t) file_len + 1) {
+        char *grown = realloc(*buf, sizeof(char) * (file_len + 1));
+        if(grown == NULL) {
+            printf("Error allocating memory\n");
+            fclose(f);
+            return false;
+        }
+        *buf = grown;
+        *cap = file_len + 1;
+    }
+
+    *len = fread(*buf, sizeof(char), file_len, f);
+    (*buf)[*len] = '\0';
+    fclose(f);
+
+    if(*len != (size_t) file_len) {
+        printf("Error reading file %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+// checks whether the file at path holds exactly data
+static bool file_matches(const char *path, const char *data, size_t len) {
+    FILE *f = fopen(path, "r");
+    if(f == NULL) return false;
+
+    char buff[4096];
+    size_t pos = 0;
+    size_t n;
+    bool same = true;
+    while(same && (n = fread(buff, sizeof(char), sizeof(buff), f)) > 0) {
+        if(pos + n > len || memcmp(buff, data + pos, n) != 0) same = false;
+        pos += n;
+    }
+
+    fclose(f);
+    return same && pos == len;
+}
+
+char *temp_path(const char *path) {
+    // the temporary file sits next to the target so the rename never crosses a file system
+    char *tmp_path = malloc(sizeof(char) * (strlen(path) + 32));
+    if(tmp_path != NULL) sprintf(tmp_path, "%s.tmp%ld", path, (long) getpid());
+    return tmp_path;
+}
+
+int write_file_if_changed(const char *path, const char *data, size_t len) {
+    if(file_matches(path, data, len)) return 0;
+
+    char *tmp_path = temp_path(path);
+    if(tmp_path == NULL) {
+        printf("Error allocating memory\n");
+        return -1;
+    }
+
+    FILE *f = fopen(tmp_path, "w");
+    if(f == NULL) {
+        printf("Error occured opening file %s: %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        return -1;
+    }
+
+    bool ok = fwrite(data, sizeof(char), len, f) == len;
+    ok = (fclose(f) == 0) && ok;
+    if(!ok || rename(tmp_path, path) != 0) {
+        printf("Error writing file %s: %s\n", path, strerror(errno));
+        remove(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+
+    free(tmp_path);
+    return 1;
+}
+
+// checks whether two files hold the same bytes, without reading either one into memory
+static bool files_match(const char *a_path, const char *b_path) {
+    FILE *a = fopen(a_path, "r");
+    if(a == NULL) return false;
+    FILE *b = fopen(b_path, "r");
+    if(b == NULL) {
+        fclose(a);
+        return false;
+    }
+
+    char a_buff[4096], b_buff[4096];
+    size_t n;
+    bool same = true;
+    while(same && (n = fread(a_buff, sizeof(char), sizeof(a_buff), a)) > 0) {
+        same = fread(b_buff, sizeof(char), n, b) == n && memcmp(a_buff, b_buff, n) == 0;
+    }
+    same = same && fgetc(b) == EOF;
+
+    fclose(a);
+    fclose(b);
+    return same;
+}
+
+int replace_file_if_changed(const char *tmp_path, const char *path) {
+    if(files_match(tmp_path, path)) {
+        remove(tmp_path);
+        return 0;
+    }
+
+    if(rename(tmp_path, path) != 0) {
+        printf("Error writing file %s: %s\n", path, strerror(errno));
+        remove(tmp_path);
+        return -1;
+    }
+    return 1;
+}
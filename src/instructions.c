@@ -1,635 +1,239 @@
 #include "instructions.h"
 
-void add_inst_name(ParsedInstruction *inst, char *name) {
-    inst->inst = malloc(sizeof(char) * (strlen(name) + 1));
-    strcpy(inst->inst, name);
-}
-
 bool check_regs(char reg) {
     if(reg < MIN_REG || reg > MAX_REG) return false;
     return true;
 }
 
-bool parse_noop(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "NOOP");
-
-    inst->opcode = 0x0000; // noop is always an all-zero opcode
-
-    // printf("%d: 0x0000\n", line_num);
-
-    return true;
-}
-
-bool parse_inputc(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "INPUTC");
-
-    uint8_t caddress;
-    if(sscanf(line, " %*s %hhu ", &caddress) < 1) {
-        printf("Missing code address for INPUTC instruction on line %d, compilation aborting...\n", line_num);
-        return false;
-    }
-
-    inst->opcode = caddress;
-    inst->opcode |= 0x1000;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
-}
-
-bool parse_inputcf(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "INPUTCF");
-
-    char reg;
-    uint8_t caddress;
-    if(sscanf(line, " %*s %c , %hhu ", &reg, &caddress) < 2) {
-        printf("Missing register or code address for INPUTCF instruction on line %d, compilation aborting...\n", line_num);
-        return false;
-    }
-
-    if(!check_regs(reg)) {
-        printf("Invalid register \"%c\" specified for INPUTCF instruction on line %d, compilation aborting...\n", reg, line_num);
-        return false;
-    }
-
-    inst->opcode = caddress;
-    inst->opcode |= 0x1100;
-    inst->opcode |= (reg - 'A') << 10;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
+// records an error at the position of at within the line being parsed, skipping any whitespace in front of it
+__attribute__((format(printf, 5, 6)))
+static void report(ParseContext *ctx, int code, int line_num, const char *at, const char *fmt, ...) {
+    while(*at == ' ' || *at == '\t') at++;
 
-    return true;
+    va_list ap;
+    va_start(ap, fmt);
+    diag_vreport(ctx->diags, DIAG_ERROR, code, line_num, (int) (at - ctx->line) + 1, fmt, ap);
+    va_end(ap);
 }
 
-bool parse_inputd(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "INPUTD");
-
-    uint8_t daddress;
-    if(sscanf(line, " %*s %hhu ", &daddress) < 1) {
-        printf("Missing data address for INPUTD instruction on line %d, compilation aborting...\n", line_num);
-        return false;
-    }
-
-    inst->opcode = daddress;
-    inst->opcode |= 0x1200;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
+// returns a pointer to the operands following the mnemonic at the start of the line
+static const char *skip_mnemonic(const char *line) {
+    while(*line == ' ' || *line == '\t') line++;
+    while(*line != '\0' && *line != ' ' && *line != '\t') line++;
+    return line;
 }
 
-bool parse_inputdf(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "INPUTDF");
-
-    char reg;
-    uint8_t daddress;
-    if(sscanf(line, " %*s %c , %hhu ", &reg, &daddress) < 2) {
-        printf("Missing register or code address for INPUTDF instruction on line %d, compilation aborting...\n", line_num);
-        return false;
-    }
-
-    if(!check_regs(reg)) {
-        printf("Invalid register \"%c\" specified for INPUTDF instruction on line %d, compilation aborting...\n", reg, line_num);
-        return false;
-    }
-
-    inst->opcode = daddress;
-    inst->opcode |= 0x1300;
-    inst->opcode |= (reg - 'A') << 10;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
+// skips whitespace and consumes c if it is the next character
+static bool match_char(const char **s, char c) {
+    while(**s == ' ' || **s == '\t') (*s)++;
+    if(**s != c) return false;
+    (*s)++;
     return true;
 }
 
-bool parse_move(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "MOVE");
-
-    char reg0, reg1; // characters for each of the registers to be added
-    if(sscanf(line, "%*s %c , %c ", &reg0, &reg1) < 2) {
-        printf("Missing one or more registers for MOVE instruction on line %d, compilation aborting...\n", line_num);
-        return false;
-    }
-
-    if(reg0 > 'D' || reg0 < 'A') {
-        printf("Invalid register 0 \"%c\" specified for MOVE instruction on line %d, compilation aborting...\n", reg0, line_num);
-        return false;
-    }
-    if(reg1 > 'D' || reg1 < 'A') {
-        printf("Invalid register 1 \"%c\" specified for MOVE instruction on line %d, compilation aborting...\n", reg1, line_num);
-        return false;
-    }
-
-    inst->opcode = 0x2000;
-    inst->opcode |= (reg0 - 'A') << 10;
-    inst->opcode |= (reg1 - 'A') << 8;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
+// skips whitespace and reads a single register character
+static bool read_reg(const char **s, char *reg) {
+    while(**s == ' ' || **s == '\t') (*s)++;
+    if(**s == '\0') return false;
+    *reg = *(*s)++;
     return true;
 }
 
-bool parse_loadi(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "LOADI");
-
-    char reg; // character that will store the register to be loaded
-    uint8_t val; // value to be loaded
-    sscanf(line, " %*s %c , %hhu ", &reg, &val);
-
-    if(reg > 'D' || reg < 'A') {
-        printf("Invalid register \"%c\" specified for LOADI instruction on line %d, compilation aborting...\n", reg, line_num);
-        exit(-1);
-    }
-
-    inst->opcode = val; // assign val to opcode, taking up lower 8 bits
-    inst->opcode |= 0x3000; // add the opcode to the upper four bits
-    inst->opcode |= (reg  - 'A') << 10;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;    
-}
-
-bool parse_loadp(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "LOADP");
-
-    char reg; // character that will store the register to be loaded
-    uint8_t val; // value to be loaded
-    sscanf(line, " %*s %c , %hhu ", &reg, &val);
-
-    if(reg > 'D' || reg < 'A') {
-        printf("Invalid register \"%c\" specified for LOADP instruction on line %d, compilation aborting...\n", reg, line_num);
-        return false;
-    }
-
-    inst->opcode = val; // assign val to opcode, taking up lower 8 bits
-    inst->opcode |= 0x3000; // add the opcode to the upper four bits
-    inst->opcode |= (reg  - 'A') << 10;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
-}
-
-bool parse_add(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "ADD");
-
-    char reg0, reg1; // characters for each of the registers to be added
-    sscanf(line, "%*s %c , %c ", &reg0, &reg1);
-
-    if(reg0 > 'D' || reg0 < 'A') {
-        printf("Invalid register 0 \"%c\" specified for ADD instruction on line %d, compilation aborting...\n", reg0, line_num);
-        return false;
-    }
-    if(reg1 > 'D' || reg1 < 'A') {
-        printf("Invalid register 1 \"%c\" specified for ADD instruction on line %d, compilation aborting...\n", reg1, line_num);
-        return false;
-    }
-
-    inst->opcode = 0x4000;
-    inst->opcode |= (reg0 - 'A') << 10;
-    inst->opcode |= (reg1 - 'A') << 8;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
-}
-
-bool parse_addi(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "ADDI");
-
-    char reg; // characters for each of the registers to be added
-    uint8_t val; // immediate value
-    sscanf(line, "%*s %c , %hhu ", &reg, &val);
-
-    if(reg > 'D' || reg < 'A') {
-        printf("Invalid register \"%c\" specified for ADDI instruction on line %d, compilation aborting...\n", reg, line_num);
-        return false;
-    }
-
-    inst->opcode = val;
-    inst->opcode |= 0x5000;
-    inst->opcode |= (reg - 'A') << 10;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
-}
-
-bool parse_sub(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "SUB");
-
-    char reg0, reg1; // characters for each of the registers to be added
-    sscanf(line, "%*s %c , %c ", &reg0, &reg1);
-
-    if(reg0 > 'D' || reg0 < 'A') {
-        printf("Invalid register 0 \"%c\" specified for SUB instruction on line %d, compilation aborting...\n", reg0, line_num);
-        return false;
-    }
-    if(reg1 > 'D' || reg1 < 'A') {
-        printf("Invalid register 1 \"%c\" specified for SUB instruction on line %d, compilation aborting...\n", reg1, line_num);
-        return false;
-    }
-
-    inst->opcode = 0x6000;
-    inst->opcode |= (reg0 - 'A') << 10;
-    inst->opcode |= (reg1 - 'A') << 8;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
-}
-
-bool parse_subi(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "SUBI");
-
-    char reg; // characters for each of the registers to be added
-    uint8_t val; // immediate value
-    sscanf(line, "%*s %c , %hhu ", &reg, &val);
-
-    if(reg > 'D' || reg < 'A') {
-        printf("Invalid register \"%c\" specified for SUBI instruction on line %d, compilation aborting...\n", reg, line_num);
-        return false;
-    }
-
-    inst->opcode = val;
-    inst->opcode |= 0x7000;
-    inst->opcode |= (reg - 'A') << 10;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
-}
-
-bool parse_load(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "LOAD");
-
-    char reg;
-    char sym = -1;
-    uint8_t daddress = 0;
-    uint8_t offset = 0;
-    sscanf(line, " %*s %*c, [ %*u %c", &sym);
-    if(sym == ']') {
-        if(sscanf(line, " %*s %c , [ %hhu ] ", &reg, &daddress) < 2) {
-            printf("Missing register or data address for LOAD instruction on line %d, compilation aborting...\n", line_num);
-            return false;
-        }
-        sym = '+';
-    } else {
-        if(sscanf(line, " %*s %c , [ %hhu %c %hhu ]", &reg, &daddress, &sym, &offset) < 4) {
-            printf("Missing register or data address for LOAD instruction on line %d, compilation aborting...\n", line_num);
-            return false;
-        }
-    }
-
-    if(!check_regs(reg)) {
-        printf("Invalid register \"%c\" specified for LOAD instruction on line %d, compilation aborting...\n", reg, line_num);
-        return false;
-    }
-
-    if(sym == '+') {
-        daddress += offset;
-    } else if(sym == '-') {
-        daddress -= offset;
-    } else {
-        printf("Invalid operation %c specified for LOAD instruction address on line %d, compilation aborting...\n", sym, line_num);
-        return false;
-    }
-
-    inst->opcode = daddress;
-    inst->opcode |= 0x8000;
-    inst->opcode |= (reg - 'A') << 10;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
+// checks that nothing but whitespace follows the operands
+static bool check_end(const char *s, ParseContext *ctx, const char *inst_name, int line_num) {
+    while(*s == ' ' || *s == '\t' || *s == '\r') s++;
+    if(*s == '\0') return true;
 
-    return true;
+    report(ctx, E_TRAILING, line_num, s, "Unexpected \"%s\" after %s instruction", s, inst_name);
+    return false;
 }
 
-bool parse_loadf(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "LOADF");
-
-    char reg0, reg1;
-    char sym0 = -1;
-    char sym1 = -1;
-    uint8_t daddress, offset;
-    if(sscanf(line, " %*s %c , [ %hhu %c %c %c %hhu ] ", &reg0, &daddress, &sym0, &reg1, &sym1, &offset) < 3) { // check for three since it is possible to have a missing offset and still be valid
-        printf("Missing one or more registers or data address for LOADF instruction on line %d, compilation aborting...\n", line_num);
-        return false;
-    }
-
-    if(!check_regs(reg0)) {
-        printf("Invalid register 0 \"%c\" specified for LOADF instruction on line %d, compilation aborting...\n", reg0, line_num);
-        return false;
-    }
-
-    if(!check_regs(reg1)) {
-        printf("Invalid register 1 \"%c\" specified for LOADF instruction on line %d, compilation aborting...\n", reg1, line_num);
-        return false;
-    }
-
-    if(sym0 != '+') {
-        printf("Invalid operation %c specified for LOADF instruction address on line %d, must be \"+\", compilation aborting...\n", sym0, line_num);
+// evaluates an operand expression and checks that it fits into [min, max]
+static bool read_value(const char **s, int line_num, ParseContext *ctx, const char *inst_name, const char *what,
+                       bool allow_reg, int32_t min, int32_t max, ExprValue *val) {
+    const char *start = *s;
+    char err[128];
+    if(!eval_expr(s, ctx->syms, allow_reg, val, err, sizeof(err))) {
+        if(val->undefined) ctx->undefined = true;
+        report(ctx, val->overflow ? E_RANGE : E_BAD_EXPR, line_num, start, "Invalid %s for %s instruction: %s", what, inst_name, err);
         return false;
     }
 
-    if(sym1 == '+') {
-        daddress += offset;
-    } else if(sym1 == '-') {
-        daddress -= offset;
-    } else if(sym1 != ']') { // the trailing bracket will be picked up by the second symbol character if no offset is specified
-        printf("Invalid operation %c specified for LOADF instruction address on line %d, compilation aborting...\n", sym1, line_num);
+    if(val->value < min || val->value > max) {
+        report(ctx, E_RANGE, line_num, start, "The %s %d is out of range [%d, %d] for %s instruction", what, val->value, min, max, inst_name);
         return false;
     }
 
-    inst->opcode = daddress;
-    inst->opcode |= 0x9000;
-    inst->opcode |= (reg0 - 'A') << 10;
-    inst->opcode |= (reg1 - 'A') << 8;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
+    if(ctx->sym_ref < 0) ctx->sym_ref = val->sym_ref;
     return true;
 }
 
-bool parse_store(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "STORE");
-
-    char reg;
-    char sym = -1;
-    uint8_t daddress = 0;
-    uint8_t offset = 0;
-    sscanf(line, "%*s [ %*u %c", &sym);
-    if(sym == ']') {
-        if(sscanf(line, " %*s [ %hhu ], %c ", &daddress, &reg) < 2) {
-            printf("Missing register or data address for STORE instruction on line %d, compilation aborting...\n", line_num);
-            return false;
-        }
-        sym = '+'; // prevents errors later
-    } else {
-        if(sscanf(line, " %*s [ %hhu %c %hhu ], %c ", &daddress, &sym, &offset, &reg) < 4) {
-            printf("Missing register or data address for STORE instruction on line %d, compilation aborting...\n", line_num);
-            return false;
-        }
-    }
+// reads an address operand, which may be written with or without brackets
+// indexed addresses such as [array+B+1] must add exactly one register, which is stored in reg
+static bool read_address(const char **s, int line_num, ParseContext *ctx, const char *inst_name, bool indexed,
+                         int32_t max, uint8_t *address, char *reg) {
+    bool bracketed = match_char(s, '[');
+    const char *start = *s;
 
-    if(!check_regs(reg)) {
-        printf("Invalid register \"%c\" specified for STORE instruction on line %d, compilation aborting...\n", reg, line_num);
-        return false;
-    }
+    ExprValue val;
+    // indexed addresses wrap around at runtime, so the base only has to fit in the address field
+    if(!read_value(s, line_num, ctx, inst_name, "address", indexed, indexed ? IMM_MIN : 0, indexed ? IMM_MAX : max, &val)) return false;
 
-    if(sym == '+') {
-        daddress += offset;
-    } else if(sym == '-') {
-        daddress -= offset;
-    } else {
-        printf("Invalid operation %c specified for STORE instruction address on line %d, compilation aborting...\n", sym, line_num);
+    if(bracketed && !match_char(s, ']')) {
+        report(ctx, E_MISSING_BRACKET, line_num, *s, "Missing closing bracket for %s instruction address", inst_name);
         return false;
     }
 
-    inst->opcode = daddress;
-    inst->opcode |= 0xA000;
-    inst->opcode |= (reg - 'A') << 10;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
-}
-
-bool parse_storef(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "STOREF");
-
-    char reg0, reg1;
-    char sym0 = -1;
-    char sym1 = -1;
-    uint8_t daddress = 0;
-    uint8_t offset = 0;
-
-    // this is really hacky but I'm not sure how to make it any better
-    sscanf(line, " %*s [ %*u %*c %*c %c ", &sym1);
-    if(sym1 == ']') {
-        if(sscanf(line, " %*s [ %hhu %c %c ] , %c ", &daddress, &sym0, &reg1, &reg0) < 3) { // check for three since it is possible to have a missing offset and still be valid
-            printf("Missing one or more registers or data address for STOREF instruction on line %d, compilation aborting...\n", line_num);
-            return false;
-        }
-        sym1 = '+'; // to prevent errors later
-    } else {
-        if(sscanf(line, " %*s [ %hhu %c %c %c %hhu ] , %c ", &daddress, &sym0, &reg1, &sym1, &offset, &reg0) < 3) { // check for three since it is possible to have a missing offset and still be valid
-            printf("Missing one or more registers or data address for STOREF instruction on line %d, compilation aborting...\n", line_num);
+    if(indexed) {
+        if(val.reg == 0) {
+            report(ctx, E_MISSING_INDEX, line_num, start, "Missing index register in %s instruction address", inst_name);
             return false;
         }
+        *reg = val.reg;
     }
 
-    if(!check_regs(reg0)) {
-        printf("Invalid register 0 \"%c\" specified for STOREF instruction on line %d, compilation aborting...\n", reg0, line_num);
-        return false;
-    }
-
-    if(!check_regs(reg1)) {
-        printf("Invalid register 1 \"%c\" specified for STOREF instruction on line %d, compilation aborting...\n", reg1, line_num);
-        return false;
-    }
-
-    if(sym0 != '+') {
-        printf("Invalid operation %c specified for STOREF instruction address on line %d, must be \"+\", compilation aborting...\n", sym0, line_num);
-        return false;
-    }
-
-    if(sym1 == '+') {
-        daddress += offset;
-    } else if(sym1 == '-') {
-        daddress -= offset;
-    } else {
-        printf("Invalid operation %c specified for STOREF instruction address on line %d, compilation aborting...\n", sym1, line_num);
-        return false;
-    }
-
-    inst->opcode = daddress;
-    inst->opcode |= 0xB000;
-    inst->opcode |= (reg0 - 'A') << 10;
-    inst->opcode |= (reg1 - 'A') << 8;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
+    *address = (uint8_t) val.value;
     return true;
 }
 
-bool parse_shiftl(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "SHIFTL");
-
-    char reg; // characters for each of the registers to be added
-    sscanf(line, "%*s %c ", &reg);
-
-    if(reg > 'D' || reg < 'A') {
-        printf("Invalid register \"%c\" specified for SHIFTL instruction on line %d, compilation aborting...\n", reg, line_num);
+// reads the target of a branch, a label is turned into an offset from the next instruction
+// while a plain number is taken as the offset itself
+static bool read_pcoffset(const char **s, int line_num, ParseContext *ctx, const char *inst_name, uint8_t *pcoffset) {
+    const char *start = *s;
+    char err[128];
+    ExprValue val;
+    if(!eval_expr(s, ctx->syms, false, &val, err, sizeof(err))) {
+        if(val.undefined) ctx->undefined = true;
+        report(ctx, val.overflow ? E_RANGE : E_BAD_EXPR, line_num, start, "Invalid label for %s instruction: %s", inst_name, err);
         return false;
     }
 
-    inst->opcode = 0xC000;
-    inst->opcode |= (reg - 'A') << 10;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
+    // worked out in 64 bits, a label plus a large constant would otherwise wrap back into range
+    int64_t offset = val.value;
+    if(val.kinds & (1 << SYM_CODE)) offset = (int64_t) val.value - ctx->pc - 1;
 
-    return true;
-}
-
-bool parse_shiftr(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "SHIFTR");
-
-    char reg; // characters for each of the registers to be added
-    sscanf(line, "%*s %c ", &reg);
-
-    if(reg > 'D' || reg < 'A') {
-        printf("Invalid register \"%c\" specified for SHIFTR instruction on line %d, compilation aborting...\n", reg, line_num);
+    if(offset < PCOFFSET_MIN || offset > PCOFFSET_MAX) {
+        report(ctx, E_RANGE, line_num, start, "Branch offset %lld is out of range [%d, %d] for %s instruction", (long long) offset, PCOFFSET_MIN, PCOFFSET_MAX, inst_name);
         return false;
     }
 
-    inst->opcode = 0xC100;
-    inst->opcode |= (reg - 'A') << 10;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
+    if(ctx->sym_ref < 0) ctx->sym_ref = val.sym_ref;
+    *pcoffset = (uint8_t) offset;
     return true;
 }
 
-bool parse_cmp(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "CMP");
-
-    char reg0, reg1; // characters for each of the registers to be added
-    sscanf(line, "%*s %c , %c ", &reg0, &reg1);
+// what is missing when an instruction's operands cannot be read, for each pattern
+static const char *missing_operands[NUM_PATTERNS] = {
+    [PAT_NONE] = "operands",
+    [PAT_CADDR] = "code address",
+    [PAT_DADDR] = "data address",
+    [PAT_REG_CBASE] = "register or code address",
+    [PAT_REG_DBASE] = "register or data address",
+    [PAT_REG_REG] = "one or more registers",
+    [PAT_REG_IMM] = "register or immediate value",
+    [PAT_REG_PTR] = "register or address",
+    [PAT_REG_MEM] = "register or data address",
+    [PAT_REG_INDEX] = "one or more registers or data address",
+    [PAT_MEM_REG] = "register or data address",
+    [PAT_INDEX_REG] = "one or more registers or data address",
+    [PAT_REG] = "register",
+    [PAT_OFFSET] = "label"
+};
 
-    if(!check_regs(reg0)) {
-        printf("Invalid register 0 \"%c\" specified for CMP instruction on line %d, compilation aborting...\n", reg0, line_num);
+// reads a register operand, optionally preceded by a comma, and checks that it names a real register
+static bool read_reg_operand(const char **s, int line_num, ParseContext *ctx, const InstDesc *desc, const char *operands,
+                             bool comma, const char *which, char *reg) {
+    if((comma && !match_char(s, ',')) || !read_reg(s, reg)) {
+        report(ctx, E_MISSING_OPERAND, line_num, operands, "Missing %s for %s instruction", missing_operands[desc->pattern], desc->mnemonic);
         return false;
     }
-    if(!check_regs(reg1)) {
-        printf("Invalid register 1 \"%c\" specified for CMP instruction on line %d, compilation aborting...\n", reg1, line_num);
-        return false;
-    }
-
-    inst->opcode = 0xD000;
-    inst->opcode |= (reg0 - 'A') << 10;
-    inst->opcode |= (reg1 - 'A') << 8;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
-}
 
-bool parse_jump(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "JUMP");
-
-    uint8_t pcoffset;
-    if(sscanf(line, " %*s %hhu ", &pcoffset) < 1) {
-        printf("Missing label for JUMP instruction on line %d, compilation aborting...\n", line_num);
+    if(!check_regs(*reg)) {
+        report(ctx, E_BAD_REGISTER, line_num, operands, "Invalid %s \"%c\" specified for %s instruction", which, *reg, desc->mnemonic);
         return false;
     }
-
-    inst->opcode = pcoffset;
-    inst->opcode |= 0xE000;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
     return true;
 }
 
-bool parse_bre(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "BRE");
-
-    uint8_t pcoffset;
-    if(sscanf(line, " %*s %hhu ", &pcoffset) < 1) {
-        printf("Missing label for BRE instruction on line %d, compilation aborting...\n", line_num);
-        return false;
-    }
+bool parse_instruction(InstId id, char *line, int line_num, ParseContext *ctx, ParsedInstruction *inst) {
+    const InstDesc *desc = &inst_table[id];
+    const char *name = desc->mnemonic;
+    const char *operands = skip_mnemonic(line);
+    const char *s = operands;
+    bool two_regs = PAT_HAS_REG1(desc->pattern);
+    const char *which = two_regs ? "register 0" : "register";
 
-    inst->opcode = pcoffset;
-    inst->opcode |= 0xF000;
+    // fields an instruction does not use stay zero
+    char rx = 'A', ry = 'A';
+    uint8_t low = 0;
+    ExprValue val;
 
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
+    inst->operand_kinds = pattern_kinds[desc->pattern];
 
-    return true;
-}
+    switch(desc->pattern) {
+        case PAT_NONE:
+            break;
 
-bool parse_brz(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "BRZ");
+        case PAT_CADDR:
+            if(!read_address(&s, line_num, ctx, name, false, CSEG_SIZE - 1, &low, NULL)) return false;
+            break;
 
-    uint8_t pcoffset;
-    if(sscanf(line, " %*s %hhu ", &pcoffset) < 1) {
-        printf("Missing label for BRZ instruction on line %d, compilation aborting...\n", line_num);
-        return false;
-    }
+        case PAT_DADDR:
+            if(!read_address(&s, line_num, ctx, name, false, DSEG_SIZE - 1, &low, NULL)) return false;
+            break;
 
-    inst->opcode = pcoffset;
-    inst->opcode |= 0xF000;
+        case PAT_REG:
+            if(!read_reg_operand(&s, line_num, ctx, desc, operands, false, which, &rx)) return false;
+            break;
 
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
+        case PAT_REG_REG:
+            if(!read_reg_operand(&s, line_num, ctx, desc, operands, false, which, &rx)) return false;
+            if(!read_reg_operand(&s, line_num, ctx, desc, operands, true, "register 1", &ry)) return false;
+            break;
 
-    return true;
-}
+        case PAT_REG_CBASE:
+        case PAT_REG_DBASE:
+        case PAT_REG_IMM:
+        case PAT_REG_PTR:
+            if(!read_reg_operand(&s, line_num, ctx, desc, operands, false, which, &rx)) return false;
+            if(!match_char(&s, ',')) {
+                report(ctx, E_MISSING_OPERAND, line_num, operands, "Missing %s for %s instruction", missing_operands[desc->pattern], name);
+                return false;
+            }
+            // a register added at runtime means the base only has to fit in the address field
+            if(!read_value(&s, line_num, ctx, name, desc->pattern == PAT_REG_IMM ? "immediate value" : "address", false, IMM_MIN, IMM_MAX, &val)) return false;
+            low = (uint8_t) val.value;
+            break;
 
-bool parse_brne(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "BRNE");
-
-    uint8_t pcoffset;
-    if(sscanf(line, " %*s %hhu ", &pcoffset) < 1) {
-        printf("Missing label for BRNE instruction on line %d, compilation aborting...\n", line_num);
-        return false;
+        case PAT_REG_MEM:
+        case PAT_REG_INDEX:
+            if(!read_reg_operand(&s, line_num, ctx, desc, operands, false, which, &rx)) return false;
+            if(!match_char(&s, ',')) {
+                report(ctx, E_MISSING_OPERAND, line_num, operands, "Missing %s for %s instruction", missing_operands[desc->pattern], name);
+                return false;
+            }
+            if(!read_address(&s, line_num, ctx, name, two_regs, DSEG_SIZE - 1, &low, &ry)) return false;
+            break;
+
+        case PAT_MEM_REG:
+        case PAT_INDEX_REG:
+            if(!read_address(&s, line_num, ctx, name, two_regs, DSEG_SIZE - 1, &low, &ry)) return false;
+            if(!read_reg_operand(&s, line_num, ctx, desc, operands, true, which, &rx)) return false;
+            break;
+
+        case PAT_OFFSET:
+            if(!read_pcoffset(&s, line_num, ctx, name, &low)) return false;
+            break;
+
+        default:
+            return false;
     }
 
-    inst->opcode = pcoffset;
-    inst->opcode |= 0xF100;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
-}
-
-bool parse_brnz(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "BRNZ");
-
-    uint8_t pcoffset;
-    if(sscanf(line, " %*s %hhu ", &pcoffset) < 1) {
-        printf("Missing label for BRNZ instruction on line %d, compilation aborting...\n", line_num);
-        return false;
-    }
+    if(!check_end(s, ctx, name, line_num)) return false;
 
-    inst->opcode = pcoffset;
-    inst->opcode |= 0xF100;
+    inst->opcode = isa_encode(id, rx - 'A', ry - 'A', low);
 
     // printf("%d: 0x%04x\n", line_num, inst->opcode);
 
     return true;
 }
-
-bool parse_brg(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "BRG");
-
-    uint8_t pcoffset;
-    if(sscanf(line, " %*s %hhu ", &pcoffset) < 1) {
-        printf("Missing label for BRG instruction on line %d, compilation aborting...\n", line_num);
-        return false;
-    }
-
-    inst->opcode = pcoffset;
-    inst->opcode |= 0xF200;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
-}
-
-bool parse_brge(char *line, int line_num, ParsedInstruction *inst) {
-    add_inst_name(inst, "BRGE");
-
-    uint8_t pcoffset;
-    if(sscanf(line, " %*s %hhu ", &pcoffset) < 1) {
-        printf("Missing label for BRGE instruction on line %d, compilation aborting...\n", line_num);
-        return false;
-    }
-
-    inst->opcode = pcoffset;
-    inst->opcode |= 0xF300;
-
-    // printf("%d: 0x%04x\n", line_num, inst->opcode);
-
-    return true;
-}
\ No newline at end of file
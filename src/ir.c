@@ -0,0 +1,90 @@
+#include "ir.h"
+
+void ir_init(InstIR *ir) {
+    memset(ir, 0, sizeof(InstIR));
+}
+
+void ir_clear(InstIR *ir) {
+    ir->len = 0;
+}
+
+void ir_free(InstIR *ir) {
+    free(ir->opcode);
+    free(ir->line);
+    free(ir->col_start);
+    free(ir->col_end);
+    free(ir->operand_kinds);
+    free(ir->sym_ref);
+    ir_init(ir);
+}
+
+// grows one of the parallel arrays, leaving it untouched if the allocation fails
+static bool grow(void **array, size_t elem_size, size_t cap) {
+    void *grown = realloc(*array, elem_size * cap);
+    if(grown == NULL) return false;
+    *array = grown;
+    return true;
+}
+
+bool ir_push(InstIR *ir, uint16_t opcode, uint32_t line, uint32_t col_start, uint32_t col_end, uint8_t operand_kinds, int32_t sym_ref) {
+    if(ir->len == ir->cap) {
+        size_t cap = ir->cap == 0 ? 64 : ir->cap * 2;
+        if(!grow((void **) &ir->opcode, sizeof(uint16_t), cap)) return false;
+        if(!grow((void **) &ir->line, sizeof(uint32_t), cap)) return false;
+        if(!grow((void **) &ir->col_start, sizeof(uint32_t), cap)) return false;
+        if(!grow((void **) &ir->col_end, sizeof(uint32_t), cap)) return false;
+        if(!grow((void **) &ir->operand_kinds, sizeof(uint8_t), cap)) return false;
+        if(!grow((void **) &ir->sym_ref, sizeof(int32_t), cap)) return false;
+        ir->cap = cap;
+    }
+
+    size_t i = ir->len++;
+    ir->opcode[i] = opcode;
+    ir->line[i] = line;
+    ir->col_start[i] = col_start;
+    ir->col_end[i] = col_end;
+    ir->operand_kinds[i] = operand_kinds;
+    ir->sym_ref[i] = sym_ref;
+    return true;
+}
+
+void ir_remove(InstIR *ir, const bool *keep) {
+    size_t len = 0;
+    for(size_t i = 0; i < ir->len; i++) {
+        if(!keep[i]) continue;
+        ir->opcode[len] = ir->opcode[i];
+        ir->line[len] = ir->line[i];
+        ir->col_start[len] = ir->col_start[i];
+        ir->col_end[len] = ir->col_end[i];
+        ir->operand_kinds[len] = ir->operand_kinds[i];
+        ir->sym_ref[len] = ir->sym_ref[i];
+        len++;
+    }
+    ir->len = len;
+}
+
+void data_init(DataImage *data) {
+    memset(data, 0, sizeof(DataImage));
+}
+
+void data_clear(DataImage *data) {
+    data->len = 0;
+}
+
+void data_free(DataImage *data) {
+    free(data->bytes);
+    data_init(data);
+}
+
+uint8_t *data_extend(DataImage *data, size_t len) {
+    if(data->len + len > data->cap) {
+        size_t cap = data->cap == 0 ? 16 : data->cap;
+        while(cap < data->len + len) cap *= 2;
+        if(!grow((void **) &data->bytes, sizeof(uint8_t), cap)) return NULL;
+        data->cap = cap;
+    }
+
+    uint8_t *start = data->bytes + data->len;
+    data->len += len;
+    return start;
+}
@@ -0,0 +1,81 @@
+#include "isa.h"
+
+#define ISA_DESC(name, opcode, pattern) [INST_##name] = {#name, opcode, pattern},
+
+const InstDesc inst_table[NUM_INSTS] = {
+    [INST_INVALID] = {"???", 0x0000, PAT_NONE},
+    I281_INSTRUCTIONS(ISA_DESC)
+    I281_ALIASES(ISA_DESC)
+};
+
+const uint8_t pattern_kinds[NUM_PATTERNS] = {
+    [PAT_NONE] = 0,
+    [PAT_CADDR] = OPND_CADDR,
+    [PAT_DADDR] = OPND_DADDR,
+    [PAT_REG_CBASE] = OPND_REG0 | OPND_CADDR | OPND_INDEXED,
+    [PAT_REG_DBASE] = OPND_REG0 | OPND_DADDR | OPND_INDEXED,
+    [PAT_REG_REG] = OPND_REG0 | OPND_REG1,
+    [PAT_REG_IMM] = OPND_REG0 | OPND_IMM,
+    [PAT_REG_PTR] = OPND_REG0 | OPND_DADDR,
+    [PAT_REG_MEM] = OPND_REG0 | OPND_DADDR,
+    [PAT_REG_INDEX] = OPND_REG0 | OPND_REG1 | OPND_DADDR | OPND_INDEXED,
+    [PAT_MEM_REG] = OPND_REG0 | OPND_DADDR,
+    [PAT_INDEX_REG] = OPND_REG0 | OPND_REG1 | OPND_DADDR | OPND_INDEXED,
+    [PAT_REG] = OPND_REG0,
+    [PAT_OFFSET] = OPND_PCOFFSET
+};
+
+// an instruction with a register in bits 9-8 fills all four slots of its opcode, the others fill only their own
+#define DECODE_FIRST(opcode) ((((opcode) >> 12) << 2) | (((opcode) >> 8) & 0x3))
+#define DECODE_LAST(opcode, pattern) (DECODE_FIRST(opcode) + (PAT_HAS_REG1(pattern) ? 3 : 0))
+#define ISA_DECODE(name, opcode, pattern) [DECODE_FIRST(opcode) ... DECODE_LAST(opcode, pattern)] = INST_##name,
+
+const uint8_t decode_table[64] = {
+    I281_INSTRUCTIONS(ISA_DECODE)
+};
+
+InstId find_instruction(const char *mnemonic, size_t len) {
+    for(int i = INST_INVALID + 1; i < NUM_INSTS; i++) {
+        if(strncmp(inst_table[i].mnemonic, mnemonic, len) == 0 && inst_table[i].mnemonic[len] == '\0') return i;
+    }
+    return INST_INVALID;
+}
+
+int isa_disassemble(uint16_t word, char *buf, size_t len) {
+    InstId id = isa_decode(word);
+    const char *name = inst_table[id].mnemonic;
+    char rx = 'A' + ((word >> 10) & 0x3);
+    char ry = 'A' + ((word >> 8) & 0x3);
+    uint8_t low = word & 0xFF;
+
+    switch(inst_table[id].pattern) {
+        case PAT_NONE:
+            if(id == INST_INVALID) return snprintf(buf, len, ".word 0x%04X", word);
+            return snprintf(buf, len, "%s", name);
+        case PAT_CADDR:
+        case PAT_DADDR:
+            return snprintf(buf, len, "%s [%d]", name, low);
+        case PAT_REG_CBASE:
+        case PAT_REG_DBASE:
+        case PAT_REG_PTR:
+            return snprintf(buf, len, "%s %c, %d", name, rx, low);
+        case PAT_REG_REG:
+            return snprintf(buf, len, "%s %c, %c", name, rx, ry);
+        case PAT_REG_IMM:
+            return snprintf(buf, len, "%s %c, %d", name, rx, (int8_t) low);
+        case PAT_REG_MEM:
+            return snprintf(buf, len, "%s %c, [%d]", name, rx, low);
+        case PAT_REG_INDEX:
+            return snprintf(buf, len, "%s %c, [%d+%c]", name, rx, low, ry);
+        case PAT_MEM_REG:
+            return snprintf(buf, len, "%s [%d], %c", name, low, rx);
+        case PAT_INDEX_REG:
+            return snprintf(buf, len, "%s [%d+%c], %c", name, low, ry, rx);
+        case PAT_REG:
+            return snprintf(buf, len, "%s %c", name, rx);
+        case PAT_OFFSET:
+            return snprintf(buf, len, "%s %d", name, (int8_t) low);
+        default:
+            return snprintf(buf, len, "%s", name);
+    }
+}
@@ -0,0 +1,366 @@
+#include "layout.h"
+
+#include "isa.h"
+#include "cfg.h"
+#include "scan.h"
+#include "fileio.h"
+#include "instructions.h"
+
+uint32_t code_hash(const uint16_t *code, size_t len) {
+    // FNV-1a over the bytes of every word
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        hash = (hash ^ (code[i] & 0xFF)) * 16777619u;
+        hash = (hash ^ (code[i] >> 8)) * 16777619u;
+    }
+    return hash;
+}
+
+bool profile_init(Profile *profile, const uint16_t *code, size_t len) {
+    profile->len = len;
+    profile->hash = code_hash(code, len);
+    profile->count = calloc(len + 1, sizeof(uint64_t));
+    profile->taken = calloc(len + 1, sizeof(uint64_t));
+    return profile->count != NULL && profile->taken != NULL;
+}
+
+void profile_free(Profile *profile) {
+    free(profile->count);
+    free(profile->taken);
+    profile->count = NULL;
+    profile->taken = NULL;
+    profile->len = 0;
+}
+
+SimStatus sim_run_profiled(SimState *state, const SimInput *input, uint64_t max_steps, Profile *profile) {
+    if(state->status == SIM_HALTED) return SIM_HALTED;
+    state->status = SIM_RUNNING;
+
+    while(state->steps < max_steps) {
+        uint16_t pc = state->pc;
+        if(pc >= state->code_len) return sim_step(state, input);
+
+        bool taken = sim_branch_taken(isa_decode(state->cmem[pc]), state->flags);
+        SimStatus status = sim_step(state, input);
+        if(status == SIM_NO_INPUT) return status;
+
+        // code written by INPUTC past the end of the program is not part of the profile
+        if(pc < profile->len) {
+            profile->count[pc]++;
+            if(taken) profile->taken[pc]++;
+        }
+        if(status != SIM_RUNNING) return status;
+    }
+    return SIM_RUNNING;
+}
+
+bool profile_save(const Profile *profile, const char *path) {
+    char *out_data;
+    size_t out_len;
+    FILE *out_file = open_memstream(&out_data, &out_len);
+    if(out_file == NULL) return false;
+
+    fprintf(out_file, "; i281 execution profile, address, times run, times the branch was taken\n");
+    fprintf(out_file, "code %zu 0x%08x\n", profile->len, profile->hash);
+    for(size_t i = 0; i < profile->len; i++) {
+        fprintf(out_file, "%zu %llu %llu\n", i, (unsigned long long) profile->count[i], (unsigned long long) profile->taken[i]);
+    }
+    fclose(out_file);
+
+    bool ok = write_file_if_changed(path, out_data, out_len) >= 0;
+    free(out_data);
+    return ok;
+}
+
+bool profile_load(Profile *profile, const char *path) {
+    char *buf = NULL;
+    size_t cap = 0, len;
+    if(!read_file(path, &buf, &cap, &len)) {
+        free(buf);
+        return false;
+    }
+
+    memset(profile, 0, sizeof(Profile));
+    bool header = false, ok = true;
+    int line_num = 0;
+    for(char *line = buf; ok && line != NULL; ) {
+        char *next = strchr(line, '\n');
+        if(next != NULL) *next++ = '\0';
+        line_num++;
+        line[strcspn(line, ";")] = '\0';
+
+        size_t pc;
+        unsigned long long count, taken;
+        unsigned hash;
+        if(is_blank(line)) {
+            // nothing on this line
+        } else if(!header) {
+            ok = sscanf(line, " code %zu %x", &pc, &hash) == 2;
+            if(ok) {
+                header = true;
+                profile->len = pc;
+                profile->hash = hash;
+                profile->count = calloc(pc + 1, sizeof(uint64_t));
+                profile->taken = calloc(pc + 1, sizeof(uint64_t));
+                ok = profile->count != NULL && profile->taken != NULL;
+            }
+        } else if(sscanf(line, "%zu %llu %llu", &pc, &count, &taken) == 3 && pc < profile->len && taken <= count) {
+            profile->count[pc] = count;
+            profile->taken[pc] = taken;
+        } else {
+            ok = false;
+        }
+        line = next;
+    }
+
+    if(!ok || !header) {
+        printf("%s:%d: invalid profile line\n", path, line_num);
+        profile_free(profile);
+        ok = false;
+    }
+    free(buf);
+    return ok;
+}
+
+// block numbers for edges that leave a block some other way
+#define EXIT -1 // the program ends
+#define NO_EDGE -2
+
+typedef struct {
+    int start; // first instruction
+    int end; // one past the last instruction
+    int taken; // where the branch or JUMP at the end goes
+    int fall; // where the block falls through to, NO_EDGE after a JUMP
+    uint64_t weight_taken;
+    uint64_t weight_fall;
+} Block;
+
+typedef struct {
+    int from;
+    int to;
+    uint64_t weight;
+    bool fall;
+} Edge;
+
+// heaviest edges first, with fall-through edges ahead of taken ones so cold code keeps its original order
+static int compare_edges(const void *a, const void *b) {
+    const Edge *x = a, *y = b;
+    if(x->weight != y->weight) return x->weight < y->weight ? 1 : -1;
+    if(x->fall != y->fall) return x->fall ? -1 : 1;
+    return x->from - y->from;
+}
+
+// the inverse of each conditional branch, when its CMP's operands are swapped if swap is set
+static InstId invert_branch(InstId id, bool *swap) {
+    *swap = id == INST_BRG || id == INST_BRGE;
+    switch(id) {
+        case INST_BRE: return INST_BRNE;
+        case INST_BRNE: return INST_BRE;
+        case INST_BRG: return INST_BRGE; // !(a > b) is b >= a
+        case INST_BRGE: return INST_BRG; // !(a >= b) is b > a
+        default: return INST_INVALID;
+    }
+}
+
+// everything the layout pass allocates, freed together
+typedef struct {
+    int *target;
+    bool *leader;
+    int *block_of;
+    Block *blocks;
+    Edge *edges;
+    int *chain_next;
+    int *chain_prev;
+    int *order;
+    int *block_addr;
+    int *out_target; // block each emitted branch goes to, EXIT or NO_EDGE
+} Layout;
+
+static void free_layout(Layout *l) {
+    free(l->target);
+    free(l->leader);
+    free(l->block_of);
+    free(l->blocks);
+    free(l->edges);
+    free(l->chain_next);
+    free(l->chain_prev);
+    free(l->order);
+    free(l->block_addr);
+    free(l->out_target);
+}
+
+static int chain_head(const Layout *l, int b) {
+    while(l->chain_prev[b] >= 0) b = l->chain_prev[b];
+    return b;
+}
+
+// appends an instruction to out, copying the source position of instruction src
+static bool emit(InstIR *out, const InstIR *ir, int src, uint16_t opcode, int target, Layout *l) {
+    l->out_target[out->len] = target;
+    return ir_push(out, opcode, ir->line[src], ir->col_start[src], ir->col_end[src],
+                   target == NO_EDGE ? ir->operand_kinds[src] : OPND_PCOFFSET, target == NO_EDGE ? ir->sym_ref[src] : -1);
+}
+
+bool layout_blocks(InstIR *ir, const SymbolTable *syms, const Profile *profile, LayoutStats *stats) {
+    memset(stats, 0, sizeof(LayoutStats));
+    int len = ir->len;
+    if(len == 0) return true;
+
+    Layout l = {0};
+    l.target = malloc(sizeof(int) * len);
+    l.leader = calloc(len + 1, sizeof(bool));
+    l.block_of = malloc(sizeof(int) * (len + 1));
+    l.blocks = malloc(sizeof(Block) * len);
+    l.edges = malloc(sizeof(Edge) * 2 * len);
+    l.chain_next = malloc(sizeof(int) * len);
+    l.chain_prev = malloc(sizeof(int) * len);
+    l.order = malloc(sizeof(int) * len);
+    l.block_addr = malloc(sizeof(int) * len);
+    // every block can gain at most one JUMP
+    l.out_target = malloc(sizeof(int) * 2 * len);
+    if(l.target == NULL || l.leader == NULL || l.block_of == NULL || l.blocks == NULL || l.edges == NULL || l.chain_next == NULL ||
+       l.chain_prev == NULL || l.order == NULL || l.block_addr == NULL || l.out_target == NULL) {
+        free_layout(&l);
+        return false;
+    }
+
+    if(!cfg_find_targets(ir, syms, l.target)) {
+        stats->skipped = true;
+        free_layout(&l);
+        return true;
+    }
+
+    // a block starts at the entry, at every branch target and after every branch
+    bool *leader = l.leader;
+    leader[0] = true;
+    for(int i = 0; i < len; i++) {
+        if(l.target[i] < 0) continue;
+        leader[l.target[i]] = true;
+        leader[i + 1] = true;
+    }
+
+    int num_blocks = 0;
+    for(int i = 0; i < len; i++) {
+        if(leader[i]) {
+            if(num_blocks > 0) l.blocks[num_blocks - 1].end = i;
+            l.blocks[num_blocks++].start = i;
+        }
+    }
+    l.blocks[num_blocks - 1].end = len;
+    for(int b = 0; b < num_blocks; b++) {
+        for(int i = l.blocks[b].start; i < l.blocks[b].end; i++) l.block_of[i] = b;
+    }
+    l.block_of[len] = EXIT;
+    stats->blocks = num_blocks;
+
+    // the edges out of each block and how often the profile took them
+    int num_edges = 0;
+    for(int b = 0; b < num_blocks; b++) {
+        Block *blk = &l.blocks[b];
+        int last = blk->end - 1;
+        InstId id = isa_decode(ir->opcode[last]);
+
+        blk->taken = l.target[last] >= 0 ? l.block_of[l.target[last]] : NO_EDGE;
+        blk->fall = id == INST_JUMP ? NO_EDGE : l.block_of[blk->end];
+        blk->weight_taken = blk->taken != NO_EDGE ? profile->taken[last] : 0;
+        blk->weight_fall = blk->fall != NO_EDGE ? profile->count[last] - blk->weight_taken : 0;
+
+        if(blk->taken >= 0 && blk->taken != b) l.edges[num_edges++] = (Edge) {b, blk->taken, blk->weight_taken, false};
+        if(blk->fall >= 0 && blk->fall != b) l.edges[num_edges++] = (Edge) {b, blk->fall, blk->weight_fall, true};
+    }
+    qsort(l.edges, num_edges, sizeof(Edge), compare_edges);
+
+    // greedily join blocks into chains along the heaviest edges, the entry block always starts its chain
+    for(int b = 0; b < num_blocks; b++) l.chain_next[b] = l.chain_prev[b] = -1;
+    for(int e = 0; e < num_edges; e++) {
+        const Edge *edge = &l.edges[e];
+        if(edge->weight == 0 && !edge->fall) continue;
+        if(l.chain_next[edge->from] >= 0 || l.chain_prev[edge->to] >= 0 || edge->to == 0) continue;
+        if(chain_head(&l, edge->from) == edge->to) continue;
+        l.chain_next[edge->from] = edge->to;
+        l.chain_prev[edge->to] = edge->from;
+    }
+
+    // the entry chain goes first, the rest keep the order of their first block
+    int num_placed = 0;
+    for(int head = 0; head < num_blocks; head++) {
+        if(l.chain_prev[head] >= 0) continue;
+        for(int b = head; b >= 0; b = l.chain_next[b]) {
+            l.order[num_placed++] = b;
+        }
+    }
+    for(int k = 0; k < num_blocks; k++) {
+        if(l.order[k] != k) stats->moved++;
+    }
+
+    InstIR out;
+    ir_init(&out);
+    bool ok = true;
+    for(int k = 0; ok && k < num_blocks; k++) {
+        int b = l.order[k];
+        const Block *blk = &l.blocks[b];
+        int next = k + 1 < num_blocks ? l.order[k + 1] : EXIT;
+        int last = blk->end - 1;
+        InstId id = isa_decode(ir->opcode[last]);
+        bool branch = l.target[last] >= 0;
+        l.block_addr[b] = out.len;
+
+        // decide what happens to the branch at the end before copying, since inverting it may change the CMP
+        bool invert = false, swap = false;
+        InstId inverted = INST_INVALID;
+        if(branch && id != INST_JUMP && blk->fall != next && blk->taken == next) {
+            inverted = invert_branch(id, &swap);
+            int cmp = last - 1;
+            invert = !swap || (cmp >= blk->start && isa_decode(ir->opcode[cmp]) == INST_CMP &&
+                               cfg_flags_dead(ir, l.target, l.target[last]) && cfg_flags_dead(ir, l.target, blk->end));
+        }
+
+        for(int i = blk->start; ok && i < (branch ? last : blk->end); i++) {
+            uint16_t op = ir->opcode[i];
+            if(invert && swap && i == last - 1) op = (op & 0xF0FF) | ((op >> 8) & 0x3) << 10 | ((op >> 10) & 0x3) << 8;
+            ok = emit(&out, ir, i, op, NO_EDGE, &l);
+        }
+        if(!ok) break;
+
+        if(id == INST_JUMP) {
+            if(blk->taken != next) ok = emit(&out, ir, last, ir->opcode[last] & 0xFF00, blk->taken, &l);
+            else stats->jumps_removed++;
+        } else if(branch) {
+            if(invert) {
+                stats->inverted++;
+                ok = emit(&out, ir, last, inst_table[inverted].opcode, blk->fall, &l);
+            } else {
+                ok = emit(&out, ir, last, ir->opcode[last] & 0xFF00, blk->taken, &l);
+                if(ok && blk->fall != next) {
+                    stats->jumps_added++;
+                    ok = emit(&out, ir, last, inst_table[INST_JUMP].opcode, blk->fall, &l);
+                }
+            }
+        } else if(blk->fall != next) {
+            stats->jumps_added++;
+            ok = emit(&out, ir, last, inst_table[INST_JUMP].opcode, blk->fall, &l);
+        }
+    }
+
+    // resolve the offsets now that every block has its address, giving up if one no longer fits
+    for(size_t i = 0; ok && i < out.len; i++) {
+        if(l.out_target[i] == NO_EDGE) continue;
+        int addr = l.out_target[i] == EXIT ? (int) out.len : l.block_addr[l.out_target[i]];
+        int offset = addr - (int) i - 1;
+        if(offset < PCOFFSET_MIN || offset > PCOFFSET_MAX) {
+            stats->skipped = true;
+            break;
+        }
+        out.opcode[i] = (out.opcode[i] & 0xFF00) | (uint8_t) offset;
+    }
+
+    if(ok && !stats->skipped) {
+        ir_free(ir);
+        *ir = out;
+    } else {
+        ir_free(&out);
+    }
+
+    free_layout(&l);
+    return ok;
+}
@@ -0,0 +1,306 @@
+#include "lockstep.h"
+
+#include "ir.h"
+
+// lane i of each of these belongs to instance i
+typedef uint8_t Lanes __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef uint16_t LanePcs __attribute__((vector_size(2 * LOCKSTEP_LANES)));
+typedef uint64_t LaneSteps __attribute__((vector_size(8 * LOCKSTEP_LANES)));
+
+typedef struct {
+    Lanes regs[4]; // A-D
+    Lanes flags;
+    Lanes dmem[TARGET_DSEG_MAX]; // dmem[a] holds address a of every instance
+    LanePcs pc;
+    LanePcs running; // all ones for the lanes that have not stopped or been handed to the scalar simulator
+    LaneSteps steps;
+    uint64_t most; // no running lane has executed more instructions than this
+    uint8_t status[LOCKSTEP_LANES];
+    uint32_t input_pos[LOCKSTEP_LANES];
+    bool scalar[LOCKSTEP_LANES]; // finished by the scalar simulator, which left the result in out already
+} Lockstep;
+
+static inline Lanes splat(uint8_t value) {
+    return (Lanes) {0} + value;
+}
+
+// takes a where the mask is set and b everywhere else
+static inline Lanes pick(Lanes mask, Lanes a, Lanes b) {
+    return (a & mask) | (b & ~mask);
+}
+
+// the lane version of add_flags in sim.c, b has already been inverted for a subtraction
+static inline Lanes add_lanes(Lanes a, Lanes b, int carry_in, Lanes *flags) {
+    Lanes result = a + b + (uint8_t) carry_in;
+
+    // there was a carry out if the sum wrapped round to below a, or to a itself when a carry came in
+    Lanes carry = carry_in ? (Lanes) (result <= a) : (Lanes) (result < a);
+    Lanes overflow = ((a ^ result) & (b ^ result)) >> 7;
+    *flags = (carry & FLAG_C) | ((result >> 7) * FLAG_N) | (overflow * FLAG_O) | ((Lanes) (result == 0) & FLAG_Z);
+    return result;
+}
+
+static inline Lanes shift_lanes(Lanes a, bool left, Lanes *flags) {
+    // SHIFTR is arithmetic, so the sign is kept
+    Lanes result = left ? a << 1 : (a >> 1) | (a & 0x80);
+
+    Lanes carry = left ? a >> 7 : a & 0x01;
+    Lanes overflow = left ? (a ^ result) >> 7 : splat(0);
+    *flags = (carry * FLAG_C) | ((result >> 7) * FLAG_N) | (overflow * FLAG_O) | ((Lanes) (result == 0) & FLAG_Z);
+    return result;
+}
+
+// runs one instruction on the lanes in mask, returns false without running it if it is a branch or reads input,
+// which is where the instances can go their own way
+static bool step_lanes(Lockstep *ls, uint16_t inst, Lanes mask) {
+    Lanes *rx = &ls->regs[(inst >> 10) & 0x3];
+    Lanes *ry = &ls->regs[(inst >> 8) & 0x3];
+    uint8_t low = inst & 0xFF;
+    Lanes flags, value;
+
+    switch(isa_decode(inst)) {
+        case INST_MOVE:
+            *rx = pick(mask, *ry, *rx);
+            break;
+
+        case INST_LOADI:
+            *rx = pick(mask, splat(low), *rx);
+            break;
+
+        case INST_ADD:
+            *rx = pick(mask, add_lanes(*rx, *ry, 0, &flags), *rx);
+            ls->flags = pick(mask, flags, ls->flags);
+            break;
+
+        case INST_ADDI:
+            *rx = pick(mask, add_lanes(*rx, splat(low), 0, &flags), *rx);
+            ls->flags = pick(mask, flags, ls->flags);
+            break;
+
+        case INST_SUB:
+            *rx = pick(mask, add_lanes(*rx, ~*ry, 1, &flags), *rx);
+            ls->flags = pick(mask, flags, ls->flags);
+            break;
+
+        case INST_SUBI:
+            *rx = pick(mask, add_lanes(*rx, splat(~low), 1, &flags), *rx);
+            ls->flags = pick(mask, flags, ls->flags);
+            break;
+
+        case INST_LOAD:
+            *rx = pick(mask, ls->dmem[low & DSEG_MASK], *rx);
+            break;
+
+        // every instance can have a different index, so these go lane by lane
+        case INST_LOADF:
+            value = *rx;
+            for(int i = 0; i < LOCKSTEP_LANES; i++) {
+                if(mask[i]) value[i] = ls->dmem[(uint8_t) ((*ry)[i] + low) & DSEG_MASK][i];
+            }
+            *rx = value;
+            break;
+
+        case INST_STORE:
+            ls->dmem[low & DSEG_MASK] = pick(mask, *rx, ls->dmem[low & DSEG_MASK]);
+            break;
+
+        case INST_STOREF: // the index register is in bits 9-8 and the source in bits 11-10
+            for(int i = 0; i < LOCKSTEP_LANES; i++) {
+                if(mask[i]) ls->dmem[(uint8_t) ((*ry)[i] + low) & DSEG_MASK][i] = (*rx)[i];
+            }
+            break;
+
+        case INST_SHIFTL:
+            *rx = pick(mask, shift_lanes(*rx, true, &flags), *rx);
+            ls->flags = pick(mask, flags, ls->flags);
+            break;
+
+        case INST_SHIFTR:
+            *rx = pick(mask, shift_lanes(*rx, false, &flags), *rx);
+            ls->flags = pick(mask, flags, ls->flags);
+            break;
+
+        case INST_CMP:
+            add_lanes(*rx, ~*ry, 1, &flags);
+            ls->flags = pick(mask, flags, ls->flags);
+            break;
+
+        case INST_INPUTC:
+        case INST_INPUTCF:
+        case INST_INPUTD:
+        case INST_INPUTDF:
+        case INST_JUMP:
+        case INST_BRE:
+        case INST_BRNE:
+        case INST_BRG:
+        case INST_BRGE:
+            return false;
+
+        default: // NOOP, and encodings that are not instructions do nothing
+            break;
+    }
+    return true;
+}
+
+// the lane version of sim_branch_taken, all ones in the lanes that take the branch
+static inline Lanes taken_lanes(InstId id, Lanes flags) {
+    Lanes z = (Lanes) ((flags & FLAG_Z) != 0);
+    Lanes ge = ~((Lanes) ((flags & FLAG_N) != 0) ^ (Lanes) ((flags & FLAG_O) != 0));
+    switch(id) {
+        case INST_JUMP: return splat(0xFF);
+        case INST_BRE: return z;
+        case INST_BRNE: return ~z;
+        case INST_BRG: return ge & ~z;
+        case INST_BRGE: return ge;
+        default: return splat(0);
+    }
+}
+
+// lowest PC in pcs, 0xFFFF if every lane is masked out
+static inline uint16_t lowest_pc(const LanePcs *pcs) {
+    uint16_t low = 0xFFFF;
+    for(int i = 0; i < LOCKSTEP_LANES; i++) {
+        if((*pcs)[i] < low) low = (*pcs)[i];
+    }
+    return low;
+}
+
+// stops the lanes that have used up their steps, and brings the bound on the step count back down to the real one
+static void check_steps(Lockstep *ls, uint64_t max_steps) {
+    ls->most = 0;
+    for(int i = 0; i < LOCKSTEP_LANES; i++) {
+        if(!ls->running[i]) continue;
+        if(ls->steps[i] >= max_steps) ls->running[i] = 0;
+        else if(ls->steps[i] > ls->most) ls->most = ls->steps[i];
+    }
+}
+
+// ends the program for the lanes in group whose PC ran off the end
+static void halt_lanes(Lockstep *ls, const LanePcs *group, uint16_t code_len) {
+    for(int i = 0; i < LOCKSTEP_LANES; i++) {
+        if(!(*group)[i] || ls->pc[i] != code_len) continue;
+        ls->status[i] = SIM_HALTED;
+        ls->running[i] = 0;
+    }
+}
+
+// copies lane i out into a scalar state, whose code memory was filled in by sim_reset
+static void store_lane(const Lockstep *ls, int i, SimState *state) {
+    state->pc = ls->pc[i];
+    for(int r = 0; r < 4; r++) state->regs[r] = ls->regs[r][i];
+    state->flags = ls->flags[i];
+    state->status = ls->status[i];
+    state->input_pos = ls->input_pos[i];
+    state->steps = ls->steps[i];
+    for(int a = 0; a < DSEG_SIZE; a++) state->dmem[a] = ls->dmem[a][i];
+}
+
+// runs the input instruction at the PC of lane i, the values and what is left of them differ from lane to lane
+static void input_lane(Lockstep *ls, int i, uint16_t inst, uint16_t code_len, const SimInput *input, uint64_t max_steps, SimState *out) {
+    InstId id = isa_decode(inst);
+    if(id == INST_INPUTC || id == INST_INPUTCF) {
+        // from here on the instance runs code of its own
+        store_lane(ls, i, out);
+        sim_run(out, input, max_steps);
+        ls->running[i] = 0;
+        ls->scalar[i] = true;
+        return;
+    }
+
+    // out keeps the reads of each input instruction, which nothing else in the lane state needs
+    uint16_t val;
+    if(!sim_next_input(input, ls->pc[i], &ls->input_pos[i], out->pc_reads, &val)) {
+        ls->status[i] = SIM_NO_INPUT;
+        ls->running[i] = 0;
+        return;
+    }
+    uint8_t addr = (inst & 0xFF) + ((inst & 0x0100) ? ls->regs[(inst >> 10) & 0x3][i] : 0);
+    ls->dmem[addr & DSEG_MASK][i] = (uint8_t) val;
+
+    ls->steps[i]++;
+    if(ls->pc[i] + 1 >= code_len) {
+        ls->pc[i] = code_len;
+        ls->status[i] = SIM_HALTED;
+        ls->running[i] = 0;
+    } else {
+        ls->pc[i]++;
+        if(ls->steps[i] >= max_steps) ls->running[i] = 0;
+    }
+}
+
+bool lockstep_run(const uint16_t *code, size_t code_len, const uint8_t *data, size_t data_len, const SimInput *inputs,
+                  int count, uint64_t max_steps, SimState *out) {
+    if(count < 0 || count > LOCKSTEP_LANES) return false;
+
+    Lockstep ls;
+    memset(&ls, 0, sizeof(Lockstep));
+    for(int i = 0; i < count; i++) {
+        if(!sim_reset(&out[i], code, code_len, data, data_len)) return false;
+        ls.status[i] = out[i].status;
+        ls.running[i] = ls.status[i] == SIM_HALTED || max_steps == 0 ? 0 : 0xFFFF;
+    }
+    for(size_t a = 0; a < data_len; a++) ls.dmem[a] = splat(data[a]);
+
+    while(true) {
+        // the group is every lane at the lowest PC, and next is the closest PC a lane is waiting at after it
+        LanePcs key = ls.pc | ~ls.running;
+        uint16_t pc = lowest_pc(&key);
+        if(pc == 0xFFFF) break;
+        LanePcs group = (LanePcs) (key == pc);
+        key |= group;
+        uint16_t next = lowest_pc(&key);
+        Lanes mask = __builtin_convertvector(group, Lanes);
+
+        // no lane can run past its step budget in straight-line code if none of them could before
+        if(ls.most >= max_steps) check_steps(&ls, max_steps);
+        uint64_t budget = max_steps - ls.most;
+
+        // straight-line code runs for the whole group at once, up to where the waiting lanes can join in
+        int p = pc;
+        uint64_t run = 0;
+        bool branch = false;
+        while(run < budget && p < (int) code_len && p != next) {
+            if(!step_lanes(&ls, code[p], mask)) {
+                branch = true;
+                break;
+            }
+            p++;
+            run++;
+        }
+
+        LaneSteps one = __builtin_convertvector(group >> 15, LaneSteps);
+        ls.steps += one * run;
+        ls.most += run;
+        ls.pc = (ls.pc & ~group) | (group & (uint16_t) (p < (int) code_len ? p : code_len));
+
+        if(p >= (int) code_len) {
+            halt_lanes(&ls, &group, code_len);
+        } else if(branch) {
+            uint16_t inst = code[p];
+            InstId id = isa_decode(inst);
+            if(inst_table[id].pattern != PAT_OFFSET) {
+                for(int i = 0; i < count; i++) {
+                    if(group[i]) input_lane(&ls, i, inst, code_len, inputs != NULL ? &inputs[i] : NULL, max_steps, &out[i]);
+                }
+                ls.most++;
+            } else {
+                // a branch out of the program ends it, the same as running off the end
+                int target = p + 1 + (int8_t) (inst & 0xFF);
+                uint16_t taken = target < 0 || target >= (int) code_len ? code_len : target;
+                uint16_t fall = p + 1 < (int) code_len ? p + 1 : code_len;
+                LanePcs take = (LanePcs) (__builtin_convertvector(taken_lanes(id, ls.flags), LanePcs) != 0);
+
+                ls.pc = (ls.pc & ~group) | (group & ((take & taken) | (~take & fall)));
+                ls.steps += one;
+                ls.most++;
+                if(taken == code_len || fall == code_len) halt_lanes(&ls, &group, code_len);
+            }
+        }
+        if(ls.most >= max_steps) check_steps(&ls, max_steps);
+    }
+
+    for(int i = 0; i < count; i++) {
+        if(!ls.scalar[i]) store_lane(&ls, i, &out[i]);
+    }
+    return true;
+}
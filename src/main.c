@@ -4,488 +4,872 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include "instructions.h"
-
-#define DSEG_SIZE 16
-#define CSEG_SIZE 64
+#include "scan.h"
+#include "fileio.h"
+#include "watch.h"
+#include "data.h"
+#include "output.h"
+#include "sim.h"
+#include "batch.h"
+#include "cfg.h"
+#include "trace.h"
+#include "layout.h"
+#include "wcet.h"
+#include "pipeline.h"
+#include "superopt.h"
+#include "aot.h"
+#include "server.h"
 
 const char *segments[] = {".data", ".code"};
 
 #define NUM_SEGMENTS 2
 
-const char *instructions[] = {"NOOP", "INPUTC", "INPUTCF", "INPUTD", "INPUTDF", "MOVE", "LOADI", "LOADP", "ADD", "ADDI", "SUB", "SUBI",
-                                "LOAD", "LOADF", "STORE", "STOREF", "SHIFTL", "SHIFTR", "CMP", "JUMP", "BRE", "BRZ", "BRNE", "BRNZ",
-                                "BRG", "BRGE"};
-
-#define NOOP 0x00
-#define INPUTC 0x01
-#define INPUTCF 0x02
-#define INPUTD 0x03
-#define INPUTDF 0x04
-#define MOVE 0x05
-#define LOADI 0x06
-#define LOADP 0x07
-#define ADD 0x08
-#define ADDI 0x09
-#define SUB 0x0A
-#define SUBI 0x0B
-#define LOAD 0x0C
-#define LOADF 0x0D
-#define STORE 0x0E
-#define STOREF 0x0F
-#define SHIFTL 0x10
-#define SHIFTR 0x11
-#define CMP 0x12
-#define JUMP 0x13
-#define BRE 0x14
-#define BRZ 0x15
-#define BRNE 0x16
-#define BRNZ 0x17
-#define BRG 0x18
-#define BRGE 0x19
-
-#define NUM_INSTRUCTIONS 26
-
-typedef struct {
-    uint8_t len;
-    uint8_t *data;
-    char *name;
-    uint8_t start_address;
-} DataLabel;
-
-typedef struct {
-    char *name;
-    uint8_t address;
-} BranchDest;
+// the source file plus the target, the layout profile and the rewrite database
+#define MAX_INPUTS 4
 
-int parse_dseg(char **lines, int offset, int lines_len, DataLabel *labels, int labels_len) {
+// encodes the code segment into the instruction IR, returns the number of instructions or -1 if memory ran out
+// a line with an error is reported to diags and replaced by a NOOP, so the addresses of later instructions stay put
+int parse_cseg(char **lines, int offset, int lines_len, const SymbolTable *syms, InstIR *ir, DiagList *diags) {
     offset++; // skip the segment declaration
 
-    int labels_index = 0; // index in the labels array
-    uint8_t dseg_address = 0; // the current address in the data segment, this always counts up so that the assembler knows where labels are
-    for(int i = offset; i < lines_len; i++) {
-        // check if we reached a code segment
-        if(strncmp(lines[i], segments[1], strlen(segments[1])) == 0) return labels_index;
-
-        // variables to store name and type of data
-        char name[32];
-        char type[32];
-        char value[32];
-
-        int fields_parsed = sscanf(lines[i], " %s %s %s", name, type, value);
-
-        // get the whole string for the value
-        char *val_start = strstr(lines[i], value);
+    ParseContext ctx;
+    ctx.syms = syms;
+    ctx.diags = diags;
 
-        if(fields_parsed == 3) {
-            DataLabel label;
-            label.data = calloc(16, sizeof(uint8_t));
-            label.len = 16;
-            label.name = malloc(sizeof(char) * (strlen(name) + 1));
-            strcpy(label.name, name);
+    int instructions_index = 0;
+    for(int i = offset; i < lines_len; i++) {
+        // the mnemonic runs up to the first whitespace
+        const char *mnemonic = lines[i] + strspn(lines[i], " \t\r");
+        size_t mnemonic_len = strcspn(mnemonic, " \t\r");
 
-            int tokens_parsed = 0;
+        if(mnemonic_len == 0) continue; // skip blank lines
 
-            char *tok = strtok(val_start, ",");
-            while(tok != NULL) {
-                sscanf(tok, " %hhu ", &(label.data[tokens_parsed++]));
-                tok = strtok(NULL, ",");
-            }
+        ParsedInstruction inst;
+        ctx.pc = instructions_index;
+        ctx.sym_ref = -1;
+        ctx.line = lines[i];
+        ctx.undefined = false;
 
-            label.data = realloc(label.data, sizeof(uint8_t) * tokens_parsed);
-            label.len = tokens_parsed;
-            label.start_address = dseg_address;
-            
-            dseg_address += tokens_parsed;
-            // check if we have exceeded the maximum number of bytes that can be stored in the data segment
-            if(dseg_address >= DSEG_SIZE) {
-                printf("Error during assembly, too many bytes in data segment\n");
-                return -1;
-            }
+        bool success = false;
 
-            labels[labels_index++] = label;
+        InstId id = find_instruction(mnemonic, mnemonic_len);
+        if(id == INST_INVALID) {
+            // add 1 to i since we start line indexing at 0, whereas the text editor starts at 1
+            diag_report(diags, DIAG_ERROR, E_UNKNOWN_INST, i + 1, (int) (mnemonic - lines[i]) + 1, "Invalid instruction \"%.*s\"", (int) mnemonic_len, mnemonic);
+        } else {
+            success = parse_instruction(id, lines[i], i + 1, &ctx, &inst);
         }
 
+        if(!success) {
+            inst.opcode = 0x0000;
+            inst.operand_kinds = 0;
+            ctx.sym_ref = -1;
+        }
 
-    }
-
-    return labels_index;
-}
+        // labels were blanked out rather than removed, so the columns still match the source file
+        size_t col_start = strspn(lines[i], " \t");
+        size_t col_end = strlen(lines[i]);
+        while(col_end > col_start && (lines[i][col_end - 1] == ' ' || lines[i][col_end - 1] == '\t' || lines[i][col_end - 1] == '\r')) col_end--;
 
-// converts a string instruction to an integer id
-int inst_to_id(char *inst) {
-    for(int i = 0; i < NUM_INSTRUCTIONS; i++) {
-        if(strcmp(inst, instructions[i]) == 0) return i;
+        if(!ir_push(ir, inst.opcode, i + 1, col_start, col_end, inst.operand_kinds, ctx.sym_ref)) {
+            printf("Error allocating memory\n");
+            return -1;
+        }
+        instructions_index++;
     }
 
-    return -1;
+    return instructions_index;
 }
 
-int parse_cseg(char **lines, int offset, int lines_len, ParsedInstruction *instructions, int inst_len) {
-    offset++; // skip the segment declaration
+// finds the branch labels in the code segment, adding each one to the symbol table with the address of the
+// instruction that follows it, and blanks the label out of its line
+// returns the number of labels found, problems are reported to diags
+int parse_branch_dest(char **lines, const ScanLine *scan, int offset, int lines_len, SymbolTable *syms, DiagList *diags) {
+    offset++; // skip the code segment declaration
 
-    int instructions_index = 0;
+    int dest_index = 0; // current destination index
+    int address = 0; // address of the next instruction, blank lines do not take up any space
     for(int i = offset; i < lines_len; i++) {
-        char inst_str[32];
-        memset(inst_str, 0, sizeof(char) * 32);
-        sscanf(lines[i], " %s ", inst_str);
-
-        if(inst_str[0] == '\0') continue; // skip blank lines
+        // if a line contains a colon, it has a branch label
+        if(scan[i].colon != SCAN_NONE) {
+            char *c = lines[i] + scan[i].colon;
+
+            // trim the whitespace around the label name, which is all there is left of it if a second code segment
+            // already ran over this line
+            char *name = lines[i];
+            while(name < c && (*name == ' ' || *name == '\t')) name++;
+            size_t label_len = c - name;
+            while(label_len > 0 && (name[label_len - 1] == ' ' || name[label_len - 1] == '\t')) label_len--;
+
+            if(!add_symbol(syms, name, label_len, address, SYM_CODE)) {
+                diag_report(diags, DIAG_ERROR, E_DUP_SYMBOL, i + 1, (int) (name - lines[i]) + 1, "Label %.*s is already defined", (int) label_len, name);
+            } else {
+                dest_index++;
+            }
 
-        int id = inst_to_id(inst_str);
-        if(id < 0) {
-            printf("Invalid instruction found at line %d\n", i + 1); // add 1 to i since we start line indexing at 0, whereas the text editor starts at 1
-            exit(-1);
+            // overwrite the label with spaces, leaving only the assembly instruction at its original column
+            memset(lines[i], ' ', c - lines[i] + 1); // add 1 to cover the colon
         }
 
-        ParsedInstruction inst;
-
-        bool success = false;
-
-        switch(id) {
-            case NOOP:
-                success = parse_noop(lines[i], i + 1, &inst);
-                break;
-
-            case INPUTC:
-                success = parse_inputc(lines[i], i + 1, &inst);
-                break;
+        if(!is_blank(lines[i])) address++;
+    }
 
-            case INPUTCF:
-                success = parse_inputcf(lines[i], i + 1, &inst);
-                break;
+    return dest_index;
+}
 
-            case INPUTD:
-                success = parse_inputd(lines[i], i + 1, &inst);
-                break;
+void print_bin_file(FILE *f, int bin) {
+    // if we are not on the least significant bit, recursively call the function
+  // with the current number divided by 2 (right shifted by 1)
+  if((bin >> 1) > 0) print_bin_file(f, bin >> 1);
 
-            case INPUTDF:
-                success = parse_inputdf(lines[i], i + 1, &inst);
-                break;
+  // retrieve the digit
+  int digit = bin % 2;
+  fprintf(f, "%d", digit);
+}
 
-            case MOVE:
-                success = parse_move(lines[i], i + 1, &inst);
-                break;
+// buffers that are kept between runs, so that watch mode reassembles without reallocating everything
+typedef struct {
+    char *source;
+    size_t source_cap;
+    ScanResult scan;
+    char **lines;
+    int lines_cap;
+    DataImage data;
+    InstIR ir;
+    SymbolTable syms;
+    DiagList diags;
+    LoopBounds bounds;
+} Workspace;
+
+// command line options
+typedef struct {
+    bool watch;
+    bool diag_json; // print diagnostics as JSON, in which case nothing else is printed to stdout
+    unsigned formats; // OUT_* flags for the files to write
+    bool optimize; // run the control flow pass on the code segment
+    bool simulate; // run the program once it is assembled
+    uint64_t sim_steps; // instruction count to stop the simulation at, 0 to run until the program ends
+    const char *sim_input; // file of values for the INPUT instructions
+    const char *snapshot; // where to save the state once the simulation stops
+    const char *restore; // snapshot to start the simulation from instead of reset
+    const char *trace; // file to write the execution trace to
+    uint32_t trace_size; // records kept in the trace buffer
+    TraceTrigger trigger; // stops the simulation and writes the trace early
+    const char *profile; // file to write the execution profile to
+    const char *layout; // profile to reorder the code blocks by
+    const char *rewrites; // rewrite database for the peephole pass
+    bool superopt; // search the windows missing from the rewrite database before the peephole pass
+    int threads; // threads for the superoptimizer and the batch runner, 0 for one per core
+    bool wcet; // report the best and worst case instruction counts of the finished program
+    bool aot; // run the simulation on the program compiled to native code
+    bool deps; // write a Makefile dependency file for the outputs
+    const char *dep_path; // where to write it, NULL for <name>.d next to the outputs
+    const char *target; // target description the program was assembled for, NULL for the built-in i281
+} Options;
+
+void init_workspace(Workspace *ws) {
+    memset(ws, 0, sizeof(Workspace));
+    data_init(&ws->data);
+    ir_init(&ws->ir);
+    init_symbols(&ws->syms);
+    diag_init(&ws->diags, NULL);
+}
 
-            case LOADI:
-                success = parse_loadi(lines[i], i + 1, &inst);
-                break;
+void free_workspace(Workspace *ws) {
+    free(ws->source);
+    free_scan(&ws->scan);
+    free(ws->lines);
+    data_free(&ws->data);
+    ir_free(&ws->ir);
+    free_symbols(&ws->syms);
+    diag_free(&ws->diags);
+    wcet_free_bounds(&ws->bounds);
+}
 
-            case LOADP:
-                success = parse_loadp(lines[i], i + 1, &inst);
-                break;
+// counts the instructions a program executes with the given input (NULL for none), or returns -1 if it runs out of
+// input, does not end within the step budget or does not fit in memory
+long long count_executed(const uint16_t *code, size_t code_len, const DataImage *data, const SimInput *input) {
+    SimState state;
+    if(!sim_reset(&state, code, code_len, data->bytes, data->len)) return -1;
+    if(sim_run(&state, input, SIM_DEFAULT_STEPS) != SIM_HALTED) return -1;
+    return state.steps;
+}
 
-            case ADD:
-                success = parse_add(lines[i], i + 1, &inst);
-                break;
+// runs the control flow pass and reports what it saved, returns -1 if memory ran out
+int optimize_cfg(InstIR *ir, const SymbolTable *syms, const DataImage *data, bool verbose) {
+    uint16_t *before = malloc(sizeof(uint16_t) * (ir->len + 1));
+    if(before == NULL) return -1;
+    if(ir->len > 0) memcpy(before, ir->opcode, sizeof(uint16_t) * ir->len);
+    size_t before_len = ir->len;
 
-            case ADDI:
-                success = parse_addi(lines[i], i + 1, &inst);
-                break;
+    CfgStats stats;
+    if(!cfg_optimize(ir, syms, &stats)) {
+        free(before);
+        return -1;
+    }
 
-            case SUB:
-                success = parse_sub(lines[i], i + 1, &inst);
-                break;
+    if(verbose) {
+        if(stats.skipped) {
+            printf("Control flow pass skipped, the program writes its own code or uses a code label as a value\n");
+        } else {
+            printf("Control flow pass threaded %d branches, removed %d branches to the next instruction and %d unreachable instructions\n",
+                   stats.threaded, stats.fallthrough, stats.unreachable);
+            printf("Code segment went from %zu to %zu words, saving %zu\n", stats.words_before, stats.words_after, stats.words_before - stats.words_after);
+
+            // cycles can only be compared for programs that run to the end on their own
+            long long cycles_before = count_executed(before, before_len, data, NULL);
+            long long cycles_after = count_executed(ir->opcode, ir->len, data, NULL);
+            if(cycles_before >= 0 && cycles_after >= 0) {
+                printf("Executed instructions went from %lld to %lld, saving %lld\n", cycles_before, cycles_after, cycles_before - cycles_after);
+            }
+        }
+    }
 
-            case SUBI:
-                success = parse_subi(lines[i], i + 1, &inst);
-                break;
+    free(before);
+    return 0;
+}
 
-            case LOAD:
-                success = parse_load(lines[i], i + 1, &inst);
-                break;
+// runs the peephole pass with the rewrite database, searching new windows first with --superopt
+// returns -1 if the database could not be read or written or memory ran out
+int run_peephole(const Options *opts, InstIR *ir, const SymbolTable *syms, bool verbose) {
+    RewriteDB db;
+    if(!rewrite_db_load(&db, opts->rewrites)) return -1;
+
+    int result = 0;
+    PeepholeStats stats;
+    size_t known = db.len;
+    if(!peephole(ir, syms, &db, opts->superopt, opts->threads, &stats)) {
+        printf("Error allocating memory\n");
+        result = -1;
+    } else if(verbose) {
+        if(stats.skipped) {
+            printf("Peephole pass skipped, the program writes its own code or uses a code label as a value\n");
+        } else {
+            if(opts->superopt) printf("Superoptimizer searched %d new windows\n", stats.searched);
+            printf("Peephole pass replaced %d windows, code segment went from %zu to %zu words\n", stats.rewritten, stats.words_before, stats.words_after);
+        }
+    }
 
-            case LOADF:
-                success = parse_loadf(lines[i], i + 1, &inst);
-                break;
+    // whatever was found is kept even if the pass failed later on
+    if(db.len > known) {
+        if(!rewrite_db_save(&db, opts->rewrites)) result = -1;
+        else if(verbose) printf("Saved %zu new rewrites to %s\n", db.len - known, opts->rewrites);
+    }
 
-            case STORE:
-                success = parse_store(lines[i], i + 1, &inst);
-                break;
+    rewrite_db_free(&db);
+    return result;
+}
 
-            case STOREF:
-                success = parse_storef(lines[i], i + 1, &inst);
-                break;
+// reorders the code blocks by the profile given with --layout and reports the change, returns -1 on failure
+int layout_program(const Options *opts, InstIR *ir, const SymbolTable *syms, const DataImage *data, bool verbose) {
+    Profile profile;
+    if(!profile_load(&profile, opts->layout)) return -1;
 
-            case SHIFTL:
-                success = parse_shiftl(lines[i], i + 1, &inst);
-                break;
+    // the counts are by address, so they mean nothing for any other program
+    if(profile.len != ir->len || profile.hash != code_hash(ir->opcode, ir->len)) {
+        if(verbose) printf("Profile %s was taken from a different program, layout skipped\n", opts->layout);
+        profile_free(&profile);
+        return 0;
+    }
 
-            case SHIFTR:
-                success = parse_shiftr(lines[i], i + 1, &inst);
-                break;
+    uint16_t *before = malloc(sizeof(uint16_t) * (ir->len + 1));
+    if(before == NULL) {
+        printf("Error allocating memory\n");
+        profile_free(&profile);
+        return -1;
+    }
+    memcpy(before, ir->opcode, sizeof(uint16_t) * ir->len);
+    size_t before_len = ir->len;
+
+    LayoutStats stats;
+    bool ok = layout_blocks(ir, syms, &profile, &stats);
+    profile_free(&profile);
+    if(!ok) {
+        printf("Error allocating memory\n");
+        free(before);
+        return -1;
+    }
 
-            case CMP:
-                success = parse_cmp(lines[i], i + 1, &inst);
-                break;
+    if(verbose) {
+        if(stats.skipped) {
+            printf("Block layout skipped, the program writes its own code, uses a code label as a value or a branch would not reach\n");
+        } else {
+            printf("Block layout moved %d of %d blocks, inverted %d branches, added %d jumps and removed %d\n",
+                   stats.moved, stats.blocks, stats.inverted, stats.jumps_added, stats.jumps_removed);
+            printf("Code segment went from %zu to %zu words\n", before_len, ir->len);
+
+            // the profiled run is repeated with the same input so the counts can be compared
+            SimInput input = {0};
+            if(opts->sim_input == NULL || read_sim_input(opts->sim_input, &input)) {
+                long long cycles_before = count_executed(before, before_len, data, &input);
+                long long cycles_after = count_executed(ir->opcode, ir->len, data, &input);
+                if(cycles_before >= 0 && cycles_after >= 0) {
+                    printf("Executed instructions went from %lld to %lld\n", cycles_before, cycles_after);
+                }
+            }
+            free_sim_input(&input);
+        }
+    }
 
-            case JUMP:
-                success = parse_jump(lines[i], i + 1, &inst);
-                break;
+    free(before);
+    return 0;
+}
 
-            case BRE:
-                success = parse_bre(lines[i], i + 1, &inst);
-                break;
+// runs the assembled program, or the snapshot given with --restore, and prints where it stopped
+int simulate(const char *path, const Options *opts, const InstIR *ir, const DataImage *data, bool verbose) {
+    SimState state;
+    if(opts->restore != NULL) {
+        if(!sim_load_file(&state, opts->restore)) return -1;
+    } else if(!sim_reset(&state, ir->opcode, ir->len, data->bytes, data->len)) {
+        printf("Program does not fit in the %d word code segment and cannot be simulated\n", CSEG_SIZE);
+        return -1;
+    }
 
-            case BRZ:
-                success = parse_brz(lines[i], i + 1, &inst);
-                break;
+    SimInput input = {0};
+    if(opts->sim_input != NULL && !read_sim_input(opts->sim_input, &input)) {
+        free_sim_input(&input);
+        return -1;
+    }
 
-            case BRNE:
-                success = parse_brne(lines[i], i + 1, &inst);
-                break;
+    TraceBuffer trace = {0};
+    if(opts->trace != NULL && !trace_init(&trace, opts->trace_size, state.steps)) {
+        printf("Error allocating memory\n");
+        free_sim_input(&input);
+        return -1;
+    }
 
-            case BRNZ:
-                success = parse_brnz(lines[i], i + 1, &inst);
-                break;
+    Profile profile = {0};
+    if(opts->profile != NULL && !profile_init(&profile, ir->opcode, ir->len)) {
+        printf("Error allocating memory\n");
+        trace_free(&trace);
+        free_sim_input(&input);
+        return -1;
+    }
 
-            case BRG:
-                success = parse_brg(lines[i], i + 1, &inst);
-                break;
+    // the compiled program runs blocks at a time, so the trace and the profile still need the interpreter
+    AotProgram aot = {0};
+    if(opts->aot && (opts->trace != NULL || opts->profile != NULL)) {
+        if(verbose) printf("--aot has no effect with --trace or --profile, which look at every instruction\n");
+    } else if(opts->aot && !aot_compile(&aot, state.cmem, state.code_len)) {
+        if(verbose) printf("Running the program on the interpreter instead\n");
+    }
 
-            case BRGE:
-                success = parse_brge(lines[i], i + 1, &inst);
-                break;
+    int result = 0;
+    bool triggered = false;
+    uint64_t max_steps = opts->sim_steps > 0 ? opts->sim_steps : state.steps + SIM_DEFAULT_STEPS;
+    SimStatus status;
+    if(opts->trace != NULL) status = sim_run_traced(&state, &input, max_steps, &trace, &opts->trigger, &triggered);
+    else if(opts->profile != NULL) status = sim_run_profiled(&state, &input, max_steps, &profile);
+    else if(aot.run != NULL) status = aot_run(&aot, &state, &input, max_steps);
+    else status = sim_run(&state, &input, max_steps);
+
+    if(triggered) {
+        // stopping at the trigger is what was asked for, so it is not a failure
+    } else if(status == SIM_RUNNING && opts->sim_steps == 0) {
+        state.status = status = SIM_STEP_LIMIT;
+        result = -1;
+    } else if(status == SIM_NO_INPUT) {
+        result = -1;
+    }
 
-            default: // not sure how we'd ever get to here, but just in case
-                printf("Error on line %d, unrecognized instruction\n", i + 1);
+    if(verbose) {
+        if(status == SIM_HALTED) printf("Program ended after %llu instructions\n", (unsigned long long) state.steps);
+        else if(triggered) printf("Trace triggered at PC %d after %llu instructions\n", state.pc, (unsigned long long) state.steps);
+        else if(status == SIM_RUNNING) printf("Stopped at instruction count %llu\n", (unsigned long long) state.steps);
+        else if(status == SIM_NO_INPUT) printf("Ran out of input at PC %d\n", state.pc);
+        else printf("Program did not end within %d instructions\n", SIM_DEFAULT_STEPS);
+        sim_print(&state, stdout);
+    }
 
-        }
+    if(opts->snapshot != NULL) {
+        if(!sim_save_file(&state, opts->snapshot)) result = -1;
+        else if(verbose) printf("Saved snapshot to %s\n", opts->snapshot);
+    }
 
-        if(!success) exit(-1);
+    // the trace is written however the run stopped, it is most useful when something went wrong
+    if(opts->trace != NULL) {
+        if(!trace_save(&trace, opts->trace, path, ir)) result = -1;
+        else if(verbose) printf("Saved trace to %s\n", opts->trace);
+        trace_free(&trace);
+    }
 
-        instructions[instructions_index++] = inst;
+    if(opts->profile != NULL) {
+        if(!profile_save(&profile, opts->profile)) result = -1;
+        else if(verbose) printf("Saved profile to %s\n", opts->profile);
+        profile_free(&profile);
     }
 
-    return instructions_index;
+    aot_free(&aot);
+    free_sim_input(&input);
+    return result;
 }
 
-void replace_dseg_labels(char **lines, int offset, int lines_len, DataLabel *labels, int labels_len) {
-    offset++; // skip the segment declaration for the code segment
+// fills in every file that can change what the outputs of path contain, returns how many there are
+int list_inputs(const char *path, const Options *opts, const char *inputs[MAX_INPUTS]) {
+    int num_inputs = 0;
+    inputs[num_inputs++] = path;
+    if(opts->target != NULL) inputs[num_inputs++] = opts->target;
+    if(opts->layout != NULL) inputs[num_inputs++] = opts->layout;
+    if(opts->rewrites != NULL) inputs[num_inputs++] = opts->rewrites;
+    return num_inputs;
+}
 
-    // replace all data symbol names with their address
-    for(int i = offset; i < lines_len; i++) {
-        for(int j = 0; j < labels_len; j++) {
-            // find an opening bracket on the line
-            char *open_bracket = strchr(lines[i], '[');
-            if(open_bracket == NULL) continue;
-            char *c = strstr(open_bracket, labels[j].name);
-            if(c == NULL) continue;
-                
-            // this seems sketchy, but oh well
-            char *edited_line = malloc(sizeof(char) * (strlen(lines[i]) + 3)); // + 3 is here since the maximum number of chars an address can take is 3, and the minimum for a label is 1, also need the null terminator
-            // copy the contents of the line before the symbol
-            strncpy(edited_line, lines[i], (c - lines[i]) / sizeof(char));
-            edited_line[(c - lines[i]) / sizeof(char)] = '\0';
-            // concatenate the address
-            sprintf(edited_line, "%s%d%s", edited_line, labels[j].start_address, c + (strlen(labels[j].name) * sizeof(char)));
-            free(lines[i]);
-            lines[i] = edited_line;
+// writes the dependency file for the outputs of path, listing every file that can change what they contain
+int write_deps(const char *path, const Options *opts, unsigned formats, bool verbose) {
+    const char *inputs[MAX_INPUTS];
+    int num_inputs = list_inputs(path, opts, inputs);
+    return write_depfile(path, opts->dep_path, formats, inputs, num_inputs, verbose);
+}
+
+// returns the line the segment is declared on, or -1 if it is not
+// each segment runs to the end of the file or the next one, so any later declaration is reported and blanked out, and
+// cannot start the parse of the rest of the file over again
+int find_segment(char **lines, ScanLine *scan, int num_lines, const char *segment, DiagList *diags) {
+    int first = -1;
+    for(int i = 0; i < num_lines; i++) {
+        if(strncmp(lines[i], segment, strlen(segment)) != 0) continue;
+
+        if(first < 0) {
+            first = i;
+        } else {
+            diag_report(diags, DIAG_ERROR, E_BAD_DIRECTIVE, i + 1, 1, "Segment %s is already declared on line %d", segment, first + 1);
+            lines[i][0] = '\0';
+            scan[i].colon = scan[i].bracket = scan[i].comma = SCAN_NONE;
         }
     }
+    return first;
 }
 
-int parse_branch_dest(char **lines, int offset, int lines_len, BranchDest *dest, int dest_len) {
-    offset++; // skip the code segment declaration
+// assembles the file_len bytes of source already in ws->source, path names the outputs and the diagnostics
+// returns 0 on success and -1 if the program could not be assembled
+int assemble_source(const char *path, size_t file_len, const Options *opts, Workspace *ws) {
+    // progress messages are left out when stdout is reserved for the JSON diagnostics
+    bool verbose = !opts->diag_json;
 
-    int dest_index = 0; // current destination index
-    for(int i = offset; i < lines_len; i++) {
-        char *c = strchr(lines[i], ':'); // if a line contains a colon, it has a branch label
+    // every problem is collected here and printed once all passes have run
+    DiagList *diags = &ws->diags;
+    diags->file = path;
+    diag_clear(diags);
 
-        if(c != NULL) {
+    // find the newlines, comments, labels and brackets of every line
+    if(!scan_source(ws->source, file_len, &ws->scan)) {
+        printf("Error allocating memory\n");
+        return -1;
+    }
+    int num_lines = ws->scan.num_lines;
+
+    // allocate a two-dimensional array to store each line, with the comments already removed
+    if(num_lines > ws->lines_cap) {
+        char **grown = realloc(ws->lines, sizeof(char *) * num_lines);
+        if(grown == NULL) {
+            printf("Error allocating memory\n");
+            return -1;
+        }
+        ws->lines = grown;
+        ws->lines_cap = num_lines;
+    }
+    char **lines = ws->lines;
 
-            size_t label_len = (c - lines[i]) / sizeof(char);
+    for(int i = 0; i < num_lines; i++) {
+        ScanLine *scan = &ws->scan.lines[i];
+        size_t len = scan->comment != SCAN_NONE ? (size_t) scan->comment : scan->len;
+        lines[i] = malloc(sizeof(char) * (len + 1));
+        if(lines[i] == NULL) {
+            printf("Error allocating memory\n");
+            while(i-- > 0) free(lines[i]);
+            return -1;
+        }
+        memcpy(lines[i], ws->source + scan->start, len);
+        lines[i][len] = '\0';
+
+        // the passes treat each line as a string, so a NUL byte in it would hide the rest of the line from them
+        // while the scanned positions of its colon, bracket and comma still point past it
+        char *nul = memchr(lines[i], '\0', len);
+        if(nul != NULL) {
+            diag_report(diags, DIAG_ERROR, E_BAD_CHAR, i + 1, (int) (nul - lines[i]) + 1, "NUL byte in source");
+            for(; nul != NULL; nul = memchr(nul, '\0', lines[i] + len - nul)) *nul = ' ';
+        }
+    }
 
-            dest[dest_index].name = malloc(sizeof(char) * (label_len + 1));
-            strncpy(dest[dest_index].name, lines[i], label_len);
-            dest[dest_index].name[label_len] = '\0';
+    // contents of the data segment
+    DataImage *data = &ws->data;
+    data_clear(data);
+    int num_labels = 0;
 
-            dest[dest_index].address = i - offset;
+    // parsed instructions
+    InstIR *ir = &ws->ir;
+    ir_clear(ir);
+    int num_insts = 0;
 
-            // edit the line to remove the label, leaving only the assembly instruction
-            strcpy(lines[i], c + 1); // add 1 to skip the colon
-            lines[i] = realloc(lines[i], sizeof(char) * (strlen(lines[i]) + 1));
+    // constants and data and code labels that operands can refer to
+    SymbolTable *syms = &ws->syms;
+    int num_dests = 0;
 
-            dest_index++;
-        }
-    }
+    int result = 0;
 
-    // replace all label names with their address
-    for(int i = offset; i < lines_len; i++) {
-        for(int j = 0; j < dest_index; j++) {
-            char *c = strstr(lines[i], dest[j].name);
-            if(c != NULL) {
-                // this seems sketchy, but oh well
-                char *edited_line = malloc(sizeof(char) * (strlen(lines[i]) + 3)); // + 3 is here since the maximum number of chars an address can take is 3, and the minimum for a label is 1, also need the null terminator
+    int data_line = find_segment(lines, ws->scan.lines, num_lines, segments[0], diags);
+    int code_line = find_segment(lines, ws->scan.lines, num_lines, segments[1], diags);
 
-                // copy the contents of the line before the symbol
-                strncpy(edited_line, lines[i], (c - lines[i]) / sizeof(char));
-                edited_line[(c - lines[i]) / sizeof(char)] = '\0';
+    // parse the data segment first, its labels can be used anywhere in the code
+    if(data_line >= 0) {
+        num_labels = parse_dseg(lines, data_line, num_lines, syms, data, DSEG_SIZE, diags);
 
-                // concatenate the address
-                // the value passed to the %d specifier is the destination address minus the current program counter value - 1
-                sprintf(edited_line, "%s%d%s", edited_line, dest[j].address - i + offset - 1, c + (strlen(dest[j].name) * sizeof(char)));
+        if(verbose) printf("Read %d labels from data segment\n", num_labels);
+    }
 
-                free(lines[i]);
-                lines[i] = edited_line;
+    parse_equs(lines, num_lines, syms, diags);
 
-                // printf("Line %d: %s\n", i, edited_line);
-            }
+    if(code_line >= 0) {
+        num_dests = parse_branch_dest(lines, ws->scan.lines, code_line, num_lines, syms, diags);
+        num_insts = parse_cseg(lines, code_line, num_lines, syms, ir, diags);
+        if(num_insts < 0) {
+            num_insts = 0;
+            result = -1;
+            goto cleanup;
         }
     }
 
-    return dest_index;
-}
+    if(verbose) {
+        printf("Parsed %d branch destinations\n", num_dests);
+        printf("Parsed %d instructions\n", num_insts);
+    }
 
-void print_bin_file(FILE *f, int bin) {
-    // if we are not on the least significant bit, recursively call the function
-  // with the current number divided by 2 (right shifted by 1)
-  if((bin >> 1) > 0) print_bin_file(f, bin >> 1);
+    // the IR can hold any number of instructions, but the hardware cannot
+    if(num_insts > CSEG_SIZE) diag_report(diags, DIAG_WARNING, W_CSEG_FULL, ir->line[CSEG_SIZE], ir->col_start[CSEG_SIZE] + 1, "%d instructions do not fit in the %d word code segment", num_insts, CSEG_SIZE);
 
-  // retrieve the digit
-  int digit = bin % 2;
-  fprintf(f, "%d", digit);
-}
+    // the loop bounds live in the comments, which is the one place that still has them
+    if(opts->wcet && !wcet_read_bounds(ws->source, &ws->scan, &ws->bounds, diags)) {
+        printf("Error allocating memory\n");
+        result = -1;
+        goto cleanup;
+    }
 
-int main(int argc, char *argv[]) {
-    if(argc < 2) {
-        printf("Usage: filename\n");
-        return -1;
+    diag_print(diags, stdout, opts->diag_json);
+    if(diags->errors > 0) {
+        result = -1;
+        goto cleanup;
     }
 
-    FILE *asm_file = fopen(argv[1], "r");
-    if(asm_file == NULL) {
-        printf("Error occured opening file: %s\n", strerror(errno));
-        return -1;
+    if(opts->optimize && optimize_cfg(ir, syms, data, verbose) < 0) {
+        printf("Error allocating memory\n");
+        result = -1;
+        goto cleanup;
     }
 
-    // find number of lines in program so that we can parse line by line
-    int num_lines = 0;
-    char c;
-    while((c = fgetc(asm_file)) != EOF) {
-        if(c == '\n') num_lines++;
+    if(opts->rewrites != NULL && run_peephole(opts, ir, syms, verbose) < 0) {
+        result = -1;
+        goto cleanup;
     }
 
-    // allocate a two-dimensional array to store each line
-    char **lines = malloc(sizeof(char *) * num_lines);
+    // the layout comes after the control flow pass, which is where --profile took its counts
+    if(opts->layout != NULL && layout_program(opts, ir, syms, data, verbose) < 0) {
+        result = -1;
+        goto cleanup;
+    }
 
-    // buffer to read data into
-    char *read_buff = malloc(sizeof(char) * 1024);
-    memset(read_buff, 0, 1024);
+    // the analysis looks at the program as it will be written, after every pass has changed it
+    // the report goes to stderr when stdout is reserved for the JSON diagnostics
+    if(opts->wcet && !wcet_analyze(ir, syms, &ws->bounds, verbose ? stdout : stderr)) result = -1;
 
-    fseek(asm_file, 0, SEEK_SET);
+    // write every selected output from the one assembled program
+    if(write_outputs(path, opts->formats, ir, data, verbose) < 0) result = -1;
 
-    for(int i = 0; i < num_lines; i++) {
-        fgets(read_buff, 1024, asm_file);
-        size_t len = strlen(read_buff);
-        read_buff[len - 1] = '\0'; // remove trailing newline
-        lines[i] = malloc(sizeof(char) * (len + 1));
-        if(lines[i] == NULL) printf("Error allocating memory\n");
-        strcpy(lines[i], read_buff);
-        memset(read_buff, 0, 1024);
-    }
+    // a build system reading the dependencies must never see them for outputs that were not written
+    else if(opts->deps && write_deps(path, opts, opts->formats, verbose) < 0) result = -1;
 
-    // remove comments from file
-    for(int i = 0; i < num_lines; i++) {
-        char *comment_start = strchr(lines[i], ';');
-        if(comment_start != NULL) {
-            comment_start[0] = '\0';
-        }
-        lines[i] = realloc(lines[i], strlen(lines[i]) + 1);
-    }
+    if(opts->simulate && simulate(path, opts, ir, data, verbose) < 0) result = -1;
 
-    // data label array to store values that will be placed in the data segment
-    DataLabel *label = malloc(sizeof(DataLabel) * 8);
-    int num_labels = 0;
+cleanup:
+    for(int i = 0; i < num_lines; i++) free(lines[i]);
+    clear_symbols(syms);
 
-    // look for a data segment to begin parsing
-    for(int i = 0; i < num_lines; i++) {
-        if(strncmp(lines[i], segments[0], strlen(segments[0])) == 0) {
-            num_labels = parse_dseg(lines, i, num_lines, label, 8);
+    return result;
+}
 
-            printf("Read %d labels from data segment\n", num_labels);
+// assembles the file at path, returns 0 on success and -1 if the program could not be assembled
+int assemble(const char *path, const Options *opts, Workspace *ws) {
+    // read the whole program into memory so it can be scanned in one pass
+    size_t file_len;
+    if(!read_file(path, &ws->source, &ws->source_cap, &file_len)) return -1;
+    return assemble_source(path, file_len, opts, ws);
+}
 
-            // for(int j = 0; j < num_labels; j++) {
-            //     printf("Name: %s\nStart Address: %d\nValues:\n", label[j].name, label[j].start_address);
-            //     for(int k = 0; k < label[j].len; k++) {
-            //         printf("%d\n", label[j].data[k]);
-            //     }
-            // }
-        }
+typedef struct {
+    const char *path;
+    const Options *opts;
+    Workspace *ws;
+} WatchTarget;
+
+void reassemble(void *ctx) {
+    WatchTarget *target = ctx;
+    bool verbose = !target->opts->diag_json;
+    if(verbose) printf("\n%s or one of its inputs changed, reassembling\n", target->path);
+
+    // the sizes come from the target file, which may be the one that changed
+    if(target->opts->target != NULL && !target_load(target->opts->target)) {
+        if(verbose) printf("Assembly failed, waiting for the next change\n");
+        return;
     }
+    if(assemble(target->path, target->opts, target->ws) != 0 && verbose) printf("Assembly failed, waiting for the next change\n");
+}
 
-    // array to store parsed instructions
-    ParsedInstruction *inst = malloc(sizeof(ParsedInstruction) * CSEG_SIZE);
-    int num_insts = 0;
+#ifdef I281_FUZZ
+
+// budgets for one fuzz input, a run that goes over them grew faster than its input and is reported as a crash
+// the base covers the fixed cost of the simulations, which stop after a set number of steps however long the input is
+#define FUZZ_BASE_NS 1000000000LL
+#define FUZZ_NS_PER_BYTE 20000LL
+#define FUZZ_BASE_BYTES (1 << 20)
+#define FUZZ_BYTES_PER_BYTE 256
+#define FUZZ_SIM_STEPS 100000
+
+// memory the workspace is left holding after a run, which is where a pass that grows too fast shows up
+static size_t workspace_size(const Workspace *ws) {
+    size_t size = ws->source_cap;
+    size += sizeof(ScanLine) * ws->scan.lines_cap;
+    size += sizeof(char *) * ws->lines_cap;
+    size += ws->data.cap;
+    size += (sizeof(uint16_t) * 3 + sizeof(uint32_t) + sizeof(uint8_t) + sizeof(int32_t)) * ws->ir.cap;
+    size += sizeof(Symbol) * ws->syms.cap + sizeof(int) * ws->syms.index_cap;
+    for(int i = 0; i < ws->syms.len; i++) size += strlen(ws->syms.syms[i].name) + 1;
+    size += sizeof(Diagnostic) * ws->diags.cap;
+    for(int i = 0; i < ws->diags.len; i++) size += strlen(ws->diags.items[i].msg) + 1;
+    size += sizeof(LoopBound) * ws->bounds.cap;
+    return size;
+}
 
-    // array to store branch destinations
-    BranchDest *dest = malloc(sizeof(BranchDest) * 16);
-    int num_dests = 0;
+static long long elapsed_ns(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000LL + (now.tv_nsec - start->tv_nsec);
+}
 
-    // look for a code segment to parse code
-    for(int i = 0; i < num_lines; i++) {
-        if(strncmp(lines[i], segments[1], strlen(segments[1])) == 0) {
-            replace_dseg_labels(lines, i, num_lines, label, num_labels);
-            num_dests = parse_branch_dest(lines, i, num_lines, dest, 16);
-            num_insts = parse_cseg(lines, i, num_lines, inst, 64);
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    // the progress messages and diagnostics would take longer to print than the program takes to assemble
+    if(freopen("/dev/null", "w", stdout) == NULL) return -1;
+    return 0;
+}
+
+// runs every pass that needs nothing but the source on data, without writing any files
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    Options opts = {0};
+    opts.optimize = true;
+    opts.wcet = true;
+    opts.simulate = true;
+    opts.sim_steps = FUZZ_SIM_STEPS;
+
+    // a fresh workspace for every input, so the memory it ends up with is down to this input alone
+    Workspace ws;
+    init_workspace(&ws);
+    ws.source = malloc(size + 1);
+    if(ws.source == NULL) return 0;
+    ws.source_cap = size + 1;
+    memcpy(ws.source, data, size);
+    ws.source[size] = '\0';
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assemble_source("fuzz.asm", size, &opts, &ws);
+    long long ns = elapsed_ns(&start);
+    size_t bytes = workspace_size(&ws);
+    free_workspace(&ws);
+
+    if(ns > FUZZ_BASE_NS + FUZZ_NS_PER_BYTE * (long long) size) {
+        fprintf(stderr, "%zu byte input took %lld ms, over the time budget\n", size, ns / 1000000);
+        abort();
+    }
+    if(bytes > FUZZ_BASE_BYTES + FUZZ_BYTES_PER_BYTE * size) {
+        fprintf(stderr, "%zu byte input left %zu bytes in the workspace, over the memory budget\n", size, bytes);
+        abort();
+    }
+    return 0;
+}
+
+#ifdef I281_FUZZ_REPLAY
+// stands in for libFuzzer with compilers that do not have it, running each file given once
+int main(int argc, char *argv[]) {
+    if(LLVMFuzzerInitialize(&argc, &argv) < 0) return -1;
+
+    char *buf = NULL;
+    size_t cap = 0;
+    for(int i = 1; i < argc; i++) {
+        size_t len;
+        if(!read_file(argv[i], &buf, &cap, &len)) {
+            free(buf);
+            return -1;
         }
+        LLVMFuzzerTestOneInput((const uint8_t *) buf, len);
     }
+    fprintf(stderr, "Ran %d inputs\n", argc - 1);
 
-    printf("Parsed %d branch destinations\n", num_dests);
-    printf("Parsed %d instructions\n", num_insts);
+    free(buf);
+    return 0;
+}
+#endif
 
-    // write the result to a file
-    char *filename = malloc(sizeof(char) * (strlen(argv[1]) + 1));
-    strcpy(filename, argv[1]);
-    char *ext = strstr(filename, ".asm");
-    strcpy(ext, ".bin");
+#else
 
-    FILE *out_file = fopen(filename, "w+");
-    fprintf(out_file, "-----MACHINE CODE-----\n");
-    for(int i = 0; i < num_insts; i++) {
-        for(int j = 0; j < 4; j++) {
-            if(inst[i].opcode & (1 << (15 - j))) fputc('1', out_file);
-            else fputc('0', out_file);
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    Options opts = {0};
+    bool no_bin = false;
+    bool stream = false;
+    const char *batch_list = NULL;
+    const char *disasm = NULL;
+    const char *trace_decode_path = NULL;
+    const char *replay_text = NULL, *replay_path = NULL;
+    bool serve_stdio = false;
+    BatchOptions batch = {0};
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--watch") == 0) opts.watch = true;
+        else if(strcmp(argv[i], "--diag-json") == 0) opts.diag_json = true;
+        else if(strcmp(argv[i], "--mif") == 0) opts.formats |= OUT_MIF;
+        else if(strcmp(argv[i], "--coe") == 0) opts.formats |= OUT_COE;
+        else if(strcmp(argv[i], "--memb") == 0) opts.formats |= OUT_MEMB;
+        else if(strcmp(argv[i], "--memh") == 0) opts.formats |= OUT_MEMH;
+        else if(strcmp(argv[i], "--no-bin") == 0) no_bin = true;
+        else if(strcmp(argv[i], "--optimize") == 0) opts.optimize = true;
+        else if(strcmp(argv[i], "--simulate") == 0) opts.simulate = true;
+        else if(strcmp(argv[i], "--stream") == 0) stream = true;
+        else if(strcmp(argv[i], "--lockstep") == 0) batch.lockstep = true;
+        else if(strcmp(argv[i], "--aot") == 0) opts.aot = batch.aot = true;
+        else if(strcmp(argv[i], "--wcet") == 0) opts.wcet = true;
+        else if(strcmp(argv[i], "--serve") == 0) serve_stdio = true;
+        // the options below take a value, a missing one falls through to the usage message
+        else if(strcmp(argv[i], "--steps") == 0 && i + 1 < argc) opts.sim_steps = strtoull(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "--input") == 0 && i + 1 < argc) opts.sim_input = argv[++i];
+        else if(strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) opts.snapshot = argv[++i];
+        else if(strcmp(argv[i], "--restore") == 0 && i + 1 < argc) opts.restore = argv[++i];
+        else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc) opts.trace = argv[++i];
+        else if(strcmp(argv[i], "--trace-size") == 0 && i + 1 < argc) opts.trace_size = strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "--trace-trigger") == 0 && i + 1 < argc) {
+            if(!parse_trigger(argv[++i], &opts.trigger)) {
+                printf("Invalid trigger \"%s\", expected pc=N, write=N or step=N\n", argv[i]);
+                return -1;
+            }
         }
-        fputc('_', out_file);
-        for(int j = 0; j < 2; j++) {
-            if(inst[i].opcode & (1 << (11 - j))) fputc('1', out_file);
-            else fputc('0', out_file);
+        else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc) opts.profile = argv[++i];
+        else if(strcmp(argv[i], "--layout") == 0 && i + 1 < argc) opts.layout = argv[++i];
+        else if(strcmp(argv[i], "--peephole") == 0 && i + 1 < argc) opts.rewrites = argv[++i];
+        else if(strcmp(argv[i], "--superopt") == 0 && i + 1 < argc) {
+            opts.rewrites = argv[++i];
+            opts.superopt = true;
         }
-        fputc('_', out_file);
-        for(int j = 0; j < 2; j++) {
-            if(inst[i].opcode & (1 << (9 - j))) fputc('1', out_file);
-            else fputc('0', out_file);
+        else if(strcmp(argv[i], "--trace-decode") == 0 && i + 1 < argc) trace_decode_path = argv[++i];
+        else if(strcmp(argv[i], "--target") == 0 && i + 1 < argc) opts.target = argv[++i];
+        else if(strcmp(argv[i], "-MD") == 0) opts.deps = true;
+        else if(strcmp(argv[i], "-MF") == 0 && i + 1 < argc) {
+            opts.dep_path = argv[++i];
+            opts.deps = true;
         }
-        fputc('_', out_file);
-        for(int j = 0; j < 8; j++) {
-            if(inst[i].opcode & (1 << (7 - j))) fputc('1', out_file);
-            else fputc('0', out_file);
+        else if(strcmp(argv[i], "--replay") == 0 && i + 2 < argc) {
+            replay_text = argv[++i];
+            replay_path = argv[++i];
         }
-        fputc('\n', out_file);
+        else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batch_list = argv[++i];
+        else if(strcmp(argv[i], "--disasm") == 0 && i + 1 < argc) disasm = argv[++i];
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) batch.threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--report") == 0 && i + 1 < argc) batch.report = argv[++i];
+        else path = argv[i];
     }
 
-    fputc('\n', out_file);
+    // every size below comes from the target, so it has to be in place before anything else runs
+    if(opts.target != NULL && !target_load(opts.target)) return -1;
 
-    fprintf(out_file, "-----DATA SEGMENT-----\n");
-    if(num_labels > 0) {
-        fputc('[', out_file);
-        // copy all but the last data label
-        for(int i = 0; i < num_labels - 1; i++) {
-            for(int j = 0; j < label[i].len; j++) {
-                fprintf(out_file, "%hhu, ", label[i].data[j]);
-            }
+    // the batch runner works on already assembled images, so there is no source file
+    if(batch_list != NULL) return run_batch(batch_list, &batch);
+
+    // the responses get stdout to themselves, everything the passes print goes to stderr instead
+    if(serve_stdio) {
+        int fd = dup(STDOUT_FILENO);
+        FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+        if(out == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            printf("Error opening the response stream: %s\n", strerror(errno));
+            return -1;
         }
-        // copy the last data label avoid adding an extra comma
-        for(int i = 0; i < label[num_labels - 1].len - 1; i++) {
-            fprintf(out_file, "%hhu, ", label[num_labels - 1].data[i]);
+        int result = serve(stdin, out);
+        fclose(out);
+        return result;
+    }
+
+    if(trace_decode_path != NULL) return trace_decode(trace_decode_path, stdout) ? 0 : -1;
+
+    // converting the input once saves parsing it on every run that uses it
+    if(replay_text != NULL) {
+        SimInput input = {0};
+        bool ok = read_sim_input(replay_text, &input) && save_sim_input(&input, replay_path);
+        if(ok) printf("Wrote %zu input values%s to %s\n", input.len, input.by_pc != NULL ? " keyed by PC" : "", replay_path);
+        free_sim_input(&input);
+        return ok ? 0 : -1;
+    }
+
+    if(disasm != NULL) {
+        uint16_t code[TARGET_CSEG_MAX];
+        uint8_t data[TARGET_DSEG_MAX];
+        size_t code_len, data_len;
+        if(!read_bin(disasm, code, &code_len, CSEG_SIZE, data, &data_len, DSEG_SIZE)) return -1;
+        write_disassembly(stdout, code, code_len, data, data_len);
+        return 0;
+    }
+
+    if(path == NULL) {
+        printf("Usage: [--target file] [--watch] [--diag-json] [--mif] [--coe] [--memb] [--memh] [--no-bin] [--optimize] [--layout profile] [--wcet]\n");
+        printf("       [-MD [-MF depfile]]\n");
+        printf("       [--peephole rewrites | --superopt rewrites [--threads N]]\n");
+        printf("       [--simulate [--aot] [--steps N] [--input file] [--snapshot file] [--restore file] [--profile file]\n");
+        printf("        [--trace file [--trace-size N] [--trace-trigger pc=N|write=N|step=N]]] filename\n");
+        printf("       --stream [--diag-json] [-MD [-MF depfile]] filename\n");
+        printf("       --batch list [--threads N] [--lockstep | --aot] [--report file]\n");
+        printf("       --serve\n");
+        printf("       --disasm file.bin\n");
+        printf("       --trace-decode file\n");
+        printf("       --replay input replayfile\n");
+        return -1;
+    }
+
+    // the streaming assembler never holds the whole program, so it can only write the .bin file
+    if(stream) {
+        if(opts.watch || opts.formats != 0 || no_bin || opts.optimize || opts.wcet || opts.rewrites != NULL || opts.simulate || opts.layout != NULL || opts.sim_steps > 0 ||
+           opts.sim_input != NULL || opts.snapshot != NULL || opts.restore != NULL || opts.trace != NULL || opts.profile != NULL) {
+            printf("--stream only writes the .bin file and cannot be combined with other outputs, passes or the simulator\n");
+            return -1;
         }
-        fprintf(out_file, "%d]\n", label[num_labels - 1].data[label[num_labels - 1].len - 1]);
+        if(assemble_stream(path, opts.diag_json) != 0) return -1;
+        return opts.deps ? write_deps(path, &opts, OUT_BIN, !opts.diag_json) : 0;
     }
 
-    fclose(out_file);
+    opts.threads = batch.threads;
 
-    printf("Wrote output to %s\n", filename);
+    // the .bin file is always written unless it was turned off
+    if(!no_bin) opts.formats |= OUT_BIN;
 
-    return 0;
-}
\ No newline at end of file
+    // saving or restoring a snapshot only makes sense for a simulation
+    if(opts.sim_steps > 0 || opts.sim_input != NULL || opts.snapshot != NULL || opts.restore != NULL || opts.trace != NULL || opts.profile != NULL) opts.simulate = true;
+    if(opts.trace != NULL && opts.profile != NULL) {
+        printf("--trace and --profile cannot be used in the same run\n");
+        return -1;
+    }
+    if(opts.trace_size == 0) opts.trace_size = TRACE_DEFAULT_SIZE;
+
+    // progress messages should show up as they happen even when the output is piped into another tool
+    if(opts.watch) setvbuf(stdout, NULL, _IOLBF, 0);
+
+    Workspace ws;
+    init_workspace(&ws);
+
+    int result = assemble(path, &opts, &ws);
+    if(!opts.watch) return result;
+
+    // the target, the layout profile and the rewrite database change the outputs as much as the source does
+    if(!opts.diag_json) printf("Watching for changes, press Ctrl-C to stop\n");
+    WatchTarget target = {path, &opts, &ws};
+    const char *watched[MAX_INPUTS];
+    int num_watched = list_inputs(path, &opts, watched);
+    return watch_files(watched, num_watched, reassemble, &target);
+}
+
+#endif
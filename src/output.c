@@ -0,0 +1,362 @@
+#include "output.h"
+
+#include "instructions.h"
+#include "fileio.h"
+#include "isa.h"
+
+// one memory of the processor, padded with zeros up to its hardware size
+typedef struct {
+    const char *name; // used in the file name, <name>_code.mif
+    int width; // bits per word
+    size_t depth; // number of words in the file
+    size_t len; // number of words actually used by the program
+    const uint16_t *words; // code segment words, or NULL for the data segment
+    const uint8_t *bytes; // data segment bytes
+} Memory;
+
+static uint32_t mem_word(const Memory *mem, size_t addr) {
+    if(addr >= mem->len) return 0;
+    return mem->words != NULL ? mem->words[addr] : mem->bytes[addr];
+}
+
+static void put_bits(FILE *out_file, uint32_t word, int width) {
+    for(int j = width - 1; j >= 0; j--) fputc(word & (1u << j) ? '1' : '0', out_file);
+}
+
+void write_bin_word(FILE *out_file, uint16_t opcode) {
+    for(int j = 0; j < 4; j++) {
+        if(opcode & (1 << (15 - j))) fputc('1', out_file);
+        else fputc('0', out_file);
+    }
+    fputc('_', out_file);
+    for(int j = 0; j < 2; j++) {
+        if(opcode & (1 << (11 - j))) fputc('1', out_file);
+        else fputc('0', out_file);
+    }
+    fputc('_', out_file);
+    for(int j = 0; j < 2; j++) {
+        if(opcode & (1 << (9 - j))) fputc('1', out_file);
+        else fputc('0', out_file);
+    }
+    fputc('_', out_file);
+    for(int j = 0; j < 8; j++) {
+        if(opcode & (1 << (7 - j))) fputc('1', out_file);
+        else fputc('0', out_file);
+    }
+    fputc('\n', out_file);
+}
+
+void write_bin_data(FILE *out_file, const DataImage *data) {
+    fputc('\n', out_file);
+
+    fprintf(out_file, "-----DATA SEGMENT-----\n");
+    if(data->len > 0) {
+        fputc('[', out_file);
+        // write all but the last byte, to avoid adding an extra comma
+        for(size_t i = 0; i < data->len - 1; i++) {
+            fprintf(out_file, "%hhu, ", data->bytes[i]);
+        }
+        fprintf(out_file, "%d]\n", data->bytes[data->len - 1]);
+    }
+}
+
+void write_bin(FILE *out_file, const InstIR *ir, const DataImage *data) {
+    fprintf(out_file, BIN_CODE_HEADER);
+    for(size_t i = 0; i < ir->len; i++) write_bin_word(out_file, ir->opcode[i]);
+    write_bin_data(out_file, data);
+}
+
+bool read_bin(const char *path, uint16_t *code, size_t *code_len, size_t code_cap, uint8_t *data, size_t *data_len, size_t data_cap) {
+    char *buf = NULL;
+    size_t cap = 0, len;
+    if(!read_file(path, &buf, &cap, &len)) {
+        free(buf);
+        return false;
+    }
+
+    *code_len = 0;
+    *data_len = 0;
+    bool ok = false;
+
+    char *s = strstr(buf, "-----MACHINE CODE-----");
+    if(s == NULL) goto done;
+
+    // one instruction per line, the bits may be grouped with underscores, up to the blank line before the data
+    for(s = strchr(s, '\n'); s != NULL && s[1] != '\0' && s[1] != '-'; s = strchr(s, '\n')) {
+        s++;
+        uint16_t word = 0;
+        int bits = 0;
+        for(; *s != '\n' && *s != '\0'; s++) {
+            if(*s == '0' || *s == '1') {
+                word = (word << 1) | (*s - '0');
+                bits++;
+            } else if(*s != '_' && *s != '\r') {
+                goto done;
+            }
+        }
+        if(bits == 0) break;
+        if(bits != 16 || *code_len == code_cap) goto done;
+        code[(*code_len)++] = word;
+    }
+
+    s = strstr(buf, "-----DATA SEGMENT-----");
+    if(s == NULL) goto done;
+    s = strchr(s, '[');
+    // an empty data segment has no list at all
+    while(s != NULL && *s != ']') {
+        char *end;
+        long val = strtol(s + 1, &end, 10);
+        if(end == s + 1 || val < -128 || val > 255 || *data_len == data_cap) goto done;
+        data[(*data_len)++] = (uint8_t) val;
+        s = end;
+        while(*s == ' ') s++;
+        if(*s != ',' && *s != ']') goto done;
+    }
+
+    ok = true;
+
+done:
+    if(!ok) printf("%s is not a valid .bin file, or does not fit in memory\n", path);
+    free(buf);
+    return ok;
+}
+
+void write_disassembly(FILE *out_file, const uint16_t *code, size_t code_len, const uint8_t *data, size_t data_len) {
+    if(data_len > 0) {
+        fprintf(out_file, ".data\n");
+        fprintf(out_file, "data BYTE ");
+        for(size_t i = 0; i < data_len; i++) fprintf(out_file, i + 1 < data_len ? "%d, " : "%d\n", (int8_t) data[i]);
+        fputc('\n', out_file);
+    }
+
+    fprintf(out_file, ".code\n");
+    for(size_t i = 0; i < code_len; i++) {
+        char text[32];
+        isa_disassemble(code[i], text, sizeof(text));
+        fprintf(out_file, "    %-24s ; %2zu: 0x%04X\n", text, i, code[i]);
+    }
+}
+
+// Altera memory initialization file, runs of unused words are collapsed into one [start..end] range
+static void write_mif(FILE *out_file, const Memory *mem) {
+    fprintf(out_file, "-- i281 %s segment\n", mem->name);
+    fprintf(out_file, "WIDTH=%d;\n", mem->width);
+    fprintf(out_file, "DEPTH=%zu;\n\n", mem->depth);
+    fprintf(out_file, "ADDRESS_RADIX=UNS;\n");
+    fprintf(out_file, "DATA_RADIX=BIN;\n\n");
+    fprintf(out_file, "CONTENT BEGIN\n");
+
+    size_t used = mem->len < mem->depth ? mem->len : mem->depth;
+    for(size_t i = 0; i < used; i++) {
+        fprintf(out_file, "    %zu : ", i);
+        put_bits(out_file, mem_word(mem, i), mem->width);
+        fprintf(out_file, ";\n");
+    }
+    if(used + 1 < mem->depth) fprintf(out_file, "    [%zu..%zu] : ", used, mem->depth - 1);
+    else if(used < mem->depth) fprintf(out_file, "    %zu : ", used);
+    if(used < mem->depth) {
+        put_bits(out_file, 0, mem->width);
+        fprintf(out_file, ";\n");
+    }
+
+    fprintf(out_file, "END;\n");
+}
+
+// Xilinx coefficient file, the vector is separated by commas and ends with a semicolon
+static void write_coe(FILE *out_file, const Memory *mem) {
+    fprintf(out_file, "; i281 %s segment, %zu words of %d bits\n", mem->name, mem->depth, mem->width);
+    fprintf(out_file, "memory_initialization_radix=2;\n");
+    fprintf(out_file, "memory_initialization_vector=\n");
+    for(size_t i = 0; i < mem->depth; i++) {
+        put_bits(out_file, mem_word(mem, i), mem->width);
+        fputs(i + 1 < mem->depth ? ",\n" : ";\n", out_file);
+    }
+}
+
+// one word per line for $readmemb
+static void write_memb(FILE *out_file, const Memory *mem) {
+    fprintf(out_file, "// i281 %s segment, %zu words of %d bits\n", mem->name, mem->depth, mem->width);
+    for(size_t i = 0; i < mem->depth; i++) {
+        put_bits(out_file, mem_word(mem, i), mem->width);
+        fputc('\n', out_file);
+    }
+}
+
+// one word per line for $readmemh
+static void write_memh(FILE *out_file, const Memory *mem) {
+    fprintf(out_file, "// i281 %s segment, %zu words of %d bits\n", mem->name, mem->depth, mem->width);
+    int digits = (mem->width + 3) / 4;
+    for(size_t i = 0; i < mem->depth; i++) fprintf(out_file, "%0*X\n", digits, mem_word(mem, i));
+}
+
+typedef void (*MemWriter)(FILE *out_file, const Memory *mem);
+
+typedef struct {
+    unsigned format;
+    const char *ext;
+    MemWriter write;
+} MemFormat;
+
+static const MemFormat mem_formats[] = {
+    {OUT_MIF, ".mif", write_mif},
+    {OUT_COE, ".coe", write_coe},
+    {OUT_MEMB, ".mem", write_memb},
+    {OUT_MEMH, ".hex", write_memh}
+};
+
+#define NUM_MEM_FORMATS (sizeof(mem_formats) / sizeof(mem_formats[0]))
+
+typedef void (*BuildFn)(FILE *out_file, const void *ctx);
+
+// builds the file in memory first so it is only touched when its contents actually change
+static int emit(const char *filename, BuildFn build, const void *ctx, bool verbose) {
+    char *out_data;
+    size_t out_len;
+    FILE *out_file = open_memstream(&out_data, &out_len);
+    if(out_file == NULL) {
+        printf("Error allocating memory\n");
+        return -1;
+    }
+    build(out_file, ctx);
+    fclose(out_file);
+
+    int written = write_file_if_changed(filename, out_data, out_len);
+    if(written < 0) ;
+    else if(!verbose) ;
+    else if(written > 0) printf("Wrote output to %s\n", filename);
+    else printf("Output %s is up to date\n", filename);
+
+    free(out_data);
+    return written < 0 ? -1 : 0;
+}
+
+typedef struct {
+    const InstIR *ir;
+    const DataImage *data;
+} BinCtx;
+
+static void build_bin(FILE *out_file, const void *ctx) {
+    const BinCtx *bin = ctx;
+    write_bin(out_file, bin->ir, bin->data);
+}
+
+typedef struct {
+    const MemFormat *format;
+    const Memory *mem;
+} MemCtx;
+
+static void build_mem(FILE *out_file, const void *ctx) {
+    const MemCtx *mem = ctx;
+    mem->format->write(out_file, mem->mem);
+}
+
+// length of the part of path the outputs are named after, everything before the .asm extension
+static size_t output_base_len(const char *path) {
+    const char *ext = strstr(path, ".asm");
+    return ext != NULL ? (size_t) (ext - path) : strlen(path);
+}
+
+int write_outputs(const char *path, unsigned formats, const InstIR *ir, const DataImage *data, bool verbose) {
+    // room for the longest suffix, "_code.mif"
+    size_t base_len = output_base_len(path);
+    char *filename = malloc(sizeof(char) * (base_len + 16));
+    if(filename == NULL) {
+        printf("Error allocating memory\n");
+        return -1;
+    }
+    memcpy(filename, path, base_len);
+
+    int result = 0;
+
+    if(formats & OUT_BIN) {
+        strcpy(filename + base_len, ".bin");
+        BinCtx ctx = {ir, data};
+        if(emit(filename, build_bin, &ctx, verbose) < 0) result = -1;
+    }
+
+    // the memories are padded out to the size of the hardware, unless the program is already larger than that
+    Memory mems[2] = {
+        {"code", 16, ir->len > CSEG_SIZE ? ir->len : CSEG_SIZE, ir->len, ir->opcode, NULL},
+        {"data", 8, data->len > DSEG_SIZE ? data->len : DSEG_SIZE, data->len, NULL, data->bytes}
+    };
+
+    for(size_t f = 0; f < NUM_MEM_FORMATS; f++) {
+        if(!(formats & mem_formats[f].format)) continue;
+        for(int m = 0; m < 2; m++) {
+            sprintf(filename + base_len, "_%s%s", mems[m].name, mem_formats[f].ext);
+            MemCtx ctx = {&mem_formats[f], &mems[m]};
+            if(emit(filename, build_mem, &ctx, verbose) < 0) result = -1;
+        }
+    }
+
+    free(filename);
+    return result;
+}
+
+// writes a file name for make, which splits on spaces and treats # and $ specially
+static void write_make_path(FILE *out_file, const char *path, size_t len) {
+    for(const char *c = path; c < path + len; c++) {
+        if(*c == ' ' || *c == '#') fputc('\\', out_file);
+        else if(*c == '$') fputc('$', out_file);
+        fputc(*c, out_file);
+    }
+}
+
+typedef struct {
+    const char *path;
+    unsigned formats;
+    const char *const *inputs;
+    int num_inputs;
+} DepCtx;
+
+static void build_deps(FILE *out_file, const void *ctx) {
+    const DepCtx *deps = ctx;
+    size_t base_len = output_base_len(deps->path);
+    static const char *mem_names[2] = {"code", "data"};
+
+    // the same names write_outputs gives the files
+    if(deps->formats & OUT_BIN) {
+        write_make_path(out_file, deps->path, base_len);
+        fprintf(out_file, ".bin ");
+    }
+    for(size_t f = 0; f < NUM_MEM_FORMATS; f++) {
+        if(!(deps->formats & mem_formats[f].format)) continue;
+        for(int m = 0; m < 2; m++) {
+            write_make_path(out_file, deps->path, base_len);
+            fprintf(out_file, "_%s%s ", mem_names[m], mem_formats[f].ext);
+        }
+    }
+    fputc(':', out_file);
+    for(int i = 0; i < deps->num_inputs; i++) {
+        fputc(' ', out_file);
+        write_make_path(out_file, deps->inputs[i], strlen(deps->inputs[i]));
+    }
+    fputc('\n', out_file);
+
+    // like gcc -MP, an empty rule for everything but the source keeps make going if one of them is deleted
+    for(int i = 1; i < deps->num_inputs; i++) {
+        fputc('\n', out_file);
+        write_make_path(out_file, deps->inputs[i], strlen(deps->inputs[i]));
+        fprintf(out_file, ":\n");
+    }
+}
+
+int write_depfile(const char *path, const char *dep_path, unsigned formats, const char *const *inputs, int num_inputs, bool verbose) {
+    char *filename = NULL;
+    if(dep_path == NULL) {
+        size_t base_len = output_base_len(path);
+        filename = malloc(base_len + 3);
+        if(filename == NULL) {
+            printf("Error allocating memory\n");
+            return -1;
+        }
+        memcpy(filename, path, base_len);
+        strcpy(filename + base_len, ".d");
+        dep_path = filename;
+    }
+
+    DepCtx ctx = {path, formats, inputs, num_inputs};
+    int result = emit(dep_path, build_deps, &ctx, verbose);
+    free(filename);
+    return result;
+}
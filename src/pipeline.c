@@ -0,0 +1,537 @@
+#include "pipeline.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include "instructions.h"
+#include "data.h"
+#include "scan.h"
+#include "fileio.h"
+#include "output.h"
+
+#define STREAM_CHUNK (64 * 1024) // bytes the read stage asks for at a time
+#define STREAM_DEPTH 4 // items a queue holds before its producer has to wait
+#define WORD_BATCH 1024 // encoded instructions handed to the write stage at a time
+
+// a bounded queue between two stages, pop returns NULL once the queue is closed and empty
+typedef struct {
+    void *items[STREAM_DEPTH];
+    int head;
+    int len;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} Queue;
+
+static void queue_init(Queue *q) {
+    q->head = 0;
+    q->len = 0;
+    q->closed = false;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void queue_destroy(Queue *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+static void queue_push(Queue *q, void *item) {
+    pthread_mutex_lock(&q->lock);
+    while(q->len == STREAM_DEPTH) pthread_cond_wait(&q->not_full, &q->lock);
+    q->items[(q->head + q->len) % STREAM_DEPTH] = item;
+    q->len++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void *queue_pop(Queue *q) {
+    pthread_mutex_lock(&q->lock);
+    while(q->len == 0 && !q->closed) pthread_cond_wait(&q->not_empty, &q->lock);
+
+    void *item = NULL;
+    if(q->len > 0) {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % STREAM_DEPTH;
+        q->len--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+static void queue_close(Queue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// complete lines from the read stage
+typedef struct {
+    char *text; // null terminated
+    size_t len;
+    int first_line; // line number of the first line, starting at 1
+} Chunk;
+
+typedef enum {
+    STMT_EQU,
+    STMT_DATA,
+    STMT_CODE
+} StmtKind;
+
+typedef struct {
+    StmtKind kind;
+    int line_num;
+    char *text; // the line with its comment cut off, pointing into the chunk
+    int32_t colon; // the ':' ending a code label, or SCAN_NONE
+} Stmt;
+
+// the lexed lines of one chunk, which owns the text they point into
+typedef struct {
+    Chunk *chunk;
+    Stmt *stmts;
+    int len;
+} StmtBatch;
+
+typedef struct {
+    uint16_t words[WORD_BATCH];
+    int len;
+} WordBatch;
+
+// state shared by the stages, each flag is only set by the stage it belongs to and read once every stage has finished
+typedef struct {
+    FILE *in;
+    FILE *out;
+    Queue chunks; // read to lex
+    Queue batches; // lex to encode
+    Queue words; // encode to write
+    bool read_failed;
+    bool lex_failed;
+    bool write_failed;
+} Stream;
+
+static void free_batch(StmtBatch *batch) {
+    free(batch->chunk->text);
+    free(batch->chunk);
+    free(batch->stmts);
+    free(batch);
+}
+
+static void *read_stage(void *arg) {
+    Stream *st = arg;
+    size_t cap = STREAM_CHUNK + 1;
+    char *buf = malloc(cap);
+    size_t len = 0;
+    int line_num = 1;
+
+    bool eof = false;
+    while(buf != NULL && !eof) {
+        // a line longer than a chunk keeps growing the buffer until its newline turns up
+        if(cap < len + STREAM_CHUNK + 1) {
+            char *grown = realloc(buf, len + STREAM_CHUNK + 1);
+            if(grown == NULL) break;
+            buf = grown;
+            cap = len + STREAM_CHUNK + 1;
+        }
+
+        size_t n = fread(buf + len, sizeof(char), STREAM_CHUNK, st->in);
+        len += n;
+        if(n < STREAM_CHUNK) {
+            if(ferror(st->in)) st->read_failed = true;
+            eof = true;
+        }
+
+        // everything up to the last newline is passed on, the partial line after it waits for the next read
+        size_t end = len;
+        if(!eof) {
+            while(end > 0 && buf[end - 1] != '\n') end--;
+        }
+        if(end == 0) continue;
+
+        char *rest = malloc(len - end + STREAM_CHUNK + 1);
+        Chunk *chunk = malloc(sizeof(Chunk));
+        if(rest == NULL || chunk == NULL) {
+            free(rest);
+            free(chunk);
+            break;
+        }
+        memcpy(rest, buf + end, len - end);
+        buf[end] = '\0';
+
+        chunk->text = buf;
+        chunk->len = end;
+        chunk->first_line = line_num;
+        for(size_t i = 0; i < end; i++) {
+            if(buf[i] == '\n') line_num++;
+        }
+        queue_push(&st->chunks, chunk);
+
+        buf = rest;
+        cap = len - end + STREAM_CHUNK + 1;
+        len -= end;
+    }
+
+    if(!eof) {
+        printf("Error allocating memory\n");
+        st->read_failed = true;
+    }
+    free(buf);
+    queue_close(&st->chunks);
+    return NULL;
+}
+
+static void *lex_stage(void *arg) {
+    Stream *st = arg;
+    ScanResult scan = {0};
+    enum {SEG_NONE, SEG_DATA, SEG_CODE} segment = SEG_NONE;
+
+    Chunk *chunk;
+    while((chunk = queue_pop(&st->chunks)) != NULL) {
+        StmtBatch *batch = malloc(sizeof(StmtBatch));
+        if(batch == NULL || !scan_source(chunk->text, chunk->len, &scan) ||
+           (batch->stmts = malloc(sizeof(Stmt) * (scan.num_lines + 1))) == NULL) {
+            // the chunk is dropped, the rest are still taken off the queue so the read stage never blocks
+            if(!st->lex_failed) printf("Error allocating memory\n");
+            st->lex_failed = true;
+            free(batch);
+            free(chunk->text);
+            free(chunk);
+            continue;
+        }
+        batch->chunk = chunk;
+        batch->len = 0;
+
+        for(int i = 0; i < scan.num_lines; i++) {
+            const ScanLine *line = &scan.lines[i];
+            char *text = chunk->text + line->start;
+            text[line->comment != SCAN_NONE ? (size_t) line->comment : line->len] = '\0';
+
+            StmtKind kind;
+            if(strncmp(text, ".data", 5) == 0) {
+                segment = SEG_DATA;
+                continue;
+            } else if(strncmp(text, ".code", 5) == 0) {
+                segment = SEG_CODE;
+                continue;
+            } else if(is_equ(text)) {
+                kind = STMT_EQU;
+            } else if(segment == SEG_NONE || is_blank(text)) {
+                continue;
+            } else {
+                kind = segment == SEG_DATA ? STMT_DATA : STMT_CODE;
+            }
+
+            batch->stmts[batch->len++] = (Stmt) {kind, chunk->first_line + i, text, line->colon};
+        }
+        queue_push(&st->batches, batch);
+    }
+
+    free_scan(&scan);
+    queue_close(&st->batches);
+    return NULL;
+}
+
+static void *write_stage(void *arg) {
+    Stream *st = arg;
+    if(fputs(BIN_CODE_HEADER, st->out) == EOF) st->write_failed = true;
+
+    WordBatch *batch;
+    while((batch = queue_pop(&st->words)) != NULL) {
+        for(int i = 0; i < batch->len; i++) write_bin_word(st->out, batch->words[i]);
+        if(ferror(st->out)) st->write_failed = true;
+        free(batch);
+    }
+    return NULL;
+}
+
+// an instruction that named a symbol before it was defined, encoded again once the whole file has been read
+typedef struct {
+    int pc;
+    int line_num;
+    char *text;
+} Fixup;
+
+typedef struct {
+    SymbolTable syms;
+    DataImage data;
+    DiagList diags;
+    DiagList scratch; // errors of the current instruction, kept until it is clear they are not a forward reference
+    Fixup *fixups;
+    int num_fixups;
+    int fixups_cap;
+    int pc;
+    int num_labels;
+    int num_dests;
+    int full_line; // first instruction past the end of code memory, for the warning
+    int full_col;
+    bool no_memory;
+} Encoder;
+
+// encodes the instruction on the line, errors are replaced by a NOOP like in the regular assembler
+// unless final is set, an instruction that names an undefined symbol reports nothing and sets *deferred instead
+static uint16_t encode(Encoder *enc, char *text, int line_num, int pc, bool final, bool *deferred) {
+    const char *mnemonic = text + strspn(text, " \t\r");
+    size_t mnemonic_len = strcspn(mnemonic, " \t\r");
+
+    InstId id = find_instruction(mnemonic, mnemonic_len);
+    if(id == INST_INVALID) {
+        diag_report(&enc->diags, DIAG_ERROR, E_UNKNOWN_INST, line_num, (int) (mnemonic - text) + 1, "Invalid instruction \"%.*s\"", (int) mnemonic_len, mnemonic);
+        return 0x0000;
+    }
+
+    diag_clear(&enc->scratch);
+    ParseContext ctx = {&enc->syms, pc, -1, text, final ? &enc->diags : &enc->scratch, false};
+    ParsedInstruction inst;
+    if(parse_instruction(id, text, line_num, &ctx, &inst)) return inst.opcode;
+
+    if(!final && ctx.undefined) {
+        *deferred = true;
+    } else {
+        diag_append(&enc->diags, &enc->scratch);
+    }
+    return 0x0000;
+}
+
+// defines the label on the line and encodes its instruction, returns false if the line holds only a label
+static bool encode_code(Encoder *enc, Stmt *stmt, uint16_t *word) {
+    char *text = stmt->text;
+
+    // the label takes the address of the instruction on its line, or of the next one if the line holds nothing else
+    if(stmt->colon != SCAN_NONE) {
+        char *name = text + strspn(text, " \t");
+        size_t label_len = text + stmt->colon - name;
+        while(label_len > 0 && (name[label_len - 1] == ' ' || name[label_len - 1] == '\t')) label_len--;
+
+        if(!add_symbol(&enc->syms, name, label_len, enc->pc, SYM_CODE)) {
+            diag_report(&enc->diags, DIAG_ERROR, E_DUP_SYMBOL, stmt->line_num, (int) (name - text) + 1, "Label %.*s is already defined", (int) label_len, name);
+        } else {
+            enc->num_dests++;
+        }
+        memset(text, ' ', stmt->colon + 1);
+    }
+
+    if(is_blank(text)) return false;
+
+    if(enc->pc == CSEG_SIZE) {
+        enc->full_line = stmt->line_num;
+        enc->full_col = (int) strspn(text, " \t") + 1;
+    }
+
+    bool deferred = false;
+    *word = encode(enc, text, stmt->line_num, enc->pc, false, &deferred);
+    if(deferred) {
+        if(enc->num_fixups == enc->fixups_cap) {
+            int cap = enc->fixups_cap == 0 ? 64 : enc->fixups_cap * 2;
+            Fixup *grown = realloc(enc->fixups, sizeof(Fixup) * cap);
+            if(grown == NULL) {
+                enc->no_memory = true;
+                return true;
+            }
+            enc->fixups = grown;
+            enc->fixups_cap = cap;
+        }
+
+        Fixup *fixup = &enc->fixups[enc->num_fixups];
+        fixup->text = strdup(text);
+        if(fixup->text == NULL) {
+            enc->no_memory = true;
+            return true;
+        }
+        fixup->pc = enc->pc;
+        fixup->line_num = stmt->line_num;
+        enc->num_fixups++;
+    }
+    enc->pc++;
+    return true;
+}
+
+static void encode_stage(Stream *st, Encoder *enc) {
+    WordBatch *words = NULL;
+
+    StmtBatch *batch;
+    while((batch = queue_pop(&st->batches)) != NULL) {
+        for(int i = 0; i < batch->len && !enc->no_memory; i++) {
+            Stmt *stmt = &batch->stmts[i];
+            switch(stmt->kind) {
+                case STMT_EQU:
+                    parse_equ_line(stmt->text, stmt->line_num, &enc->syms, &enc->diags);
+                    break;
+
+                case STMT_DATA:
+                    enc->num_labels += parse_data_line(stmt->text, stmt->line_num, &enc->syms, &enc->data, DSEG_SIZE, &enc->diags);
+                    break;
+
+                case STMT_CODE: {
+                    uint16_t word;
+                    if(!encode_code(enc, stmt, &word)) break;
+
+                    if(words == NULL) {
+                        words = malloc(sizeof(WordBatch));
+                        if(words == NULL) {
+                            enc->no_memory = true;
+                            break;
+                        }
+                        words->len = 0;
+                    }
+                    words->words[words->len++] = word;
+                    if(words->len == WORD_BATCH) {
+                        queue_push(&st->words, words);
+                        words = NULL;
+                    }
+                    break;
+                }
+            }
+        }
+        free_batch(batch);
+    }
+
+    if(words != NULL && words->len > 0) queue_push(&st->words, words);
+    else free(words);
+    queue_close(&st->words);
+}
+
+// opens the streams and runs the stages, the temporary output is left open in st->out for the fixups
+static bool run_stages(Stream *st, Encoder *enc) {
+    pthread_t reader, lexer, writer;
+    queue_init(&st->chunks);
+    queue_init(&st->batches);
+    queue_init(&st->words);
+
+    bool started = pthread_create(&reader, NULL, read_stage, st) == 0;
+    bool lexing = started && pthread_create(&lexer, NULL, lex_stage, st) == 0;
+    bool writing = lexing && pthread_create(&writer, NULL, write_stage, st) == 0;
+
+    if(writing) {
+        // the encoder runs on this thread, it owns the symbol table so nothing else has to lock it
+        encode_stage(st, enc);
+    } else {
+        printf("Error starting the pipeline threads\n");
+        // whatever did start is unblocked by closing its queues and draining the ones it fills
+        queue_close(&st->words);
+        if(started) {
+            void *item;
+            if(lexing) {
+                while((item = queue_pop(&st->batches)) != NULL) free_batch(item);
+            } else {
+                while((item = queue_pop(&st->chunks)) != NULL) {
+                    free(((Chunk *) item)->text);
+                    free(item);
+                }
+            }
+        }
+    }
+
+    if(writing) pthread_join(writer, NULL);
+    if(lexing) pthread_join(lexer, NULL);
+    if(started) pthread_join(reader, NULL);
+
+    queue_destroy(&st->chunks);
+    queue_destroy(&st->batches);
+    queue_destroy(&st->words);
+    return writing;
+}
+
+int assemble_stream(const char *path, bool diag_json) {
+    bool verbose = !diag_json;
+
+    Stream st = {0};
+    st.in = fopen(path, "r");
+    if(st.in == NULL) {
+        printf("Error occured opening file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // the output is named like the regular .bin file and only replaces it once it is complete
+    size_t base_len = strlen(path);
+    const char *ext = strstr(path, ".asm");
+    if(ext != NULL) base_len = ext - path;
+    char *filename = malloc(sizeof(char) * (base_len + 5));
+    if(filename == NULL) {
+        printf("Error allocating memory\n");
+        fclose(st.in);
+        return -1;
+    }
+    memcpy(filename, path, base_len);
+    strcpy(filename + base_len, ".bin");
+
+    char *tmp_path = temp_path(filename);
+    st.out = tmp_path != NULL ? fopen(tmp_path, "w+") : NULL;
+    if(st.out == NULL) {
+        printf("Error occured opening file %s: %s\n", tmp_path, strerror(errno));
+        fclose(st.in);
+        free(tmp_path);
+        free(filename);
+        return -1;
+    }
+    // one large buffer so the write stage hands the kernel big blocks
+    setvbuf(st.out, NULL, _IOFBF, STREAM_CHUNK);
+
+    Encoder enc = {0};
+    init_symbols(&enc.syms);
+    data_init(&enc.data);
+    diag_init(&enc.diags, path);
+    diag_init(&enc.scratch, path);
+
+    int result = 0;
+    if(!run_stages(&st, &enc) || st.read_failed || st.lex_failed || st.write_failed || enc.no_memory) {
+        if(st.read_failed) printf("Error reading file %s\n", path);
+        if(enc.no_memory) printf("Error allocating memory\n");
+        result = -1;
+    }
+
+    // every symbol is known now, so the fixups either encode or report their real error
+    long header_len = (long) strlen(BIN_CODE_HEADER);
+    for(int i = 0; i < enc.num_fixups; i++) {
+        Fixup *fixup = &enc.fixups[i];
+        uint16_t word = encode(&enc, fixup->text, fixup->line_num, fixup->pc, true, NULL);
+        if(result == 0 && word != 0x0000) {
+            fseek(st.out, header_len + (long) fixup->pc * BIN_WORD_LEN, SEEK_SET);
+            write_bin_word(st.out, word);
+        }
+        free(fixup->text);
+    }
+
+    if(verbose && result == 0) {
+        printf("Read %d labels from data segment\n", enc.num_labels);
+        printf("Parsed %d branch destinations\n", enc.num_dests);
+        printf("Parsed %d instructions, %d with forward references\n", enc.pc, enc.num_fixups);
+    }
+
+    if(enc.pc > CSEG_SIZE) diag_report(&enc.diags, DIAG_WARNING, W_CSEG_FULL, enc.full_line, enc.full_col, "%d instructions do not fit in the %d word code segment", enc.pc, CSEG_SIZE);
+    diag_print(&enc.diags, stdout, diag_json);
+    if(enc.diags.errors > 0) result = -1;
+
+    if(result == 0) {
+        fseek(st.out, 0, SEEK_END);
+        write_bin_data(st.out, &enc.data);
+    }
+
+    bool closed = fclose(st.out) == 0;
+    fclose(st.in);
+    if(result == 0 && !closed) {
+        printf("Error writing file %s: %s\n", filename, strerror(errno));
+        result = -1;
+    }
+
+    if(result == 0) {
+        int written = replace_file_if_changed(tmp_path, filename);
+        if(written < 0) result = -1;
+        else if(!verbose) ;
+        else if(written > 0) printf("Wrote output to %s\n", filename);
+        else printf("Output %s is up to date\n", filename);
+    } else {
+        remove(tmp_path);
+    }
+
+    free(enc.fixups);
+    free_symbols(&enc.syms);
+    data_free(&enc.data);
+    diag_free(&enc.diags);
+    diag_free(&enc.scratch);
+    free(tmp_path);
+    free(filename);
+    return result;
+}
@@ -0,0 +1,200 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+// the scan works on 64-byte blocks, producing one bit per byte for every structure character
+#define SCAN_BLOCK 64
+
+// quotes are structure characters too, so the delimiters inside string and character literals can be skipped
+static inline bool is_structural(char c) {
+    return c == '\n' || c == ';' || c == ':' || c == '[' || c == ',' || c == '"' || c == '\'';
+}
+
+static uint64_t block_mask_scalar(const char *block) {
+    uint64_t mask = 0;
+    for(int i = 0; i < SCAN_BLOCK; i++) {
+        if(is_structural(block[i])) mask |= (uint64_t) 1 << i;
+    }
+    return mask;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static uint64_t block_mask_sse2(const char *block) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i semi = _mm_set1_epi8(';');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i bracket = _mm_set1_epi8('[');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i dquote = _mm_set1_epi8('"');
+    const __m128i squote = _mm_set1_epi8('\'');
+
+    uint64_t mask = 0;
+    for(int i = 0; i < SCAN_BLOCK; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (block + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, semi)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, bracket)));
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, comma),
+                                             _mm_or_si128(_mm_cmpeq_epi8(v, dquote), _mm_cmpeq_epi8(v, squote))));
+        mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(hit) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t block_mask_avx2(const char *block) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i semi = _mm256_set1_epi8(';');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i bracket = _mm256_set1_epi8('[');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i dquote = _mm256_set1_epi8('"');
+    const __m256i squote = _mm256_set1_epi8('\'');
+
+    uint64_t mask = 0;
+    for(int i = 0; i < SCAN_BLOCK; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (block + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, semi)),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, bracket)));
+        hit = _mm256_or_si256(hit, _mm256_or_si256(_mm256_cmpeq_epi8(v, comma),
+                                                   _mm256_or_si256(_mm256_cmpeq_epi8(v, dquote), _mm256_cmpeq_epi8(v, squote))));
+        mask |= (uint64_t) (uint32_t) _mm256_movemask_epi8(hit) << i;
+    }
+    return mask;
+}
+#endif
+
+typedef uint64_t (*BlockMaskFn)(const char *block);
+
+// picks the widest implementation the running CPU supports
+static BlockMaskFn select_block_mask(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return block_mask_avx2;
+    if(__builtin_cpu_supports("sse2")) return block_mask_sse2;
+#endif
+    return block_mask_scalar;
+}
+
+static void reset_line(ScanLine *line, size_t start) {
+    line->start = start;
+    line->len = 0;
+    line->comment = SCAN_NONE;
+    line->colon = SCAN_NONE;
+    line->bracket = SCAN_NONE;
+    line->comma = SCAN_NONE;
+}
+
+// checks whether the quote at pos is escaped, which takes an odd number of backslashes in front of it
+static bool is_escaped(const char *buf, size_t line_start, size_t pos) {
+    size_t backslashes = 0;
+    while(pos - backslashes > line_start && buf[pos - backslashes - 1] == '\\') backslashes++;
+    return backslashes % 2 == 1;
+}
+
+// records the structure character at pos in the current line
+static bool add_structural(const char *buf, size_t pos, ScanResult *res) {
+    ScanLine *line = &res->lines[res->num_lines];
+    int32_t col = (int32_t) (pos - line->start);
+
+    // inside a literal only the newline, which ends it along with the line, and the closing quote count
+    if(res->quote != '\0' && buf[pos] != '\n') {
+        if(buf[pos] == res->quote && !is_escaped(buf, line->start, pos)) res->quote = '\0';
+        return true;
+    }
+
+    switch(buf[pos]) {
+        case '\n':
+            res->quote = '\0';
+            line->len = pos - line->start;
+            res->num_lines++;
+            if(res->num_lines == res->lines_cap) {
+                ScanLine *grown = realloc(res->lines, sizeof(ScanLine) * res->lines_cap * 2);
+                if(grown == NULL) return false;
+                res->lines = grown;
+                res->lines_cap *= 2;
+            }
+            reset_line(&res->lines[res->num_lines], pos + 1);
+            return true;
+
+        case ';':
+            if(line->comment == SCAN_NONE) line->comment = col;
+            return true;
+    }
+
+    // anything after the comment start belongs to the comment
+    if(line->comment != SCAN_NONE) return true;
+
+    switch(buf[pos]) {
+        case '"':
+        case '\'':
+            res->quote = buf[pos];
+            break;
+
+        case ':':
+            if(line->colon == SCAN_NONE) line->colon = col;
+            break;
+
+        case '[':
+            if(line->bracket == SCAN_NONE) line->bracket = col;
+            break;
+
+        case ',':
+            if(line->comma == SCAN_NONE) line->comma = col;
+            break;
+    }
+
+    return true;
+}
+
+bool scan_source(const char *buf, size_t len, ScanResult *res) {
+    if(res->lines == NULL) {
+        res->lines_cap = 64;
+        res->lines = malloc(sizeof(ScanLine) * res->lines_cap);
+        if(res->lines == NULL) return false;
+    }
+    res->num_lines = 0;
+    res->quote = '\0';
+    reset_line(&res->lines[0], 0);
+
+    BlockMaskFn block_mask = select_block_mask();
+
+    size_t pos = 0;
+    for(; pos + SCAN_BLOCK <= len; pos += SCAN_BLOCK) {
+        uint64_t mask = block_mask(buf + pos);
+        // visit each set bit, lowest first
+        while(mask != 0) {
+            if(!add_structural(buf, pos + __builtin_ctzll(mask), res)) return false;
+            mask &= mask - 1;
+        }
+    }
+
+    // the tail is shorter than a block, so it is finished off one byte at a time
+    for(; pos < len; pos++) {
+        if(is_structural(buf[pos]) && !add_structural(buf, pos, res)) return false;
+    }
+
+    // a last line without a trailing newline still counts
+    ScanLine *last = &res->lines[res->num_lines];
+    if(last->start < len) {
+        last->len = len - last->start;
+        res->num_lines++;
+    }
+
+    return true;
+}
+
+void free_scan(ScanResult *res) {
+    free(res->lines);
+    res->lines = NULL;
+    res->num_lines = 0;
+    res->lines_cap = 0;
+}
+
+bool is_blank(const char *line) {
+    while(*line == ' ' || *line == '\t' || *line == '\r') line++;
+    return *line == '\0';
+}
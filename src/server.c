@@ -0,0 +1,561 @@
+#include "server.h"
+
+#include <ctype.h>
+#include <time.h>
+#include "data.h"
+#include "fileio.h"
+#include "instructions.h"
+#include "scan.h"
+
+// what the passes make of a line, a line can be in both segments when the code segment is declared first
+#define LINE_DATA 0x1 // a declaration in the data segment
+#define LINE_CODE 0x2 // in the code segment, where it may hold a label and an instruction
+#define LINE_EQU 0x4 // a .equ directive, which is neither data nor code wherever it is
+
+#define SEG_NONE -1
+
+static const char *segment_names[] = {".data", ".code"};
+
+typedef struct {
+    int start;
+    int len;
+} Span;
+
+typedef struct {
+    char *text; // the line without its comment, with any NUL bytes turned into spaces
+    char *code; // text with the label blanked out, which is what the instruction parser reads
+    int segment; // index in segment_names of the segment the line declares, or SEG_NONE
+    int colon; // from the scan of the line
+    int nul; // column of the first NUL byte the line held, or 0
+    unsigned kind; // LINE_* bits
+    bool blanked; // a repeated segment declaration, which the passes skip
+    int indent; // whitespace before the instruction
+    bool blank; // nothing is left once the label is blanked out, so the line takes up no address
+    InstId id; // the mnemonic, INST_INVALID if there is none or it is not an instruction
+    Span *idents; // names in the operands, which the line has to be encoded again for if they change
+    int num_idents;
+    int label_col; // column of the code label, or 0 if there is none
+    int label_len;
+    bool dup_label;
+    bool dirty; // the line changed since it was last encoded
+    int address; // -1 unless the line holds an instruction
+    uint16_t word;
+    DiagList data_diags; // from parsing the line as data or a constant, kept until it is parsed again
+    DiagList code_diags; // from encoding the instruction, kept until it is encoded again
+    int sent_address; // what the editor was last told
+    uint16_t sent_word;
+} EditLine;
+
+typedef struct {
+    EditLine *lines;
+    int num_lines;
+    int cap;
+    int data_line; // first declaration of each segment, -1 if there is none
+    int code_line;
+    SymbolTable syms; // constants and data labels, then code labels from num_data_syms on
+    int num_data_syms;
+    SymbolTable prev; // syms before the edit
+    SymbolTable moved; // names whose value changed in the edit, only the names matter
+    DataImage data;
+    ScanResult scan;
+    DiagList out;
+    char *path; // the file the document was opened from, printed with the diagnostics
+    int version;
+} Session;
+
+// the first line after the data segment
+static int data_end(const Session *s) {
+    return s->code_line > s->data_line ? s->code_line : s->num_lines;
+}
+
+// fills in the kind of line i from where the segments are
+static void classify(Session *s, int i) {
+    EditLine *line = &s->lines[i];
+    unsigned kind = 0;
+    if(line->blanked) kind = 0;
+    else if(is_equ(line->text)) kind = LINE_EQU;
+    else {
+        if(s->data_line >= 0 && i > s->data_line && i < data_end(s)) kind |= LINE_DATA;
+        if(s->code_line >= 0 && i > s->code_line) kind |= LINE_CODE;
+    }
+
+    // a line that is parsed differently now has to be encoded again
+    if(kind != line->kind) line->dirty = true;
+    line->kind = kind;
+}
+
+// the same split into tokens as eval_expr, so every name it could look up is found
+static bool find_idents(EditLine *line, const char *operands) {
+    line->num_idents = 0;
+    int cap = 0;
+    for(const char *c = operands; *c != '\0';) {
+        if(isdigit((unsigned char) *c)) {
+            while(isalnum((unsigned char) *c)) c++;
+            continue;
+        }
+        if(!isalpha((unsigned char) *c) && *c != '_' && *c != '.') {
+            c++;
+            continue;
+        }
+
+        const char *start = c;
+        while(isalnum((unsigned char) *c) || *c == '_' || *c == '.') c++;
+        if(line->num_idents == cap) {
+            cap = cap == 0 ? 4 : cap * 2;
+            Span *grown = realloc(line->idents, sizeof(Span) * cap);
+            if(grown == NULL) return false;
+            line->idents = grown;
+        }
+        line->idents[line->num_idents++] = (Span) {(int) (start - line->text), (int) (c - start)};
+    }
+    return true;
+}
+
+// lexes the len bytes at src into a new line, scan holds the structure characters found in them
+static bool init_line(EditLine *line, const char *src, size_t len, const ScanLine *scan) {
+    memset(line, 0, sizeof(EditLine));
+    diag_init(&line->data_diags, NULL);
+    diag_init(&line->code_diags, NULL);
+    line->address = line->sent_address = -1;
+    line->dirty = true;
+    line->segment = SEG_NONE;
+    line->colon = scan != NULL ? scan->colon : SCAN_NONE;
+
+    if(scan != NULL && scan->comment != SCAN_NONE) len = scan->comment;
+    line->text = malloc(len + 1);
+    line->code = malloc(len + 1);
+    if(line->text == NULL || line->code == NULL) return false;
+    memcpy(line->text, src, len);
+    line->text[len] = '\0';
+
+    // like the assembler, a NUL byte is reported and read as a space
+    for(char *nul = memchr(line->text, '\0', len); nul != NULL; nul = memchr(nul, '\0', line->text + len - nul)) {
+        if(line->nul == 0) line->nul = (int) (nul - line->text) + 1;
+        *nul = ' ';
+    }
+
+    for(int seg = 0; seg < 2; seg++) {
+        if(strncmp(line->text, segment_names[seg], strlen(segment_names[seg])) == 0) line->segment = seg;
+    }
+
+    // the label of a code line is blanked, leaving the instruction at its column
+    strcpy(line->code, line->text);
+    if(line->colon != SCAN_NONE) memset(line->code, ' ', line->colon + 1);
+    const char *mnemonic = line->code + strspn(line->code, " \t\r");
+    size_t mnemonic_len = strcspn(mnemonic, " \t\r");
+    line->indent = (int) strspn(line->code, " \t");
+    line->blank = mnemonic_len == 0;
+    line->id = mnemonic_len > 0 ? find_instruction(mnemonic, mnemonic_len) : INST_INVALID;
+
+    return find_idents(line, mnemonic + mnemonic_len);
+}
+
+static void free_line(EditLine *line) {
+    free(line->text);
+    free(line->code);
+    free(line->idents);
+    diag_free(&line->data_diags);
+    diag_free(&line->code_diags);
+}
+
+// finds the first declaration of each segment, the passes skip the ones after it
+static void find_segments(Session *s) {
+    s->data_line = s->code_line = -1;
+    for(int i = 0; i < s->num_lines; i++) {
+        EditLine *line = &s->lines[i];
+        int *first = line->segment == 0 ? &s->data_line : line->segment == 1 ? &s->code_line : NULL;
+        line->blanked = first != NULL && *first >= 0;
+        if(first != NULL && *first < 0) *first = i;
+    }
+    for(int i = 0; i < s->num_lines; i++) classify(s, i);
+}
+
+// parses the data segment and every constant again, in the order the assembler does
+static void parse_data(Session *s) {
+    clear_symbols(&s->syms);
+    data_clear(&s->data);
+
+    for(int i = 0; i < s->num_lines; i++) {
+        diag_clear(&s->lines[i].data_diags);
+    }
+
+    // constants in the data segment are defined along with the data, so they can use the labels above them
+    int end = data_end(s);
+    for(int i = s->data_line + 1; s->data_line >= 0 && i < end; i++) {
+        EditLine *line = &s->lines[i];
+        if(line->kind & LINE_EQU) {
+            strcpy(line->code, line->text);
+            parse_equ_line(line->code, i + 1, &s->syms, &line->data_diags);
+        } else if(line->kind & LINE_DATA) {
+            parse_data_line(line->text, i + 1, &s->syms, &s->data, DSEG_SIZE, &line->data_diags);
+        }
+    }
+
+    for(int i = 0; i < s->num_lines; i++) {
+        EditLine *line = &s->lines[i];
+        if(!(line->kind & LINE_EQU) || (s->data_line >= 0 && i > s->data_line && i < end)) continue;
+        strcpy(line->code, line->text);
+        parse_equ_line(line->code, i + 1, &s->syms, &line->data_diags);
+    }
+
+    s->num_data_syms = s->syms.len;
+}
+
+// defines the code labels at the addresses they have now
+static void place_labels(Session *s) {
+    truncate_symbols(&s->syms, s->num_data_syms);
+
+    // a label takes the address of the instruction after it, blank lines do not take up any space
+    int address = 0;
+    for(int i = 0; i < s->num_lines; i++) {
+        EditLine *line = &s->lines[i];
+        line->label_col = 0;
+        line->dup_label = false;
+        if(!(line->kind & LINE_CODE)) {
+            line->address = -1;
+            continue;
+        }
+
+        if(line->colon != SCAN_NONE) {
+            const char *c = line->text + line->colon;
+            const char *name = line->text;
+            while(name < c && (*name == ' ' || *name == '\t')) name++;
+            size_t label_len = c - name;
+            while(label_len > 0 && (name[label_len - 1] == ' ' || name[label_len - 1] == '\t')) label_len--;
+
+            line->label_col = (int) (name - line->text) + 1;
+            line->label_len = (int) label_len;
+            line->dup_label = !add_symbol(&s->syms, name, label_len, address, SYM_CODE);
+        }
+
+        int old = line->address;
+        line->address = !line->blank ? address++ : -1;
+
+        // a branch to a label is an offset from its own address
+        if(line->address != old && inst_table[line->id].pattern == PAT_OFFSET) line->dirty = true;
+    }
+}
+
+// collects the names defined differently now than before the edit
+static void find_moved(Session *s) {
+    clear_symbols(&s->moved);
+    for(int i = 0; i < s->syms.len; i++) {
+        const Symbol *sym = &s->syms.syms[i];
+        int j = find_symbol(&s->prev, sym->name, strlen(sym->name));
+        if(j < 0 || s->prev.syms[j].value != sym->value || s->prev.syms[j].kind != sym->kind) {
+            add_symbol(&s->moved, sym->name, strlen(sym->name), 0, sym->kind);
+        }
+    }
+    for(int i = 0; i < s->prev.len; i++) {
+        const Symbol *sym = &s->prev.syms[i];
+        if(find_symbol(&s->syms, sym->name, strlen(sym->name)) < 0) add_symbol(&s->moved, sym->name, strlen(sym->name), 0, sym->kind);
+    }
+}
+
+static bool names_moved(const Session *s, const EditLine *line) {
+    for(int k = 0; k < line->num_idents; k++) {
+        if(find_symbol(&s->moved, line->text + line->idents[k].start, line->idents[k].len) >= 0) return true;
+    }
+    return false;
+}
+
+// encodes the instruction on line i, the same as parse_cseg does
+static void encode_line(Session *s, int i) {
+    EditLine *line = &s->lines[i];
+    diag_clear(&line->code_diags);
+    line->dirty = false;
+
+    // the parser may write to the line, so it starts from a fresh copy every time
+    strcpy(line->code, line->text);
+    if(line->colon != SCAN_NONE) memset(line->code, ' ', line->colon + 1);
+
+    const char *mnemonic = line->code + strspn(line->code, " \t\r");
+    size_t mnemonic_len = strcspn(mnemonic, " \t\r");
+
+    ParseContext ctx;
+    ctx.syms = &s->syms;
+    ctx.diags = &line->code_diags;
+    ctx.pc = line->address;
+    ctx.sym_ref = -1;
+    ctx.line = line->code;
+    ctx.undefined = false;
+
+    ParsedInstruction inst;
+    bool success = false;
+    if(line->id == INST_INVALID) {
+        diag_report(&line->code_diags, DIAG_ERROR, E_UNKNOWN_INST, i + 1, (int) (mnemonic - line->code) + 1, "Invalid instruction \"%.*s\"", (int) mnemonic_len, mnemonic);
+    } else {
+        success = parse_instruction(line->id, line->code, i + 1, &ctx, &inst);
+    }
+    line->word = success ? inst.opcode : 0x0000;
+}
+
+// brings the symbols and the encoding of every line up to date after an edit, data_changed is set if the edit touched
+// the data segment or a constant
+static void update(Session *s, bool data_changed) {
+    // the symbols as they were are kept to compare with
+    clear_symbols(&s->prev);
+    for(int i = 0; i < s->syms.len; i++) add_symbol(&s->prev, s->syms.syms[i].name, strlen(s->syms.syms[i].name), s->syms.syms[i].value, s->syms.syms[i].kind);
+
+    if(data_changed) parse_data(s);
+    place_labels(s);
+    find_moved(s);
+
+    for(int i = 0; i < s->num_lines; i++) {
+        EditLine *line = &s->lines[i];
+        if(line->address < 0) {
+            diag_clear(&line->code_diags);
+            line->word = 0;
+            line->dirty = false;
+            continue;
+        }
+        if(line->dirty || (s->moved.len > 0 && names_moved(s, line))) encode_line(s, i);
+    }
+}
+
+// every problem in the document, numbered by where the lines are now
+static void collect_diags(Session *s) {
+    diag_clear(&s->out);
+    int num_insts = 0;
+    for(int i = 0; i < s->num_lines; i++) {
+        EditLine *line = &s->lines[i];
+        for(int k = 0; k < line->data_diags.len; k++) {
+            const Diagnostic *d = &line->data_diags.items[k];
+            diag_report(&s->out, d->severity, d->code, i + 1, d->col, "%s", d->msg);
+        }
+        for(int k = 0; k < line->code_diags.len; k++) {
+            const Diagnostic *d = &line->code_diags.items[k];
+            diag_report(&s->out, d->severity, d->code, i + 1, d->col, "%s", d->msg);
+        }
+        if(line->nul > 0) diag_report(&s->out, DIAG_ERROR, E_BAD_CHAR, i + 1, line->nul, "NUL byte in source");
+        if(line->blanked) {
+            int first = line->segment == 0 ? s->data_line : s->code_line;
+            diag_report(&s->out, DIAG_ERROR, E_BAD_DIRECTIVE, i + 1, 1, "Segment %s is already declared on line %d", segment_names[line->segment], first + 1);
+        }
+        if(line->dup_label) diag_report(&s->out, DIAG_ERROR, E_DUP_SYMBOL, i + 1, line->label_col, "Label %.*s is already defined", line->label_len, line->text + line->label_col - 1);
+        if(line->address >= 0 && num_insts++ == CSEG_SIZE) {
+            int count = 0;
+            for(int j = i; j < s->num_lines; j++) count += s->lines[j].address >= 0;
+            diag_report(&s->out, DIAG_WARNING, W_CSEG_FULL, i + 1, line->indent + 1, "%d instructions do not fit in the %d word code segment", CSEG_SIZE + count, CSEG_SIZE);
+        }
+    }
+}
+
+static void respond(Session *s, FILE *out, long long us) {
+    collect_diags(s);
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *f = open_memstream(&body, &body_len);
+    if(f == NULL) return;
+
+    fprintf(f, "{\"version\": %d, \"us\": %lld, \"lines\": [", s->version, us);
+    bool first = true;
+    for(int i = 0; i < s->num_lines; i++) {
+        EditLine *line = &s->lines[i];
+        if(line->address == line->sent_address && (line->address < 0 || line->word == line->sent_word)) continue;
+
+        fprintf(f, "%s{\"line\": %d, \"address\": ", first ? "" : ", ", i + 1);
+        if(line->address < 0) fprintf(f, "null}");
+        else fprintf(f, "%d, \"word\": \"0x%04X\"}", line->address, line->word);
+        line->sent_address = line->address;
+        line->sent_word = line->word;
+        first = false;
+    }
+    fprintf(f, "], \"diagnostics\": ");
+    s->out.file = s->path != NULL ? s->path : "";
+    diag_print(&s->out, f, true);
+    fprintf(f, "}\n");
+    fclose(f);
+
+    fprintf(out, "Content-Length: %zu\r\n\r\n", body_len);
+    fwrite(body, 1, body_len, out);
+    fflush(out);
+    free(body);
+}
+
+// makes room for n more lines at index at
+static bool open_gap(Session *s, int at, int n) {
+    if(s->num_lines + n > s->cap) {
+        int cap = s->cap == 0 ? 64 : s->cap;
+        while(cap < s->num_lines + n) cap *= 2;
+        EditLine *grown = realloc(s->lines, sizeof(EditLine) * cap);
+        if(grown == NULL) return false;
+        s->lines = grown;
+        s->cap = cap;
+    }
+    if(at < s->num_lines) memmove(&s->lines[at + n], &s->lines[at], sizeof(EditLine) * (s->num_lines - at));
+    memset(&s->lines[at], 0, sizeof(EditLine) * n);
+    s->num_lines += n;
+    return true;
+}
+
+// replaces count lines from first with the n lines of texts, whose lengths are in lens
+static bool edit(Session *s, int first, int count, char **texts, size_t *lens, int n) {
+    bool structural = false; // a segment declaration came or went, so every line may be in another segment now
+    bool data_changed = false;
+
+    for(int i = first; i < first + count; i++) {
+        EditLine *line = &s->lines[i];
+        if(line->segment != SEG_NONE) structural = true;
+        if(line->kind & (LINE_DATA | LINE_EQU)) data_changed = true;
+        free_line(line);
+    }
+    if(count > 0) memmove(&s->lines[first], &s->lines[first + count], sizeof(EditLine) * (s->num_lines - first - count));
+    s->num_lines -= count;
+    if(!open_gap(s, first, n)) return false;
+
+    for(int k = 0; k < n; k++) {
+        EditLine *line = &s->lines[first + k];
+        if(!scan_source(texts[k], lens[k], &s->scan)) return false;
+        if(!init_line(line, texts[k], lens[k], s->scan.num_lines > 0 ? &s->scan.lines[0] : NULL)) return false;
+        if(line->segment != SEG_NONE) structural = true;
+    }
+
+    if(structural) {
+        find_segments(s);
+        data_changed = true;
+    } else {
+        // the segments are where they were, only further down or up
+        if(s->data_line >= first + count) s->data_line += n - count;
+        if(s->code_line >= first + count) s->code_line += n - count;
+        for(int k = 0; k < n; k++) {
+            classify(s, first + k);
+            if(s->lines[first + k].kind & (LINE_DATA | LINE_EQU)) data_changed = true;
+        }
+    }
+
+    update(s, data_changed);
+    return true;
+}
+
+// replaces the whole document with the file at path
+static bool open_document(Session *s, const char *path) {
+    char *buf = NULL;
+    size_t cap = 0, len;
+    if(!read_file(path, &buf, &cap, &len)) return false;
+
+    ScanResult scan = {0};
+    bool ok = scan_source(buf, len, &scan);
+    char **texts = malloc(sizeof(char *) * (scan.num_lines + 1));
+    size_t *lens = malloc(sizeof(size_t) * (scan.num_lines + 1));
+    if(!ok || texts == NULL || lens == NULL) {
+        free(texts);
+        free(lens);
+        free_scan(&scan);
+        free(buf);
+        return false;
+    }
+
+    // the lines are split and scanned again one at a time by edit, which finds the same structure in them
+    for(int i = 0; i < scan.num_lines; i++) {
+        texts[i] = buf + scan.lines[i].start;
+        lens[i] = scan.lines[i].len;
+    }
+    ok = edit(s, 0, s->num_lines, texts, lens, scan.num_lines);
+    free(s->path);
+    s->path = strdup(path);
+
+    free(texts);
+    free(lens);
+    free_scan(&scan);
+    free(buf);
+    return ok;
+}
+
+static long long elapsed_us(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+// reads one line of input without its newline, returns its length or -1 at the end of the input
+static ssize_t read_line(FILE *in, char **buf, size_t *cap) {
+    ssize_t len = getline(buf, cap, in);
+    if(len > 0 && (*buf)[len - 1] == '\n') (*buf)[--len] = '\0';
+    return len;
+}
+
+int serve(FILE *in, FILE *out) {
+    Session s;
+    memset(&s, 0, sizeof(Session));
+    init_symbols(&s.syms);
+    init_symbols(&s.prev);
+    init_symbols(&s.moved);
+    data_init(&s.data);
+    diag_init(&s.out, NULL);
+    s.data_line = s.code_line = -1;
+
+    int result = 0;
+    char *request = NULL;
+    size_t request_cap = 0;
+    ssize_t len;
+    while((len = read_line(in, &request, &request_cap)) >= 0) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        int first, count, n;
+        bool ok = true;
+        if(strncmp(request, "open ", 5) == 0) {
+            ok = open_document(&s, request + 5);
+        } else if(sscanf(request, "edit %d %d %d", &first, &count, &n) == 3) {
+            // the replacement lines are read before the edit is checked, so a bad one cannot leave them unread
+            if(n < 0) n = 0;
+            char **texts = calloc(n > 0 ? n : 1, sizeof(char *));
+            size_t *lens = calloc(n > 0 ? n : 1, sizeof(size_t));
+            if(texts == NULL || lens == NULL) {
+                printf("Error allocating memory\n");
+                free(texts);
+                free(lens);
+                result = -1;
+                break;
+            }
+            for(int k = 0; k < n && ok; k++) {
+                size_t cap = 0;
+                ssize_t text_len = read_line(in, &texts[k], &cap);
+                if(text_len < 0) ok = false;
+                lens[k] = text_len < 0 ? 0 : text_len;
+            }
+
+            if(!ok) {
+                printf("Request \"%s\" is missing some of its lines\n", request);
+            } else if(first < 1 || count < 0 || first - 1 > s.num_lines - count) {
+                printf("Request \"%s\" does not fit in the %d line document\n", request, s.num_lines);
+                ok = false;
+            } else {
+                // the clock starts once the edit has been read, the editor is not waiting on its own pipe
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                if(!edit(&s, first - 1, count, texts, lens, n)) {
+                    printf("Error allocating memory\n");
+                    result = -1;
+                }
+            }
+
+            for(int k = 0; k < n; k++) free(texts[k]);
+            free(texts);
+            free(lens);
+            if(result < 0) break;
+        } else if(strcmp(request, "quit") == 0) {
+            break;
+        } else {
+            printf("Unknown request \"%s\", expected open, edit or quit\n", request);
+            ok = false;
+        }
+
+        // a request that could not be carried out leaves the document as it was, which is answered all the same
+        if(ok) s.version++;
+        respond(&s, out, elapsed_us(&start));
+    }
+
+    free(request);
+    for(int i = 0; i < s.num_lines; i++) free_line(&s.lines[i]);
+    free(s.lines);
+    free_symbols(&s.syms);
+    free_symbols(&s.prev);
+    free_symbols(&s.moved);
+    data_free(&s.data);
+    free_scan(&s.scan);
+    diag_free(&s.out);
+    free(s.path);
+    return result;
+}
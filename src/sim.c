@@ -0,0 +1,498 @@
+#include "sim.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fileio.h"
+
+bool sim_reset(SimState *state, const uint16_t *code, size_t code_len, const uint8_t *data, size_t data_len) {
+    if(code_len > CSEG_SIZE || data_len > DSEG_SIZE) return false;
+
+    memset(state, 0, sizeof(SimState));
+    if(code_len > 0) memcpy(state->cmem, code, sizeof(uint16_t) * code_len);
+    if(data_len > 0) memcpy(state->dmem, data, sizeof(uint8_t) * data_len);
+    state->code_len = code_len;
+    state->status = code_len == 0 ? SIM_HALTED : SIM_RUNNING;
+    return true;
+}
+
+// sets the flags for a + b + carry_in, where b has already been inverted for a subtraction
+static uint8_t add_flags(SimState *state, uint8_t a, uint8_t b, int carry_in) {
+    unsigned sum = a + b + carry_in;
+    uint8_t result = (uint8_t) sum;
+
+    state->flags = 0;
+    if(sum > 0xFF) state->flags |= FLAG_C;
+    if(result & 0x80) state->flags |= FLAG_N;
+    if(((a ^ result) & (b ^ result)) & 0x80) state->flags |= FLAG_O;
+    if(result == 0) state->flags |= FLAG_Z;
+    return result;
+}
+
+static uint8_t shift_flags(SimState *state, uint8_t a, bool left) {
+    // SHIFTR is arithmetic, so the sign is kept
+    uint8_t result = left ? (uint8_t) (a << 1) : (uint8_t) ((a >> 1) | (a & 0x80));
+
+    state->flags = 0;
+    if(left ? (a & 0x80) : (a & 0x01)) state->flags |= FLAG_C;
+    if(result & 0x80) state->flags |= FLAG_N;
+    if(left && ((a ^ result) & 0x80)) state->flags |= FLAG_O;
+    if(result == 0) state->flags |= FLAG_Z;
+    return result;
+}
+
+SimStatus sim_step(SimState *state, const SimInput *input) {
+    if(state->pc >= state->code_len) {
+        state->status = SIM_HALTED;
+        return SIM_HALTED;
+    }
+
+    uint16_t inst = state->cmem[state->pc];
+    uint8_t *rx = &state->regs[(inst >> 10) & 0x3];
+    uint8_t *ry = &state->regs[(inst >> 8) & 0x3];
+    uint8_t low = inst & 0xFF;
+    int next = state->pc + 1;
+    uint16_t val;
+
+    switch(isa_decode(inst)) {
+        case INST_INPUTC:
+        case INST_INPUTCF:
+        case INST_INPUTD:
+        case INST_INPUTDF:
+            if(!sim_next_input(input, state->pc, &state->input_pos, state->pc_reads, &val)) {
+                state->status = SIM_NO_INPUT;
+                return SIM_NO_INPUT;
+            }
+            {
+                // the F forms add the register in bits 11-10 to the address
+                uint8_t addr = low + ((inst & 0x0100) ? *rx : 0);
+                if(inst & 0x0200) {
+                    state->dmem[addr & DSEG_MASK] = (uint8_t) val;
+                } else {
+                    state->cmem[addr & CSEG_MASK] = val;
+                    if((addr & CSEG_MASK) >= state->code_len) state->code_len = (addr & CSEG_MASK) + 1;
+                }
+            }
+            break;
+
+        case INST_MOVE:
+            *rx = *ry;
+            break;
+
+        case INST_LOADI:
+            *rx = low;
+            break;
+
+        case INST_ADD:
+            *rx = add_flags(state, *rx, *ry, 0);
+            break;
+
+        case INST_ADDI:
+            *rx = add_flags(state, *rx, low, 0);
+            break;
+
+        case INST_SUB:
+            *rx = add_flags(state, *rx, ~*ry, 1);
+            break;
+
+        case INST_SUBI:
+            *rx = add_flags(state, *rx, ~low, 1);
+            break;
+
+        case INST_LOAD:
+            *rx = state->dmem[low & DSEG_MASK];
+            break;
+
+        case INST_LOADF:
+            *rx = state->dmem[(uint8_t) (*ry + low) & DSEG_MASK];
+            break;
+
+        case INST_STORE:
+            state->dmem[low & DSEG_MASK] = *rx;
+            break;
+
+        case INST_STOREF: // the index register is in bits 9-8 and the source in bits 11-10
+            state->dmem[(uint8_t) (*ry + low) & DSEG_MASK] = *rx;
+            break;
+
+        case INST_SHIFTL:
+            *rx = shift_flags(state, *rx, true);
+            break;
+
+        case INST_SHIFTR:
+            *rx = shift_flags(state, *rx, false);
+            break;
+
+        case INST_CMP:
+            add_flags(state, *rx, ~*ry, 1);
+            break;
+
+        case INST_JUMP:
+        case INST_BRE:
+        case INST_BRNE:
+        case INST_BRG:
+        case INST_BRGE:
+            if(sim_branch_taken(isa_decode(inst), state->flags)) next += (int8_t) low;
+            break;
+
+        default: // NOOP, and encodings that are not instructions do nothing
+            break;
+    }
+
+    state->steps++;
+    if(next < 0 || next >= state->code_len) {
+        state->pc = state->code_len;
+        state->status = SIM_HALTED;
+    } else {
+        state->pc = next;
+        state->status = SIM_RUNNING;
+    }
+    return state->status;
+}
+
+SimStatus sim_run(SimState *state, const SimInput *input, uint64_t max_steps) {
+    // a run stopped for lack of input did not execute the INPUT instruction, so it can be continued with more
+    if(state->status == SIM_HALTED) return SIM_HALTED;
+
+    state->status = SIM_RUNNING;
+    while(state->steps < max_steps) {
+        if(sim_step(state, input) != SIM_RUNNING) return state->status;
+    }
+    return SIM_RUNNING;
+}
+
+void sim_print(const SimState *state, FILE *out_file) {
+    fprintf(out_file, "PC: %d, steps: %llu\n", state->pc, (unsigned long long) state->steps);
+    fprintf(out_file, "A: %d, B: %d, C: %d, D: %d\n", (int8_t) state->regs[0], (int8_t) state->regs[1], (int8_t) state->regs[2], (int8_t) state->regs[3]);
+    fprintf(out_file, "Flags: C=%d N=%d O=%d Z=%d\n", !!(state->flags & FLAG_C), !!(state->flags & FLAG_N), !!(state->flags & FLAG_O), !!(state->flags & FLAG_Z));
+    fputc('[', out_file);
+    for(int i = 0; i < DSEG_SIZE; i++) fprintf(out_file, i < DSEG_SIZE - 1 ? "%d, " : "%d]\n", (int8_t) state->dmem[i]);
+}
+
+// the snapshot layout does not depend on the host, every value is written byte by byte in little endian
+static uint8_t *put_le(uint8_t *p, uint64_t val, int bytes) {
+    for(int i = 0; i < bytes; i++) *p++ = (uint8_t) (val >> (8 * i));
+    return p;
+}
+
+static const uint8_t *get_le(const uint8_t *p, uint64_t *val, int bytes) {
+    *val = 0;
+    for(int i = 0; i < bytes; i++) *val |= (uint64_t) *p++ << (8 * i);
+    return p;
+}
+
+// grows the value array of a text input so it can hold one more value
+static bool reserve_input(SimInput *input, uint16_t **keys) {
+    if(input->len < input->cap) return true;
+    size_t cap = input->cap == 0 ? 64 : input->cap * 2;
+    uint16_t *values = realloc(input->values, sizeof(uint16_t) * cap);
+    if(values != NULL) input->values = values;
+    uint16_t *grown = values != NULL ? realloc(*keys, sizeof(uint16_t) * cap) : NULL;
+    if(grown == NULL) {
+        printf("Error allocating memory\n");
+        return false;
+    }
+    *keys = grown;
+    input->cap = cap;
+    return true;
+}
+
+// sorts the values of a keyed input by PC, keeping the order of the values for each PC
+static bool group_by_pc(SimInput *input, const uint16_t *keys) {
+    input->num_keys = CSEG_SIZE;
+    input->by_pc = calloc(CSEG_SIZE + 1, sizeof(uint32_t));
+    uint16_t *sorted = malloc(sizeof(uint16_t) * (input->len > 0 ? input->len : 1));
+    if(input->by_pc == NULL || sorted == NULL) {
+        printf("Error allocating memory\n");
+        free(sorted);
+        return false;
+    }
+
+    for(size_t i = 0; i < input->len; i++) input->by_pc[keys[i] + 1]++;
+    for(int pc = 0; pc < CSEG_SIZE; pc++) input->by_pc[pc + 1] += input->by_pc[pc];
+    uint32_t next[TARGET_CSEG_MAX];
+    memcpy(next, input->by_pc, sizeof(uint32_t) * CSEG_SIZE);
+    for(size_t i = 0; i < input->len; i++) sorted[next[keys[i]]++] = input->values[i];
+
+    free(input->values);
+    input->values = sorted;
+    input->cap = input->len;
+    return true;
+}
+
+static bool read_text_input(const char *path, SimInput *input) {
+    char *buf = NULL;
+    size_t cap = 0, len;
+    if(!read_file(path, &buf, &cap, &len)) {
+        free(buf);
+        return false;
+    }
+
+    // the PC each value is for, only used when the input is keyed
+    uint16_t *keys = NULL;
+    int key = -1;
+    bool ok = true;
+
+    input->len = 0;
+    const char *s = buf;
+    while(ok) {
+        while(isspace((unsigned char) *s) || *s == ',') s++;
+        if(*s == '\0') break;
+
+        char *end;
+        long val = strtol(s, &end, 0);
+        if(end != s && *end == ':') {
+            // a value before the first PC would belong to no input instruction
+            ok = val >= 0 && val < CSEG_SIZE && (key >= 0 || input->len == 0);
+            if(!ok) printf("Invalid input PC \"%.*s\" in %s\n", (int) (end - s + 1), s, path);
+            key = val;
+            s = end + 1;
+            continue;
+        }
+
+        if(end == s || val < -32768 || val > 65535) {
+            printf("Invalid input value \"%.*s\" in %s\n", (int) strcspn(s, " \t\r\n,"), s, path);
+            ok = false;
+            break;
+        }
+        s = end;
+
+        ok = reserve_input(input, &keys);
+        if(ok) {
+            keys[input->len] = key;
+            input->values[input->len++] = (uint16_t) val;
+        }
+    }
+
+    if(ok && key >= 0) ok = group_by_pc(input, keys);
+    free(keys);
+    free(buf);
+    return ok;
+}
+
+// the replay header is the magic, version, key count and value count
+#define REPLAY_HEADER (8 + 2 + 2 + 4 + 4)
+
+static bool map_replay(const char *path, int fd, SimInput *input) {
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        printf("Error reading %s\n", path);
+        return false;
+    }
+    size_t len = st.st_size;
+    uint8_t *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) {
+        printf("Error mapping %s\n", path);
+        return false;
+    }
+
+    uint64_t version = 0, num_keys = 0, num_values = 0;
+    const uint8_t *p = map + REPLAY_HEADER;
+    if(len >= REPLAY_HEADER) {
+        get_le(map + 8, &version, 2);
+        get_le(map + 12, &num_keys, 4);
+        get_le(map + 16, &num_values, 4);
+    }
+    size_t offsets_len = num_keys > 0 ? 4 * (num_keys + 1) : 0;
+    bool ok = len >= REPLAY_HEADER && version == REPLAY_VERSION && len == REPLAY_HEADER + offsets_len + 2 * num_values;
+
+    // the offsets of each PC's values have to stay inside the values and be in order
+    uint64_t prev = 0, off;
+    for(uint64_t k = 0; ok && k <= num_keys && num_keys > 0; k++) {
+        get_le(p + 4 * k, &off, 4);
+        ok = off >= prev && off <= num_values && (k < num_keys || off == num_values);
+        prev = off;
+    }
+    if(!ok) {
+        printf("%s is not a valid replay file\n", path);
+        munmap(map, len);
+        return false;
+    }
+
+    input->map = map;
+    input->map_len = len;
+    input->len = num_values;
+    input->cap = num_values;
+    input->num_keys = num_keys;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    input->by_pc = num_keys > 0 ? (uint32_t *) p : NULL;
+    input->values = (uint16_t *) (p + offsets_len);
+#else
+    // a big endian host has to swap every value, so the file is read into memory instead
+    input->map = NULL;
+    input->by_pc = num_keys > 0 ? malloc(offsets_len) : NULL;
+    input->values = malloc(2 * num_values + 1);
+    if((num_keys > 0 && input->by_pc == NULL) || input->values == NULL) {
+        printf("Error allocating memory\n");
+        munmap(map, len);
+        return false;
+    }
+    for(uint64_t k = 0; k <= num_keys && num_keys > 0; k++) {
+        get_le(p + 4 * k, &off, 4);
+        input->by_pc[k] = off;
+    }
+    for(uint64_t i = 0; i < num_values; i++) {
+        get_le(p + offsets_len + 2 * i, &off, 2);
+        input->values[i] = off;
+    }
+    munmap(map, len);
+#endif
+    return true;
+}
+
+bool read_sim_input(const char *path, SimInput *input) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        printf("Error opening file %s\n", path);
+        return false;
+    }
+
+    char magic[8];
+    bool replay = read(fd, magic, 8) == 8 && memcmp(magic, REPLAY_MAGIC, 8) == 0;
+    bool ok = replay ? map_replay(path, fd, input) : read_text_input(path, input);
+    close(fd);
+    return ok;
+}
+
+bool save_sim_input(const SimInput *input, const char *path) {
+    if(input->len > UINT32_MAX) {
+        printf("Too many input values for a replay file\n");
+        return false;
+    }
+
+    uint32_t num_keys = input->by_pc != NULL ? input->num_keys : 0;
+    size_t offsets_len = num_keys > 0 ? 4 * ((size_t) num_keys + 1) : 0;
+    size_t len = REPLAY_HEADER + offsets_len + 2 * input->len;
+    uint8_t *buf = malloc(len);
+    if(buf == NULL) {
+        printf("Error allocating memory\n");
+        return false;
+    }
+
+    memcpy(buf, REPLAY_MAGIC, 8);
+    uint8_t *p = put_le(buf + 8, REPLAY_VERSION, 2);
+    p = put_le(p, 0, 2);
+    p = put_le(p, num_keys, 4);
+    p = put_le(p, input->len, 4);
+    for(uint32_t k = 0; k <= num_keys && num_keys > 0; k++) p = put_le(p, input->by_pc[k], 4);
+    for(size_t i = 0; i < input->len; i++) p = put_le(p, input->values[i], 2);
+
+    bool ok = write_file_if_changed(path, (const char *) buf, len) >= 0;
+    free(buf);
+    return ok;
+}
+
+void free_sim_input(SimInput *input) {
+    if(input->map != NULL) {
+        munmap(input->map, input->map_len);
+    } else {
+        free(input->values);
+        free(input->by_pc);
+    }
+    memset(input, 0, sizeof(SimInput));
+}
+
+// magic, version, dseg_size, cseg_size, pc, regs, flags, status, code_len, input_pos, steps and the data memory
+#define SNAPSHOT_HEADER (8 + 2 + 2 + 2 + 2 + 4 + 1 + 1 + 2 + 4 + 8 + DSEG_SIZE)
+
+size_t sim_snapshot_size(const SimState *state) {
+    // only the part of code memory the program uses is stored, with the reads of each of its input instructions
+    return SNAPSHOT_HEADER + 6 * state->code_len;
+}
+
+size_t sim_save(const SimState *state, uint8_t *buf) {
+    uint8_t *p = buf;
+    memcpy(p, SNAPSHOT_MAGIC, 8);
+    p += 8;
+    p = put_le(p, SNAPSHOT_VERSION, 2);
+    p = put_le(p, DSEG_SIZE, 2);
+    p = put_le(p, CSEG_SIZE, 2);
+    p = put_le(p, state->pc, 2);
+    memcpy(p, state->regs, 4);
+    p += 4;
+    *p++ = state->flags;
+    *p++ = state->status;
+    p = put_le(p, state->code_len, 2);
+    p = put_le(p, state->input_pos, 4);
+    p = put_le(p, state->steps, 8);
+    memcpy(p, state->dmem, DSEG_SIZE);
+    p += DSEG_SIZE;
+    for(int i = 0; i < state->code_len; i++) p = put_le(p, state->cmem[i], 2);
+    for(int i = 0; i < state->code_len; i++) p = put_le(p, state->pc_reads[i], 4);
+    return p - buf;
+}
+
+bool sim_load(SimState *state, const uint8_t *buf, size_t len) {
+    if(len < SNAPSHOT_HEADER || memcmp(buf, SNAPSHOT_MAGIC, 8) != 0) return false;
+
+    const uint8_t *p = buf + 8;
+    uint64_t val;
+    p = get_le(p, &val, 2);
+    if(val != SNAPSHOT_VERSION) return false;
+
+    // the data memory and the code length limit depend on the sizes, so a snapshot from another target is rejected
+    p = get_le(p, &val, 2);
+    if(val != (uint64_t) DSEG_SIZE) return false;
+    p = get_le(p, &val, 2);
+    if(val != (uint64_t) CSEG_SIZE) return false;
+
+    SimState loaded;
+    memset(&loaded, 0, sizeof(SimState));
+    p = get_le(p, &val, 2);
+    loaded.pc = val;
+    memcpy(loaded.regs, p, 4);
+    p += 4;
+    loaded.flags = *p++ & (FLAG_C | FLAG_N | FLAG_O | FLAG_Z);
+    loaded.status = *p++;
+    p = get_le(p, &val, 2);
+    loaded.code_len = val;
+    p = get_le(p, &val, 4);
+    loaded.input_pos = val;
+    p = get_le(p, &val, 8);
+    loaded.steps = val;
+    memcpy(loaded.dmem, p, DSEG_SIZE);
+    p += DSEG_SIZE;
+
+    if(loaded.code_len > CSEG_SIZE || loaded.status > SIM_STEP_LIMIT || len != SNAPSHOT_HEADER + 6 * (size_t) loaded.code_len) return false;
+    if(loaded.pc > loaded.code_len) return false;
+
+    for(int i = 0; i < loaded.code_len; i++) {
+        p = get_le(p, &val, 2);
+        loaded.cmem[i] = val;
+    }
+    for(int i = 0; i < loaded.code_len; i++) {
+        p = get_le(p, &val, 4);
+        loaded.pc_reads[i] = val;
+    }
+
+    *state = loaded;
+    return true;
+}
+
+bool sim_save_file(const SimState *state, const char *path) {
+    uint8_t *buf = malloc(sim_snapshot_size(state));
+    if(buf == NULL) {
+        printf("Error allocating memory\n");
+        return false;
+    }
+    size_t len = sim_save(state, buf);
+    bool ok = write_file_if_changed(path, (const char *) buf, len) >= 0;
+    free(buf);
+    return ok;
+}
+
+bool sim_load_file(SimState *state, const char *path) {
+    char *buf = NULL;
+    size_t cap = 0, len;
+    if(!read_file(path, &buf, &cap, &len)) {
+        free(buf);
+        return false;
+    }
+
+    bool ok = sim_load(state, (const uint8_t *) buf, len);
+    if(!ok) printf("%s is not a valid snapshot for the %s target\n", path, target.name);
+    free(buf);
+    return ok;
+}
@@ -0,0 +1,520 @@
+#include "superopt.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "isa.h"
+#include "cfg.h"
+#include "sim.h"
+#include "scan.h"
+#include "fileio.h"
+
+#define SUPEROPT_QUICK 16 // states every candidate is run from, most are rejected on the first
+#define SUPEROPT_STATES 4096 // states a candidate has to agree on before it is accepted
+#define MAX_IMMS 16
+#define MAX_ADDRS 4
+#define MAX_CANDIDATES 1024
+
+bool superopt_allowed(uint16_t opcode) {
+    switch(isa_decode(opcode)) {
+        case INST_NOOP:
+        case INST_MOVE:
+        case INST_LOADI:
+        case INST_ADD:
+        case INST_ADDI:
+        case INST_SUB:
+        case INST_SUBI:
+        case INST_LOAD:
+        case INST_LOADF:
+        case INST_STORE:
+        case INST_STOREF:
+        case INST_SHIFTL:
+        case INST_SHIFTR:
+        case INST_CMP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// what a sequence leaves behind, everything else in the state is the same for any straight-line sequence
+typedef struct {
+    uint8_t regs[4];
+    uint8_t flags;
+    uint8_t dmem[TARGET_DSEG_MAX];
+} Outcome;
+
+static void run_sequence(const SimState *start, const uint16_t *code, size_t len, Outcome *out) {
+    SimState state = *start;
+    memcpy(state.cmem, code, sizeof(uint16_t) * len);
+    state.code_len = len;
+    for(size_t i = 0; i < len; i++) sim_step(&state, NULL);
+
+    memcpy(out->regs, state.regs, sizeof(out->regs));
+    out->flags = state.flags;
+    memcpy(out->dmem, state.dmem, sizeof(out->dmem));
+}
+
+static bool same_outcome(const Outcome *a, const Outcome *b, bool flags) {
+    return memcmp(a->regs, b->regs, sizeof(a->regs)) == 0 && memcmp(a->dmem, b->dmem, sizeof(a->dmem)) == 0 && (!flags || a->flags == b->flags);
+}
+
+// the start states, the same every run so the database does not depend on when a window was searched
+// the even ones are built from the values where arithmetic tends to go wrong, the odd ones are random
+static void init_states(SimState *states) {
+    static const uint8_t edges[] = {0x00, 0x01, 0x7F, 0x80, 0xFF, 0x02, 0xFE, 0x40};
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+
+    for(int s = 0; s < SUPEROPT_STATES; s++) {
+        SimState *state = &states[s];
+        memset(state, 0, sizeof(SimState));
+        state->status = SIM_RUNNING;
+
+        uint8_t bytes[4 + 1 + TARGET_DSEG_MAX];
+        for(int i = 0; i < 4 + 1 + DSEG_SIZE; i++) {
+            // xorshift64
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            bytes[i] = (s % 2 == 0 && i < 4) ? edges[(s / 2 + i * 3 + (s / 16) * i) % 8] : (uint8_t) seed;
+        }
+        memcpy(state->regs, bytes, 4);
+        state->flags = bytes[4] & (FLAG_C | FLAG_N | FLAG_O | FLAG_Z);
+        memcpy(state->dmem, bytes + 5, DSEG_SIZE);
+    }
+}
+
+static void add_value(uint8_t *values, int *len, int cap, uint8_t value) {
+    for(int i = 0; i < *len; i++) {
+        if(values[i] == value) return;
+    }
+    if(*len < cap) values[(*len)++] = value;
+}
+
+// every instruction a replacement may be built from, limited to the registers, addresses and constants that could
+// matter for this window, registers outside the window would have to be left as they are anyway
+static size_t build_candidates(const uint16_t *window, size_t len, const Outcome *expect, uint16_t *cands) {
+    unsigned reg_mask = 0;
+    uint8_t imms[MAX_IMMS], addrs[MAX_ADDRS];
+    int num_imms = 0, num_addrs = 0;
+
+    for(size_t i = 0; i < len; i++) {
+        uint8_t kinds = pattern_kinds[inst_table[isa_decode(window[i])].pattern];
+        if(kinds & OPND_REG0) reg_mask |= 1 << ((window[i] >> 10) & 0x3);
+        if(kinds & OPND_REG1) reg_mask |= 1 << ((window[i] >> 8) & 0x3);
+        if(kinds & OPND_DADDR) add_value(addrs, &num_addrs, MAX_ADDRS, window[i] & 0xFF);
+    }
+
+    // a register or memory byte that always ends up with the same value can be loaded directly
+    for(int r = 0; r < 4; r++) {
+        bool constant = true;
+        for(int s = 1; constant && s < SUPEROPT_STATES; s++) constant = expect[s].regs[r] == expect[0].regs[r];
+        if(constant) add_value(imms, &num_imms, MAX_IMMS, expect[0].regs[r]);
+    }
+    for(size_t i = 0; i < len; i++) {
+        if(pattern_kinds[inst_table[isa_decode(window[i])].pattern] & OPND_IMM) add_value(imms, &num_imms, MAX_IMMS, window[i] & 0xFF);
+    }
+    // folding two immediates into one, and the usual small constants
+    for(size_t i = 0; i < len; i++) {
+        for(size_t j = i + 1; j < len; j++) {
+            if(!(pattern_kinds[inst_table[isa_decode(window[i])].pattern] & OPND_IMM)) continue;
+            if(!(pattern_kinds[inst_table[isa_decode(window[j])].pattern] & OPND_IMM)) continue;
+            add_value(imms, &num_imms, MAX_IMMS, (window[i] + window[j]) & 0xFF);
+            add_value(imms, &num_imms, MAX_IMMS, (window[i] - window[j]) & 0xFF);
+            add_value(imms, &num_imms, MAX_IMMS, (window[j] - window[i]) & 0xFF);
+        }
+    }
+    add_value(imms, &num_imms, MAX_IMMS, 0);
+    add_value(imms, &num_imms, MAX_IMMS, 1);
+    add_value(imms, &num_imms, MAX_IMMS, 0xFF);
+
+    size_t n = 0;
+    for(int rx = 0; rx < 4; rx++) {
+        if(!(reg_mask & (1 << rx))) continue;
+        cands[n++] = isa_encode(INST_SHIFTL, rx, 0, 0);
+        cands[n++] = isa_encode(INST_SHIFTR, rx, 0, 0);
+
+        for(int ry = 0; ry < 4; ry++) {
+            if(!(reg_mask & (1 << ry))) continue;
+            // MOVE to itself does nothing, so it is never part of a shortest sequence
+            if(rx != ry) cands[n++] = isa_encode(INST_MOVE, rx, ry, 0);
+            cands[n++] = isa_encode(INST_ADD, rx, ry, 0);
+            cands[n++] = isa_encode(INST_SUB, rx, ry, 0);
+            cands[n++] = isa_encode(INST_CMP, rx, ry, 0);
+            for(int a = 0; a < num_addrs; a++) {
+                cands[n++] = isa_encode(INST_LOADF, rx, ry, addrs[a]);
+                cands[n++] = isa_encode(INST_STOREF, rx, ry, addrs[a]);
+            }
+        }
+
+        for(int i = 0; i < num_imms; i++) {
+            cands[n++] = isa_encode(INST_LOADI, rx, 0, imms[i]);
+            cands[n++] = isa_encode(INST_ADDI, rx, 0, imms[i]);
+            cands[n++] = isa_encode(INST_SUBI, rx, 0, imms[i]);
+        }
+        for(int a = 0; a < num_addrs; a++) {
+            cands[n++] = isa_encode(INST_LOAD, rx, 0, addrs[a]);
+            cands[n++] = isa_encode(INST_STORE, rx, 0, addrs[a]);
+        }
+    }
+    return n;
+}
+
+// one search for a fixed replacement length, shared by the workers
+typedef struct {
+    const uint16_t *cands;
+    size_t num_cands;
+    const SimState *states;
+    const Outcome *expect;
+    size_t len;
+    bool flags;
+    size_t rest_count; // sequences that share a first instruction, num_cands to the power len - 1
+    atomic_size_t next_first; // first instruction the next idle worker takes
+    atomic_size_t best; // lowest sequence number found so far, SIZE_MAX until one is
+} Search;
+
+static bool matches(const Search *search, const uint16_t *seq, int start, int end) {
+    Outcome out;
+    for(int s = start; s < end; s++) {
+        run_sequence(&search->states[s], seq, search->len, &out);
+        if(!same_outcome(&out, &search->expect[s], search->flags)) return false;
+    }
+    return true;
+}
+
+static void *search_worker(void *arg) {
+    Search *search = arg;
+    uint16_t seq[SUPEROPT_WINDOW];
+    size_t digits[SUPEROPT_WINDOW];
+
+    while(true) {
+        size_t first = atomic_fetch_add(&search->next_first, 1);
+        if(first >= search->num_cands) break;
+
+        // everything starting with a later first instruction comes after a sequence that was already found
+        size_t best = atomic_load(&search->best);
+        if(best != SIZE_MAX && best / search->rest_count < first) break;
+
+        memset(digits, 0, sizeof(digits));
+        for(size_t rest = 0; rest < search->rest_count; rest++) {
+            seq[0] = search->cands[first];
+            for(size_t d = 1; d < search->len; d++) seq[d] = search->cands[digits[d]];
+
+            if(matches(search, seq, 0, SUPEROPT_QUICK) && matches(search, seq, SUPEROPT_QUICK, SUPEROPT_STATES)) {
+                size_t found = first * search->rest_count + rest;
+                size_t current = atomic_load(&search->best);
+                while(found < current && !atomic_compare_exchange_weak(&search->best, &current, found)) ;
+                break;
+            }
+
+            // count through the remaining instructions like an odometer, the last one moving fastest
+            for(size_t d = search->len - 1; d >= 1; d--) {
+                if(++digits[d] < search->num_cands) break;
+                digits[d] = 0;
+            }
+        }
+    }
+    return NULL;
+}
+
+bool superopt_search(const uint16_t *window, size_t len, bool flags, int threads, Rewrite *out) {
+    memset(out, 0, sizeof(Rewrite));
+    memcpy(out->window, window, sizeof(uint16_t) * len);
+    out->window_len = len;
+    out->flags = flags;
+
+    SimState *states = malloc(sizeof(SimState) * SUPEROPT_STATES);
+    Outcome *expect = malloc(sizeof(Outcome) * SUPEROPT_STATES);
+    uint16_t *cands = malloc(sizeof(uint16_t) * MAX_CANDIDATES);
+    if(states == NULL || expect == NULL || cands == NULL) {
+        free(states);
+        free(expect);
+        free(cands);
+        return false;
+    }
+
+    init_states(states);
+    for(int s = 0; s < SUPEROPT_STATES; s++) run_sequence(&states[s], window, len, &expect[s]);
+    size_t num_cands = build_candidates(window, len, expect, cands);
+
+    // the empty sequence, for windows that do nothing at all
+    Search search = {cands, num_cands, states, expect, 0, flags, 1};
+    if(matches(&search, cands, 0, SUPEROPT_STATES)) out->found = true;
+
+    int num_workers = threads > 0 ? threads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_workers < 1) num_workers = 1;
+    pthread_t *workers = malloc(sizeof(pthread_t) * num_workers);
+    bool ok = workers != NULL;
+
+    for(size_t k = 1; ok && !out->found && k < len; k++) {
+        search.len = k;
+        search.rest_count = 1;
+        for(size_t d = 1; d < k; d++) search.rest_count *= num_cands;
+        atomic_store(&search.next_first, 0);
+        atomic_store(&search.best, SIZE_MAX);
+
+        int started = 0;
+        while(started < num_workers && pthread_create(&workers[started], NULL, search_worker, &search) == 0) started++;
+        // whatever could not be handed to a thread is searched here
+        if(started == 0) search_worker(&search);
+        for(int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+
+        size_t best = atomic_load(&search.best);
+        if(best != SIZE_MAX) {
+            // the sequence number is the candidate indices written in base num_cands
+            for(size_t d = k; d-- > 0; ) {
+                out->repl[d] = cands[best % num_cands];
+                best /= num_cands;
+            }
+            out->repl_len = k;
+            out->found = true;
+        }
+    }
+
+    free(workers);
+    free(states);
+    free(expect);
+    free(cands);
+    return ok;
+}
+
+static bool same_window(const Rewrite *r, const uint16_t *window, size_t len, bool flags) {
+    return r->flags == flags && r->window_len == len && memcmp(r->window, window, sizeof(uint16_t) * len) == 0;
+}
+
+const Rewrite *rewrite_db_find(const RewriteDB *db, const uint16_t *window, size_t len, bool flags) {
+    for(size_t i = 0; i < db->len; i++) {
+        if(same_window(&db->items[i], window, len, flags)) return &db->items[i];
+    }
+    return NULL;
+}
+
+static bool rewrite_db_add(RewriteDB *db, const Rewrite *r) {
+    if(db->len == db->cap) {
+        size_t cap = db->cap == 0 ? 64 : db->cap * 2;
+        Rewrite *grown = realloc(db->items, sizeof(Rewrite) * cap);
+        if(grown == NULL) return false;
+        db->items = grown;
+        db->cap = cap;
+    }
+    db->items[db->len++] = *r;
+    return true;
+}
+
+// reads up to max hex words, returns the number read or -1 if something else is in the way
+static int read_words(char **s, uint16_t *words, int max) {
+    int n = 0;
+    while(true) {
+        while(**s == ' ' || **s == '\t' || **s == '\r') (*s)++;
+        if(!isxdigit((unsigned char) **s)) return n;
+
+        char *end;
+        unsigned long word = strtoul(*s, &end, 16);
+        if(n == max || word > 0xFFFF) return -1;
+        words[n++] = (uint16_t) word;
+        *s = end;
+    }
+}
+
+bool rewrite_db_load(RewriteDB *db, const char *path) {
+    memset(db, 0, sizeof(RewriteDB));
+    if(access(path, F_OK) != 0) return true;
+
+    char *buf = NULL;
+    size_t cap = 0, len;
+    if(!read_file(path, &buf, &cap, &len)) {
+        free(buf);
+        return false;
+    }
+
+    bool ok = true, same_target = false, foreign = false;
+    int line_num = 0;
+    for(char *line = buf; ok && !foreign && line != NULL; ) {
+        char *next = strchr(line, '\n');
+        if(next != NULL) *next++ = '\0';
+        line_num++;
+        line[strcspn(line, ";")] = '\0';
+
+        // the target line has to come before the first rewrite
+        char name[32], end;
+        int dseg, cseg, regs;
+        if(!same_target && sscanf(line, " target %31s %d %d %d %c", name, &dseg, &cseg, &regs, &end) == 4) {
+            same_target = strcmp(name, target.name) == 0 && dseg == DSEG_SIZE && cseg == CSEG_SIZE && regs == target.num_regs;
+            foreign = !same_target;
+        } else if(!is_blank(line) && !same_target) {
+            foreign = true;
+        } else if(!is_blank(line)) {
+            Rewrite r = {0};
+            char *s = line + strspn(line, " \t");
+            if(strncmp(s, "exact ", 6) == 0) {
+                r.flags = true;
+                s += 6;
+            } else if(strncmp(s, "noflags ", 8) == 0) {
+                s += 8;
+            } else {
+                ok = false;
+            }
+
+            int window_len = ok ? read_words(&s, r.window, SUPEROPT_WINDOW) : -1;
+            ok = window_len > 0 && strncmp(s, "=>", 2) == 0;
+            if(ok) {
+                s += 2;
+                r.window_len = window_len;
+                r.found = strncmp(s + strspn(s, " \t"), "none", 4) != 0;
+                int repl_len = r.found ? read_words(&s, r.repl, window_len - 1) : 0;
+                if(!r.found) s += strspn(s, " \t") + 4;
+                ok = repl_len >= 0 && is_blank(s);
+                r.repl_len = repl_len;
+            }
+            if(ok) ok = rewrite_db_add(db, &r);
+        }
+        line = next;
+    }
+
+    if(!ok) {
+        printf("%s:%d: invalid rewrite\n", path, line_num);
+        rewrite_db_free(db);
+    } else if(foreign) {
+        printf("%s was built for another target, starting a new database\n", path);
+        rewrite_db_free(db);
+    }
+    free(buf);
+    return ok;
+}
+
+bool rewrite_db_save(const RewriteDB *db, const char *path) {
+    char *out_data;
+    size_t out_len;
+    FILE *out_file = open_memstream(&out_data, &out_len);
+    if(out_file == NULL) return false;
+
+    fprintf(out_file, "; i281 rewrite database, window => shortest equivalent sequence\n");
+    fprintf(out_file, "target %s %d %d %d\n", target.name, DSEG_SIZE, CSEG_SIZE, target.num_regs);
+    for(size_t i = 0; i < db->len; i++) {
+        const Rewrite *r = &db->items[i];
+        fprintf(out_file, "%s", r->flags ? "exact" : "noflags");
+        for(int w = 0; w < r->window_len; w++) fprintf(out_file, " %04X", r->window[w]);
+        fprintf(out_file, " =>");
+        if(!r->found) fprintf(out_file, " none");
+        for(int w = 0; w < r->repl_len; w++) fprintf(out_file, " %04X", r->repl[w]);
+        fputc('\n', out_file);
+    }
+    fclose(out_file);
+
+    bool ok = write_file_if_changed(path, out_data, out_len) >= 0;
+    free(out_data);
+    return ok;
+}
+
+void rewrite_db_free(RewriteDB *db) {
+    free(db->items);
+    memset(db, 0, sizeof(RewriteDB));
+}
+
+// checks that the window starting at i is straight-line code that is only ever entered at its first instruction
+static bool is_window(const InstIR *ir, const bool *leader, size_t i, size_t len) {
+    if(i + len > ir->len) return false;
+    for(size_t j = i; j < i + len; j++) {
+        if(!superopt_allowed(ir->opcode[j]) || (j > i && leader[j])) return false;
+    }
+    return true;
+}
+
+// the entry to use for the window, or NULL if there is nothing shorter to replace it with
+static const Rewrite *best_rewrite(const RewriteDB *db, const uint16_t *window, size_t len, bool flags_dead) {
+    const Rewrite *r = rewrite_db_find(db, window, len, true);
+    if(flags_dead) {
+        const Rewrite *any = rewrite_db_find(db, window, len, false);
+        if(any != NULL && any->found && (r == NULL || !r->found || any->repl_len < r->repl_len)) r = any;
+    }
+    return r != NULL && r->found ? r : NULL;
+}
+
+bool peephole(InstIR *ir, const SymbolTable *syms, RewriteDB *db, bool search, int threads, PeepholeStats *stats) {
+    memset(stats, 0, sizeof(PeepholeStats));
+    stats->words_before = ir->len;
+    stats->words_after = ir->len;
+    if(ir->len == 0) return true;
+
+    int *target = malloc(sizeof(int) * ir->len);
+    bool *leader = calloc(ir->len + 1, sizeof(bool));
+    bool *dead = malloc(sizeof(bool) * (ir->len + 1));
+    bool *keep = malloc(sizeof(bool) * ir->len);
+    int *new_index = malloc(sizeof(int) * (ir->len + 1));
+    bool ok = target != NULL && leader != NULL && dead != NULL && keep != NULL && new_index != NULL;
+
+    if(ok && !cfg_find_targets(ir, syms, target)) {
+        stats->skipped = true;
+    } else if(ok) {
+        for(size_t i = 0; i < ir->len; i++) {
+            if(target[i] >= 0) leader[target[i]] = true;
+        }
+        for(size_t i = 0; i <= ir->len; i++) dead[i] = cfg_flags_dead(ir, target, i);
+
+        // search every window the database does not know yet, each one only once
+        for(size_t i = 0; ok && search && i < ir->len; i++) {
+            for(size_t len = 1; ok && len <= SUPEROPT_WINDOW && is_window(ir, leader, i, len); len++) {
+                for(int flags = 1; ok && flags >= 0; flags--) {
+                    if(!flags && !dead[i + len]) continue;
+                    if(rewrite_db_find(db, &ir->opcode[i], len, flags) != NULL) continue;
+
+                    Rewrite r;
+                    ok = superopt_search(&ir->opcode[i], len, flags, threads, &r) && rewrite_db_add(db, &r);
+                    stats->searched++;
+                }
+            }
+        }
+
+        // the longest window that saves the most is replaced, then the scan carries on after it
+        for(size_t i = 0; ok && i < ir->len; i++) keep[i] = true;
+        for(size_t i = 0; ok && i < ir->len; ) {
+            const Rewrite *best = NULL;
+            for(size_t len = 1; len <= SUPEROPT_WINDOW && is_window(ir, leader, i, len); len++) {
+                const Rewrite *r = best_rewrite(db, &ir->opcode[i], len, dead[i + len]);
+                if(r != NULL && (best == NULL || r->window_len - r->repl_len >= best->window_len - best->repl_len)) best = r;
+            }
+
+            if(best == NULL) {
+                i++;
+                continue;
+            }
+
+            for(size_t j = 0; j < best->window_len; j++) {
+                if(j < best->repl_len) {
+                    ir->opcode[i + j] = best->repl[j];
+                    ir->operand_kinds[i + j] = pattern_kinds[inst_table[isa_decode(best->repl[j])].pattern];
+                    ir->sym_ref[i + j] = -1;
+                } else {
+                    keep[i + j] = false;
+                }
+            }
+            stats->rewritten++;
+            i += best->window_len;
+        }
+
+        // a deleted instruction maps to the one that took its place, like in the control flow pass
+        int kept = 0;
+        for(size_t i = 0; ok && i < ir->len; i++) {
+            new_index[i] = kept;
+            if(keep[i]) kept++;
+        }
+        new_index[ir->len] = kept;
+
+        for(size_t i = 0; ok && i < ir->len; i++) {
+            if(!keep[i] || target[i] < 0) continue;
+            int offset = new_index[target[i]] - new_index[i] - 1;
+            ir->opcode[i] = (ir->opcode[i] & 0xFF00) | (uint8_t) offset;
+        }
+
+        if(ok) ir_remove(ir, keep);
+        stats->words_after = ir->len;
+    }
+
+    free(target);
+    free(leader);
+    free(dead);
+    free(keep);
+    free(new_index);
+    return ok;
+}
@@ -0,0 +1,71 @@
+#include "target.h"
+
+#include <ctype.h>
+#include "fileio.h"
+
+// the machine the assembler was written for, which every target file starts from
+#define I281_TARGET {"i281", 16, 64, 4, 15, 63}
+
+Target target = I281_TARGET;
+
+static bool is_power_of_two(long n) {
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+bool target_load(const char *path) {
+    char *buf = NULL;
+    size_t cap = 0, len;
+    if(!read_file(path, &buf, &cap, &len)) {
+        free(buf);
+        return false;
+    }
+
+    // a setting taken out of the file goes back to its i281 value when watch mode loads it again
+    Target loaded = I281_TARGET;
+    bool ok = true;
+    int line_num = 0;
+    for(char *line = buf; ok && line != NULL; ) {
+        char *next = strchr(line, '\n');
+        if(next != NULL) *next++ = '\0';
+        line_num++;
+        line[strcspn(line, ";#\r")] = '\0';
+
+        char key[16], value[64];
+        int fields = sscanf(line, "%15s %63s", key, value);
+        if(fields <= 0) {
+            line = next;
+            continue;
+        }
+
+        char *end = value;
+        long n = fields == 2 ? strtol(value, &end, 0) : 0;
+        bool number = fields == 2 && end != value && *end == '\0';
+        if(fields == 2 && strcmp(key, "name") == 0) {
+            snprintf(loaded.name, sizeof(loaded.name), "%.31s", value);
+        } else if(strcmp(key, "dseg") == 0) {
+            ok = number && is_power_of_two(n) && n <= TARGET_DSEG_MAX;
+            if(!ok) printf("%s:%d: dseg must be a power of two up to %d\n", path, line_num, TARGET_DSEG_MAX);
+            loaded.dseg_size = n;
+        } else if(strcmp(key, "cseg") == 0) {
+            ok = number && is_power_of_two(n) && n <= TARGET_CSEG_MAX;
+            if(!ok) printf("%s:%d: cseg must be a power of two up to %d\n", path, line_num, TARGET_CSEG_MAX);
+            loaded.cseg_size = n;
+        } else if(strcmp(key, "regs") == 0) {
+            ok = number && n >= 1 && n <= 4;
+            if(!ok) printf("%s:%d: regs must be between 1 and 4, the register fields are 2 bits\n", path, line_num);
+            loaded.num_regs = n;
+        } else {
+            printf("%s:%d: unknown target setting \"%s\"\n", path, line_num, key);
+            ok = false;
+        }
+        line = next;
+    }
+    free(buf);
+
+    if(ok) {
+        loaded.dseg_mask = loaded.dseg_size - 1;
+        loaded.cseg_mask = loaded.cseg_size - 1;
+        target = loaded;
+    }
+    return ok;
+}
@@ -0,0 +1,288 @@
+#include "trace.h"
+
+#include "isa.h"
+#include "fileio.h"
+
+bool trace_init(TraceBuffer *trace, uint32_t size, uint64_t first_step) {
+    uint32_t cap = 1;
+    while(cap < size && cap < (1u << 31)) cap <<= 1;
+
+    trace->records = malloc(sizeof(TraceRecord) * cap);
+    if(trace->records == NULL) return false;
+    trace->mask = cap - 1;
+    atomic_init(&trace->head, 0);
+    trace->first_step = first_step;
+    return true;
+}
+
+void trace_free(TraceBuffer *trace) {
+    free(trace->records);
+    trace->records = NULL;
+}
+
+// the simulator is the only writer, the release store lets a reader on another thread see finished records only
+static inline void trace_push(TraceBuffer *trace, const TraceRecord *rec) {
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    trace->records[head & trace->mask] = *rec;
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+bool parse_trigger(const char *s, TraceTrigger *trigger) {
+    static const struct {
+        const char *prefix;
+        TriggerKind kind;
+    } kinds[] = {{"pc=", TRIGGER_PC}, {"write=", TRIGGER_WRITE}, {"step=", TRIGGER_STEP}};
+
+    for(size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        size_t len = strlen(kinds[i].prefix);
+        if(strncmp(s, kinds[i].prefix, len) != 0) continue;
+
+        char *end;
+        trigger->value = strtoull(s + len, &end, 0);
+        trigger->kind = kinds[i].kind;
+        return end != s + len && *end == '\0';
+    }
+    return false;
+}
+
+// works out which register or memory cell the instruction at the PC is about to change
+static uint16_t trace_dest(const SimState *state, uint16_t word) {
+    uint8_t rx = (word >> 10) & 0x3;
+    uint8_t ry = (word >> 8) & 0x3;
+    uint8_t low = word & 0xFF;
+
+    switch(isa_decode(word)) {
+        case INST_INPUTC:
+            return TRACE_CMEM | (low & CSEG_MASK);
+        case INST_INPUTCF:
+            return TRACE_CMEM | ((uint8_t) (low + state->regs[rx]) & CSEG_MASK);
+        case INST_INPUTD:
+        case INST_STORE:
+            return TRACE_DMEM | (low & DSEG_MASK);
+        case INST_INPUTDF:
+            return TRACE_DMEM | ((uint8_t) (low + state->regs[rx]) & DSEG_MASK);
+        case INST_STOREF:
+            return TRACE_DMEM | ((uint8_t) (low + state->regs[ry]) & DSEG_MASK);
+        case INST_MOVE:
+        case INST_LOADI:
+        case INST_ADD:
+        case INST_ADDI:
+        case INST_SUB:
+        case INST_SUBI:
+        case INST_LOAD:
+        case INST_LOADF:
+        case INST_SHIFTL:
+        case INST_SHIFTR:
+            return rx;
+        default:
+            return TRACE_NONE;
+    }
+}
+
+SimStatus sim_run_traced(SimState *state, const SimInput *input, uint64_t max_steps, TraceBuffer *trace,
+                         const TraceTrigger *trigger, bool *triggered) {
+    *triggered = false;
+    if(state->status == SIM_HALTED) return SIM_HALTED;
+    state->status = SIM_RUNNING;
+
+    while(state->steps < max_steps) {
+        // running off the end executes nothing, so there is nothing to record
+        if(state->pc >= state->code_len) return sim_step(state, input);
+
+        TraceRecord rec;
+        rec.pc = state->pc;
+        rec.opcode = state->cmem[state->pc];
+        rec.dest = trace_dest(state, rec.opcode);
+
+        SimStatus status = sim_step(state, input);
+        if(status == SIM_NO_INPUT) return status;
+
+        if(rec.dest == TRACE_NONE) rec.value = 0;
+        else if(rec.dest & TRACE_CMEM) rec.value = state->cmem[rec.dest & ~TRACE_CMEM];
+        else if(rec.dest & TRACE_DMEM) rec.value = state->dmem[rec.dest & ~TRACE_DMEM];
+        else rec.value = state->regs[rec.dest];
+        rec.flags = state->flags;
+        trace_push(trace, &rec);
+
+        switch(trigger->kind) {
+            case TRIGGER_PC: *triggered = rec.pc == trigger->value; break;
+            case TRIGGER_WRITE: *triggered = rec.dest == (TRACE_DMEM | trigger->value); break;
+            case TRIGGER_STEP: *triggered = state->steps == trigger->value; break;
+            default: break;
+        }
+        if(*triggered) return SIM_RUNNING;
+        if(status != SIM_RUNNING) return status;
+    }
+    return SIM_RUNNING;
+}
+
+// the trace file starts with a magic number and version, then every value is written in little endian
+#define TRACE_MAGIC "i281trac"
+#define TRACE_VERSION 2
+#define TRACE_RECORD_LEN 9
+
+static void put_le(FILE *out_file, uint64_t val, int bytes) {
+    for(int i = 0; i < bytes; i++) fputc((uint8_t) (val >> (8 * i)), out_file);
+}
+
+static bool get_le(const uint8_t **p, const uint8_t *end, uint64_t *val, int bytes) {
+    if(end - *p < bytes) return false;
+    *val = 0;
+    for(int i = 0; i < bytes; i++) *val |= (uint64_t) *(*p)++ << (8 * i);
+    return true;
+}
+
+bool trace_save(const TraceBuffer *trace, const char *path, const char *source, const InstIR *ir) {
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    uint64_t count = head < (uint64_t) trace->mask + 1 ? head : (uint64_t) trace->mask + 1;
+
+    char *out_data;
+    size_t out_len;
+    FILE *out_file = open_memstream(&out_data, &out_len);
+    if(out_file == NULL) return false;
+
+    fwrite(TRACE_MAGIC, 1, 8, out_file);
+    put_le(out_file, TRACE_VERSION, 2);
+    put_le(out_file, trace->first_step + head - count, 8); // instruction count before the oldest record
+    put_le(out_file, count, 4);
+
+    put_le(out_file, ir->len, 4);
+    for(size_t i = 0; i < ir->len; i++) put_le(out_file, ir->line[i], 4);
+    size_t source_len = strlen(source);
+    put_le(out_file, source_len, 2);
+    fwrite(source, 1, source_len, out_file);
+
+    // oldest record first
+    for(uint64_t i = head - count; i < head; i++) {
+        const TraceRecord *rec = &trace->records[i & trace->mask];
+        put_le(out_file, rec->pc, 2);
+        put_le(out_file, rec->opcode, 2);
+        put_le(out_file, rec->value, 2);
+        put_le(out_file, rec->dest, 2);
+        put_le(out_file, rec->flags, 1);
+    }
+    fclose(out_file);
+
+    bool ok = write_file_if_changed(path, out_data, out_len) >= 0;
+    free(out_data);
+    return ok;
+}
+
+// splits the source into lines in place, returns the number of lines
+// if memory runs out the lines split so far are kept, they are only there to be shown next to the trace
+static int split_lines(char *buf, char ***lines) {
+    int num_lines = 0, cap = 0;
+    *lines = NULL;
+    for(char *line = buf; line != NULL && *line != '\0'; ) {
+        char *next = strchr(line, '\n');
+        if(next != NULL) *next++ = '\0';
+        line[strcspn(line, "\r")] = '\0';
+
+        if(num_lines == cap) {
+            cap = cap == 0 ? 64 : cap * 2;
+            char **grown = realloc(*lines, sizeof(char *) * cap);
+            if(grown == NULL) break;
+            *lines = grown;
+        }
+        (*lines)[num_lines++] = line;
+        line = next;
+    }
+    return num_lines;
+}
+
+static void print_change(FILE *out_file, const TraceRecord *rec) {
+    char change[24];
+    if(rec->dest == TRACE_NONE) snprintf(change, sizeof(change), "-");
+    else if(rec->dest & TRACE_CMEM) snprintf(change, sizeof(change), "code[%d] = 0x%04X", rec->dest & ~TRACE_CMEM, rec->value);
+    else if(rec->dest & TRACE_DMEM) snprintf(change, sizeof(change), "[%d] = %d", rec->dest & ~TRACE_DMEM, (int8_t) rec->value);
+    else snprintf(change, sizeof(change), "%c = %d", 'A' + rec->dest, (int8_t) rec->value);
+    fprintf(out_file, "%-18s", change);
+}
+
+bool trace_decode(const char *path, FILE *out_file) {
+    char *buf = NULL;
+    size_t cap = 0, len;
+    if(!read_file(path, &buf, &cap, &len)) {
+        free(buf);
+        return false;
+    }
+
+    const uint8_t *p = (const uint8_t *) buf;
+    const uint8_t *end = p + len;
+    uint64_t version, first_step, count, num_lines, source_len;
+    uint32_t *pc_lines = NULL;
+    char *source = NULL, *source_buf = NULL, **lines = NULL;
+    int num_source_lines = 0;
+    bool ok = false;
+    bool no_memory = false;
+
+    if(len < 8 || memcmp(p, TRACE_MAGIC, 8) != 0) goto done;
+    p += 8;
+    if(!get_le(&p, end, &version, 2) || version != TRACE_VERSION) goto done;
+    if(!get_le(&p, end, &first_step, 8) || !get_le(&p, end, &count, 4) || !get_le(&p, end, &num_lines, 4)) goto done;
+    if((uint64_t) (end - p) < num_lines * 4) goto done;
+
+    pc_lines = malloc(sizeof(uint32_t) * (num_lines + 1));
+    if(pc_lines == NULL) {
+        no_memory = true;
+        goto done;
+    }
+    for(uint64_t i = 0; i < num_lines; i++) {
+        uint64_t line;
+        get_le(&p, end, &line, 4);
+        pc_lines[i] = line;
+    }
+
+    if(!get_le(&p, end, &source_len, 2) || (uint64_t) (end - p) < source_len) goto done;
+    source = strndup((const char *) p, source_len);
+    if(source == NULL) {
+        no_memory = true;
+        goto done;
+    }
+    p += source_len;
+    if((uint64_t) (end - p) != count * TRACE_RECORD_LEN) goto done;
+
+    // the source is only for showing the lines, the trace can still be read without it
+    size_t source_cap = 0, source_file_len;
+    FILE *check = fopen(source, "r");
+    if(check != NULL) {
+        fclose(check);
+        if(read_file(source, &source_buf, &source_cap, &source_file_len)) num_source_lines = split_lines(source_buf, &lines);
+    }
+
+    fprintf(out_file, "Trace of %llu instructions from %s\n", (unsigned long long) count, source);
+    fprintf(out_file, "%8s %3s %-4s  %-24s %-18s %-4s  %s\n", "step", "pc", "word", "instruction", "change", "flag", "source");
+    for(uint64_t i = 0; i < count; i++) {
+        uint64_t pc, opcode, value, dest, flags;
+        get_le(&p, end, &pc, 2);
+        get_le(&p, end, &opcode, 2);
+        get_le(&p, end, &value, 2);
+        get_le(&p, end, &dest, 2);
+        get_le(&p, end, &flags, 1);
+        TraceRecord rec = {pc, opcode, value, dest, flags};
+
+        char text[32];
+        isa_disassemble(rec.opcode, text, sizeof(text));
+        fprintf(out_file, "%8llu %3d %04X  %-24s ", (unsigned long long) (first_step + i + 1), rec.pc, rec.opcode, text);
+        print_change(out_file, &rec);
+        fprintf(out_file, " %c%c%c%c  ", rec.flags & FLAG_C ? 'C' : '-', rec.flags & FLAG_N ? 'N' : '-',
+                rec.flags & FLAG_O ? 'O' : '-', rec.flags & FLAG_Z ? 'Z' : '-');
+
+        // code written by INPUTC has no source line
+        uint32_t line = rec.pc < num_lines ? pc_lines[rec.pc] : 0;
+        if(line > 0 && (int) line <= num_source_lines) fprintf(out_file, "%4u: %s\n", line, lines[line - 1] + strspn(lines[line - 1], " \t"));
+        else if(line > 0) fprintf(out_file, "%4u\n", line);
+        else fputc('\n', out_file);
+    }
+    ok = true;
+
+done:
+    if(no_memory) printf("Error allocating memory\n");
+    else if(!ok) printf("%s is not a valid trace\n", path);
+    free(lines);
+    free(source_buf);
+    free(source);
+    free(pc_lines);
+    free(buf);
+    return ok;
+}
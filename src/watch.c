@@ -0,0 +1,108 @@
+#include "watch.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+// how long to wait for more events after a change before rebuilding, editors often save with several writes
+#define SETTLE_MS 50
+
+typedef struct {
+    int wd; // watch descriptor of the directory containing the file
+    char *name; // name of the file within that directory
+} WatchedFile;
+
+// splits path into the directory to watch and the file name inside it
+static char *split_dir(const char *path, const char **name) {
+    const char *slash = strrchr(path, '/');
+    if(slash == NULL) {
+        *name = path;
+        return strdup(".");
+    }
+
+    *name = slash + 1;
+    if(slash == path) return strdup("/");
+    return strndup(path, slash - path);
+}
+
+// reads all pending events, returning true if any of them touched a watched file
+static bool drain_events(int fd, WatchedFile *files, int num_files) {
+    char buff[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+
+    ssize_t n;
+    while((n = read(fd, buff, sizeof(buff))) > 0) {
+        for(char *p = buff; p < buff + n; ) {
+            struct inotify_event *event = (struct inotify_event *) p;
+            for(int i = 0; i < num_files; i++) {
+                if(event->wd == files[i].wd && event->len > 0 && strcmp(event->name, files[i].name) == 0) changed = true;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return changed;
+}
+
+int watch_files(const char **paths, int num_paths, RebuildFn rebuild, void *ctx) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd < 0) {
+        printf("Error starting watch: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // directories are watched rather than the files themselves, since many editors save by renaming a new file
+    // over the old one, which would silently end a watch on the original inode
+    int num_files = 0;
+    WatchedFile *files = malloc(sizeof(WatchedFile) * num_paths);
+    if(files == NULL) {
+        printf("Error allocating memory\n");
+        goto cleanup;
+    }
+    for(; num_files < num_paths; num_files++) {
+        const char *name;
+        char *dir = split_dir(paths[num_files], &name);
+        char *name_copy = strdup(name);
+        if(dir == NULL || name_copy == NULL) {
+            printf("Error allocating memory\n");
+            free(dir);
+            free(name_copy);
+            goto cleanup;
+        }
+
+        int wd = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if(wd < 0) {
+            printf("Error watching %s: %s\n", dir, strerror(errno));
+            free(dir);
+            free(name_copy);
+            goto cleanup;
+        }
+        free(dir);
+        files[num_files].wd = wd;
+        files[num_files].name = name_copy;
+    }
+
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    while(true) {
+        if(poll(&pfd, 1, -1) < 0) {
+            if(errno == EINTR) continue;
+            printf("Error waiting for changes: %s\n", strerror(errno));
+            break;
+        }
+
+        if(!drain_events(fd, files, num_files)) continue;
+
+        // let the rest of the save finish before reassembling
+        while(poll(&pfd, 1, SETTLE_MS) > 0) drain_events(fd, files, num_files);
+
+        rebuild(ctx);
+    }
+
+cleanup:
+    for(int i = 0; i < num_files; i++) free(files[i].name);
+    free(files);
+    close(fd);
+    return -1;
+}
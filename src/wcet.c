@@ -0,0 +1,559 @@
+#include "wcet.h"
+
+#include <ctype.h>
+#include "isa.h"
+#include "cfg.h"
+
+#define WCET_INF UINT64_MAX // a count with no bound
+
+static uint64_t sat_add(uint64_t a, uint64_t b) {
+    return (a == WCET_INF || b == WCET_INF || a + b < a) ? WCET_INF : a + b;
+}
+
+static uint64_t sat_mul(uint64_t a, uint64_t b) {
+    if(a == 0 || b == 0) return 0;
+    if(a == WCET_INF || b == WCET_INF || a > WCET_INF / b) return WCET_INF;
+    return a * b;
+}
+
+static bool add_bound(LoopBounds *bounds, int line, uint32_t min, uint32_t max) {
+    if(bounds->len == bounds->cap) {
+        int cap = bounds->cap == 0 ? 16 : bounds->cap * 2;
+        LoopBound *grown = realloc(bounds->items, sizeof(LoopBound) * cap);
+        if(grown == NULL) return false;
+        bounds->items = grown;
+        bounds->cap = cap;
+    }
+    bounds->items[bounds->len++] = (LoopBound) {line, min, max};
+    return true;
+}
+
+bool wcet_read_bounds(const char *source, const ScanResult *scan, LoopBounds *bounds, DiagList *diags) {
+    bounds->len = 0;
+
+    for(int i = 0; i < scan->num_lines; i++) {
+        const ScanLine *line = &scan->lines[i];
+        if(line->comment == SCAN_NONE) continue;
+
+        // the comment runs to the end of the line, which is not null terminated here
+        const char *comment = source + line->start + line->comment;
+        size_t comment_len = line->len - line->comment;
+        const char *at = NULL;
+        for(size_t j = 0; j + 5 <= comment_len && at == NULL; j++) {
+            if(strncmp(comment + j, "@loop", 5) == 0) at = comment + j;
+        }
+        if(at == NULL) continue;
+
+        const char *s = at + 5;
+        char *end;
+        unsigned long min = 1, max = 0;
+        bool valid = *s == ' ' || *s == '\t';
+        if(valid) {
+            while(*s == ' ' || *s == '\t') s++;
+            max = strtoul(s, &end, 0);
+            valid = end != s && isdigit((unsigned char) *s);
+            s = end;
+        }
+        if(valid && s[0] == '.' && s[1] == '.') {
+            min = max;
+            s += 2;
+            max = strtoul(s, &end, 0);
+            valid = end != s && isdigit((unsigned char) *s);
+            s = end;
+        }
+        // the first instruction of a loop runs at least once every time the loop is entered
+        valid = valid && min >= 1 && max >= min && max <= UINT32_MAX && (*s == '\0' || isspace((unsigned char) *s));
+
+        if(!valid) {
+            diag_report(diags, DIAG_ERROR, E_BAD_DIRECTIVE, i + 1, (int) (at - (source + line->start)) + 1, "Invalid loop bound, expected \"@loop MAX\" or \"@loop MIN..MAX\"");
+        } else if(!add_bound(bounds, i + 1, min, max)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void wcet_free_bounds(LoopBounds *bounds) {
+    free(bounds->items);
+    bounds->items = NULL;
+    bounds->len = 0;
+    bounds->cap = 0;
+}
+
+// an edge of the collapsed graph, its counts include the node it leaves
+typedef struct {
+    int to;
+    uint64_t best;
+    uint64_t worst;
+} Edge;
+
+typedef struct {
+    Edge *items;
+    int len;
+    int cap;
+} Edges;
+
+typedef struct {
+    int header; // block the loop is entered at
+    bool *body; // blocks in the loop, inner loops included
+    int size;
+    const LoopBound *bound; // NULL if the loop has no annotation
+    uint64_t best; // instructions per entry
+    uint64_t worst;
+    bool exits; // false for a loop that only ends with the program
+} Loop;
+
+// the analysis of one program, blocks are numbered in address order and num_blocks stands for the end of the program
+typedef struct {
+    const InstIR *ir;
+    int num_blocks;
+    int *start; // first instruction of each block
+    int *end; // one past the last instruction
+    int *succ; // two successors per block, -1 where there is none
+    bool *reached; // reachable from the first instruction
+    Edges *edges;
+    int *rep; // the node a block was collapsed into, itself if it was not
+    Loop *loops;
+    int num_loops;
+    // scratch space for walk_dag
+    uint64_t *best;
+    uint64_t *worst;
+    bool *seen;
+    int *indegree;
+    int *order;
+    int order_len;
+} Wcet;
+
+static int find_rep(Wcet *w, int n) {
+    if(n == w->num_blocks) return n;
+    while(w->rep[n] != n) {
+        w->rep[n] = w->rep[w->rep[n]];
+        n = w->rep[n];
+    }
+    return n;
+}
+
+static bool push_edge(Edges *edges, int to, uint64_t best, uint64_t worst) {
+    if(edges->len == edges->cap) {
+        int cap = edges->cap == 0 ? 4 : edges->cap * 2;
+        Edge *grown = realloc(edges->items, sizeof(Edge) * cap);
+        if(grown == NULL) return false;
+        edges->items = grown;
+        edges->cap = cap;
+    }
+    edges->items[edges->len++] = (Edge) {to, best, worst};
+    return true;
+}
+
+// finds the shortest and longest counts from start to every node in member, walking the nodes in topological order
+// edges to skip_to and to nodes outside member are left for the caller, returns false if member has a cycle
+static bool walk_dag(Wcet *w, int start, const bool *member, int skip_to) {
+    int n = w->num_blocks;
+    for(int i = 0; i < n; i++) {
+        w->best[i] = WCET_INF;
+        w->worst[i] = 0;
+        w->seen[i] = false;
+        w->indegree[i] = 0;
+    }
+
+    // only the part of member that start reaches counts towards the in-degrees
+    w->order_len = 0;
+    w->order[w->order_len++] = start;
+    w->seen[start] = true;
+    for(int k = 0; k < w->order_len; k++) {
+        const Edges *edges = &w->edges[w->order[k]];
+        for(int e = 0; e < edges->len; e++) {
+            int to = find_rep(w, edges->items[e].to);
+            if(to == n || to == skip_to || !member[to]) continue;
+            w->indegree[to]++;
+            if(!w->seen[to]) {
+                w->seen[to] = true;
+                w->order[w->order_len++] = to;
+            }
+        }
+    }
+    int reached = w->order_len;
+
+    // Kahn's algorithm, order is reused as the queue
+    w->order_len = 0;
+    w->order[w->order_len++] = start;
+    w->best[start] = 0;
+    w->worst[start] = 0;
+    for(int k = 0; k < w->order_len; k++) {
+        int from = w->order[k];
+        const Edges *edges = &w->edges[from];
+        for(int e = 0; e < edges->len; e++) {
+            const Edge *edge = &edges->items[e];
+            int to = find_rep(w, edge->to);
+            if(to == n || to == skip_to || !member[to]) continue;
+
+            uint64_t best = sat_add(w->best[from], edge->best);
+            uint64_t worst = sat_add(w->worst[from], edge->worst);
+            if(best < w->best[to]) w->best[to] = best;
+            if(worst > w->worst[to]) w->worst[to] = worst;
+            if(--w->indegree[to] == 0) w->order[w->order_len++] = to;
+        }
+    }
+    return w->order_len == reached;
+}
+
+static const LoopBound *find_bound(const LoopBounds *bounds, uint32_t line) {
+    for(int i = 0; i < bounds->len; i++) {
+        if(bounds->items[i].line == (int) line) return &bounds->items[i];
+    }
+    return NULL;
+}
+
+// collapses the loop into its header, whose edges become the ways out of the loop with the cost of getting there
+static bool collapse_loop(Wcet *w, Loop *loop, bool *member, FILE *out) {
+    int n = w->num_blocks;
+    int h = loop->header;
+
+    // inner loops were collapsed already, so they stand in for their blocks
+    for(int i = 0; i < n; i++) member[i] = false;
+    for(int i = 0; i < n; i++) {
+        if(!loop->body[i]) continue;
+        int rep = find_rep(w, i);
+        if(!loop->body[rep]) {
+            fprintf(out, "Cannot analyze, the loops at lines %u and %u overlap without one being inside the other\n",
+                    w->ir->line[w->start[h]], w->ir->line[w->start[rep]]);
+            return false;
+        }
+        member[rep] = true;
+    }
+
+    if(!walk_dag(w, h, member, h)) {
+        fprintf(out, "Cannot analyze, the loop at line %u has a cycle that does not go through its first instruction\n", w->ir->line[w->start[h]]);
+        return false;
+    }
+
+    // one pass round the loop, and the way out to each place the loop can leave to
+    uint64_t iter_best = WCET_INF, iter_worst = 0;
+    Edges exits = {0};
+    for(int k = 0; k < w->order_len; k++) {
+        int from = w->order[k];
+        const Edges *edges = &w->edges[from];
+        for(int e = 0; e < edges->len; e++) {
+            const Edge *edge = &edges->items[e];
+            int to = find_rep(w, edge->to);
+            uint64_t best = sat_add(w->best[from], edge->best);
+            uint64_t worst = sat_add(w->worst[from], edge->worst);
+
+            if(to == h) {
+                if(best < iter_best) iter_best = best;
+                if(worst > iter_worst) iter_worst = worst;
+            } else if(to == n || !member[to]) {
+                int x;
+                for(x = 0; x < exits.len && exits.items[x].to != to; x++) ;
+                if(x == exits.len && !push_edge(&exits, to, best, worst)) {
+                    free(exits.items);
+                    return false;
+                }
+                if(best < exits.items[x].best) exits.items[x].best = best;
+                if(worst > exits.items[x].worst) exits.items[x].worst = worst;
+            }
+        }
+    }
+
+    // the header runs up to max times, so the loop goes round max - 1 times before leaving on the last run
+    uint64_t min = loop->bound != NULL ? loop->bound->min : 1;
+    uint64_t max = loop->bound != NULL ? loop->bound->max : WCET_INF;
+    loop->exits = exits.len > 0;
+    if(!loop->exits) {
+        // a loop that never leaves ends the program once its bound runs out
+        if(!push_edge(&exits, n, sat_mul(min, iter_best), sat_mul(max, iter_worst))) return false;
+    } else {
+        for(int x = 0; x < exits.len; x++) {
+            exits.items[x].best = sat_add(exits.items[x].best, sat_mul(min - 1, iter_best == WCET_INF ? 0 : iter_best));
+            exits.items[x].worst = sat_add(exits.items[x].worst, sat_mul(max == WCET_INF ? WCET_INF : max - 1, iter_worst));
+        }
+    }
+
+    loop->best = WCET_INF;
+    loop->worst = 0;
+    for(int x = 0; x < exits.len; x++) {
+        if(exits.items[x].best < loop->best) loop->best = exits.items[x].best;
+        if(exits.items[x].worst > loop->worst) loop->worst = exits.items[x].worst;
+    }
+
+    for(int i = 0; i < n; i++) {
+        if(member[i] && i != h) w->rep[i] = h;
+    }
+    free(w->edges[h].items);
+    w->edges[h] = exits;
+    return true;
+}
+
+// finds every loop from the backward edges, merging loops that share a first block
+static bool find_loops(Wcet *w, FILE *out) {
+    int n = w->num_blocks;
+    int *stack = w->order; // not in use yet
+
+    for(int b = 0; b < n; b++) {
+        if(!w->reached[b]) continue;
+        for(int s = 0; s < 2; s++) {
+            int h = w->succ[2 * b + s];
+            if(h < 0 || h == n || w->start[h] > w->start[b]) continue;
+
+            Loop *loop = NULL;
+            for(int l = 0; l < w->num_loops; l++) {
+                if(w->loops[l].header == h) loop = &w->loops[l];
+            }
+            if(loop == NULL) {
+                loop = &w->loops[w->num_loops++];
+                loop->header = h;
+                loop->body = calloc(n, sizeof(bool));
+                loop->size = 1;
+                loop->bound = NULL;
+                if(loop->body == NULL) return false;
+                loop->body[h] = true;
+            }
+
+            // everything that reaches the backward branch without passing the header is in the loop
+            int top = 0;
+            if(!loop->body[b]) {
+                loop->body[b] = true;
+                loop->size++;
+                stack[top++] = b;
+            }
+            while(top > 0) {
+                int m = stack[--top];
+                for(int p = 0; p < n; p++) {
+                    if(!w->reached[p] || loop->body[p] || (w->succ[2 * p] != m && w->succ[2 * p + 1] != m)) continue;
+                    loop->body[p] = true;
+                    loop->size++;
+                    stack[top++] = p;
+                }
+            }
+        }
+    }
+
+    // a loop entered anywhere but its first block has no single count for how often it runs
+    for(int l = 0; l < w->num_loops; l++) {
+        const Loop *loop = &w->loops[l];
+        if(loop->header != 0 && loop->body[0]) {
+            fprintf(out, "Cannot analyze, the branch back to line %u does not close a loop\n", w->ir->line[w->start[loop->header]]);
+            return false;
+        }
+        for(int p = 0; p < n; p++) {
+            if(!w->reached[p] || loop->body[p]) continue;
+            for(int s = 0; s < 2; s++) {
+                int to = w->succ[2 * p + s];
+                if(to >= 0 && to < n && to != loop->header && loop->body[to]) {
+                    fprintf(out, "Cannot analyze, control enters the loop at line %u at line %u instead of at its first instruction\n",
+                            w->ir->line[w->start[loop->header]], w->ir->line[w->start[to]]);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static void print_count(FILE *out, int width, uint64_t count) {
+    if(count == WCET_INF) fprintf(out, " %*s", width, "unbounded");
+    else fprintf(out, " %*llu", width, (unsigned long long) count);
+}
+
+static void free_wcet(Wcet *w) {
+    for(int b = 0; w->edges != NULL && b < w->num_blocks; b++) free(w->edges[b].items);
+    for(int l = 0; w->loops != NULL && l < w->num_loops; l++) free(w->loops[l].body);
+    free(w->start);
+    free(w->end);
+    free(w->succ);
+    free(w->reached);
+    free(w->edges);
+    free(w->rep);
+    free(w->loops);
+    free(w->best);
+    free(w->worst);
+    free(w->seen);
+    free(w->indegree);
+    free(w->order);
+}
+
+bool wcet_analyze(const InstIR *ir, const SymbolTable *syms, const LoopBounds *bounds, FILE *out) {
+    int len = ir->len;
+    if(len == 0) {
+        fprintf(out, "Best case 0 instructions, worst case 0 instructions\n");
+        return true;
+    }
+
+    Wcet w = {0};
+    w.ir = ir;
+    int *target = malloc(sizeof(int) * len);
+    bool *leader = calloc(len + 1, sizeof(bool));
+    int *block_of = malloc(sizeof(int) * (len + 1));
+    bool *member = NULL;
+    bool ok = target != NULL && leader != NULL && block_of != NULL;
+    if(!ok) printf("Error allocating memory\n");
+
+    if(ok && !cfg_find_targets(ir, syms, target)) {
+        fprintf(out, "Cannot analyze, the program writes its own code or uses a code label as a value\n");
+        ok = false;
+    }
+
+    if(ok) {
+        // blocks start at the entry, at every branch target and after every branch
+        leader[0] = true;
+        for(int i = 0; i < len; i++) {
+            if(target[i] < 0) continue;
+            leader[target[i]] = true;
+            leader[i + 1] = true;
+        }
+        int n = 0;
+        for(int i = 0; i < len; i++) {
+            if(leader[i]) n++;
+            block_of[i] = n - 1;
+        }
+        block_of[len] = n;
+        w.num_blocks = n;
+
+        w.start = malloc(sizeof(int) * n);
+        w.end = malloc(sizeof(int) * n);
+        w.succ = malloc(sizeof(int) * 2 * n);
+        w.reached = calloc(n, sizeof(bool));
+        w.edges = calloc(n, sizeof(Edges));
+        w.rep = malloc(sizeof(int) * n);
+        w.loops = malloc(sizeof(Loop) * n);
+        w.best = malloc(sizeof(uint64_t) * n);
+        w.worst = malloc(sizeof(uint64_t) * n);
+        w.seen = malloc(sizeof(bool) * n);
+        w.indegree = malloc(sizeof(int) * n);
+        w.order = malloc(sizeof(int) * n);
+        member = malloc(sizeof(bool) * n);
+        ok = w.start != NULL && w.end != NULL && w.succ != NULL && w.reached != NULL && w.edges != NULL && w.rep != NULL &&
+             w.loops != NULL && w.best != NULL && w.worst != NULL && w.seen != NULL && w.indegree != NULL && w.order != NULL && member != NULL;
+        if(!ok) printf("Error allocating memory\n");
+    }
+
+    if(ok) {
+        int n = w.num_blocks;
+        for(int i = 0; i < len; i++) {
+            if(leader[i]) w.start[block_of[i]] = i;
+            w.end[block_of[i]] = i + 1;
+        }
+
+        for(int b = 0; b < n && ok; b++) {
+            int last = w.end[b] - 1;
+            bool jump = isa_decode(ir->opcode[last]) == INST_JUMP;
+            w.succ[2 * b] = target[last] >= 0 ? block_of[target[last]] : -1;
+            w.succ[2 * b + 1] = jump ? -1 : block_of[w.end[b]];
+            w.rep[b] = b;
+
+            uint64_t words = w.end[b] - w.start[b];
+            for(int s = 0; s < 2 && ok; s++) {
+                if(w.succ[2 * b + s] >= 0) ok = push_edge(&w.edges[b], w.succ[2 * b + s], words, words);
+            }
+        }
+
+        // only the blocks the program can get to are analyzed
+        int top = 0;
+        w.order[top++] = 0;
+        w.reached[0] = true;
+        while(ok && top > 0) {
+            int b = w.order[--top];
+            for(int s = 0; s < 2; s++) {
+                int to = w.succ[2 * b + s];
+                if(to < 0 || to == n || w.reached[to]) continue;
+                w.reached[to] = true;
+                w.order[top++] = to;
+            }
+        }
+
+        ok = ok && find_loops(&w, out);
+    }
+
+    bool bounded = true;
+    if(ok) {
+        // a bound can sit on the first line of the loop or on any of its backward branches
+        for(int l = 0; l < w.num_loops; l++) {
+            Loop *loop = &w.loops[l];
+            loop->bound = find_bound(bounds, ir->line[w.start[loop->header]]);
+            for(int b = 0; b < w.num_blocks && loop->bound == NULL; b++) {
+                int last = w.end[b] - 1;
+                if(loop->body[b] && target[last] >= 0 && block_of[target[last]] == loop->header) loop->bound = find_bound(bounds, ir->line[last]);
+            }
+            if(loop->bound == NULL) {
+                fprintf(out, "Loop at line %u has no @loop bound, so its worst case is unbounded\n", ir->line[w.start[loop->header]]);
+                bounded = false;
+            }
+        }
+
+        // innermost first, an inner loop always has fewer blocks than the loops around it
+        for(int l = 1; l < w.num_loops; l++) {
+            Loop key = w.loops[l];
+            int k = l - 1;
+            for(; k >= 0 && w.loops[k].size > key.size; k--) w.loops[k + 1] = w.loops[k];
+            w.loops[k + 1] = key;
+        }
+
+        for(int l = 0; ok && l < w.num_loops; l++) ok = collapse_loop(&w, &w.loops[l], member, out);
+    }
+
+    if(ok) {
+        int n = w.num_blocks;
+
+        fprintf(out, "Block  Address  Line  Words  Max runs  Max instructions\n");
+        for(int b = 0; b < n; b++) {
+            if(!w.reached[b]) continue;
+            uint64_t runs = 1;
+            for(int l = 0; l < w.num_loops; l++) {
+                if(w.loops[l].body[b]) runs = sat_mul(runs, w.loops[l].bound != NULL ? w.loops[l].bound->max : WCET_INF);
+            }
+            fprintf(out, "%5d  %3d-%-3d  %4u  %5d", b, w.start[b], w.end[b] - 1, ir->line[w.start[b]], w.end[b] - w.start[b]);
+            print_count(out, 9, runs);
+            print_count(out, 17, sat_mul(runs, w.end[b] - w.start[b]));
+            fputc('\n', out);
+        }
+
+        // loops are listed outermost first, in the order they appear
+        for(int b = 0; b < n; b++) {
+            for(int l = 0; l < w.num_loops; l++) {
+                const Loop *loop = &w.loops[l];
+                if(loop->header != b) continue;
+                fprintf(out, "Loop at line %u", ir->line[w.start[b]]);
+                if(loop->bound != NULL) fprintf(out, " runs %u..%u times,", loop->bound->min, loop->bound->max);
+                fprintf(out, " best %llu and worst", (unsigned long long) loop->best);
+                print_count(out, 0, loop->worst);
+                fprintf(out, " instructions per entry%s\n", loop->exits ? "" : ", and the program ends in it");
+            }
+        }
+
+        for(int i = 0; i < n; i++) member[i] = w.reached[i] && find_rep(&w, i) == i;
+        int entry = find_rep(&w, 0);
+        ok = walk_dag(&w, entry, member, -1);
+
+        uint64_t best = WCET_INF, worst = 0;
+        for(int k = 0; ok && k < w.order_len; k++) {
+            int from = w.order[k];
+            const Edges *edges = &w.edges[from];
+            for(int e = 0; e < edges->len; e++) {
+                if(find_rep(&w, edges->items[e].to) != n) continue;
+                uint64_t b = sat_add(w.best[from], edges->items[e].best);
+                uint64_t x = sat_add(w.worst[from], edges->items[e].worst);
+                if(b < best) best = b;
+                if(x > worst) worst = x;
+            }
+        }
+
+        if(!ok) {
+            fprintf(out, "Cannot analyze, the program has a cycle that is not a loop\n");
+        } else if(best == WCET_INF) {
+            fprintf(out, "The program never ends\n");
+            ok = false;
+        } else {
+            fprintf(out, "Best case %llu instructions, worst case", (unsigned long long) best);
+            print_count(out, 0, worst);
+            fprintf(out, " instructions\n");
+            ok = worst != WCET_INF;
+        }
+    }
+
+    free(target);
+    free(leader);
+    free(block_of);
+    free(member);
+    free_wcet(&w);
+    return ok && bounded;
+}
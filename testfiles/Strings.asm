@@ -0,0 +1,24 @@
+; Strings and character literals
+;
+; Delimiters inside quotes are part of the literal, they do not start a
+; comment or a label and do not split the operands
+
+.data
+text     BYTE    "a;b", ":[,"       ; six bytes
+quoted   BYTE    "\";"              ; an escaped quote then a semicolon
+chars    BYTE    ';', ':', '[', ','
+count    BYTE    ?
+
+.code
+            LOADI  A, 0              ; n = 0
+            LOADI  B, 0              ; i = 0
+Loop:       LOADF  C, [text + B]     ; C <- text[i]
+            LOADI  D, ';'            ; count the semicolons
+            CMP    C, D
+            BRNE   Next
+            ADDI   A, 1              ; n++
+Next:       ADDI   B, 1              ; i++
+            LOADI  D, count          ; D <- address of count
+            CMP    D, B              ; i < count ?
+            BRG    Loop              ; if yes, repeat the loop
+            STORE  [count], A        ; count = n
@@ -0,0 +1,5 @@
+; DUP groups nested deeper than the parser allows
+.data
+deep BYTE 1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(1 DUP(0))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))
+.code
+        NOOP
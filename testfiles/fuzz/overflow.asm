@@ -0,0 +1,12 @@
+; expressions whose arithmetic does not fit in 32 bits, each is reported as out of range
+.data
+big     BYTE 0x7fffffff*2
+        BYTE -(-2147483647-1)
+.equ WRAP, 0x7fffffff*2+2
+.code
+        LOADI A, (-2147483647-1)/-1
+        LOADI B, (-2147483647-1)%-1
+        LOADI C, 0x7fffffff*2
+        LOADI D, 0x7fffffff*2+2
+        LOADI A, 0-2147483647-2
+top:    JUMP top-2147483647-1